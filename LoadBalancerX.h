@@ -17,7 +17,22 @@
 #include<condition_variable>
 #include<map>
 #include<queue>
+#include<deque>
+#include<future>
+#include<atomic>
+#include<cstdint>
+#include<algorithm>
+#include<cmath>
+#include<type_traits>
+#include<utility>
+#if defined(__linux__)
+#include<pthread.h>
+#include<sched.h>
+#endif
 #include<iostream>
+#include<fstream>
+#include<string>
+#include<exception>
 
 namespace LoadBalanceLib
 {
@@ -52,12 +67,13 @@ namespace LoadBalanceLib
 	class GrainOfWork
 	{
 	public:
-		GrainOfWork():	workInit([](State s, GrainState&){}),
-						workInput([](State s, GrainState&){}),
-						workCompute([](State s, GrainState&){}),
-						workOutput([](State s, GrainState&){}),
-						workSync([](State s, GrainState&){}),
-						initialized(){ }
+		typedef State DeviceState;
+
+		// empty stage functions are not called
+		GrainOfWork():initialized(),grainState(),t1(),t2(){ }
+
+		// grain of a LoadBalancerX with a Kernel type: stages are static functions of Kernel, only grain state is kept per grain
+		explicit GrainOfWork(GrainState grainStatePrm):initialized(),grainState(grainStatePrm),t1(),t2(){ }
 
 		/*
 		 * workInitPrm: called only once per lifetime of LoadBalancerX instance, to initialize grain data / data inside device state (per device)
@@ -72,30 +88,37 @@ namespace LoadBalanceLib
 		 * 				workInputPrm, workComputePrm, workOutputPrm functions
 		 * 				user must synchronize each grain's work either in this function or in any other work__Prm function
 		 * 				this function is only given for extra readability and called last for every run() call for each grain
+		 * workReleasePrm: (optional) called when grain migrates away from a device in Mode::Affinity, to free what workInitPrm allocated for that device
+		 * 				workInitPrm is called again if grain comes back to the device later
 		 * grainStatePrm: internal state per grain to be used (if necessary)
 		 */
 		GrainOfWork(std::function<void(State, GrainState&)> workInitPrm,
 					std::function<void(State, GrainState&)> workInputPrm,
 					std::function<void(State, GrainState&)> workComputePrm,
 					std::function<void(State, GrainState&)> workOutputPrm,
-					std::function<void(State, GrainState&)> workSyncPrm
-				): initialized()
+					std::function<void(State, GrainState&)> workSyncPrm,
+					std::function<void(State, GrainState&)> workReleasePrm = nullptr
+				): initialized(),t1(),t2()
 		{
 			workInit=workInitPrm;
 			workInput=workInputPrm;
 			workCompute=workComputePrm;
 			workOutput=workOutputPrm;
 			workSync=workSyncPrm;
+			workRelease=workReleasePrm;
 		}
 
 		// called only once for life time
-		void init(State state, GrainState& gState){ if(workInit) workInit(state, gState);}
-		void input(State state, GrainState& gState){ if(workInput) workInput(state, gState);}
-		void compute(State state, GrainState& gState){ if(workCompute) workCompute(state, gState);}
-		void output(State state, GrainState& gState){ if(workOutput) workOutput(state, gState);}
-		void sync(State state, GrainState& gState){ if(workSync) workSync(state, gState);}
+		void init(const State & state, GrainState& gState){ if(workInit) workInit(state, gState);}
+		void input(const State & state, GrainState& gState){ if(workInput) workInput(state, gState);}
+		void compute(const State & state, GrainState& gState){ if(workCompute) workCompute(state, gState);}
+		void output(const State & state, GrainState& gState){ if(workOutput) workOutput(state, gState);}
+		void sync(const State & state, GrainState& gState){ if(workSync) workSync(state, gState);}
+		void release(const State & state, GrainState& gState){ if(workRelease) workRelease(state, gState);}
+		bool hasRelease(){ return (bool)workRelease; }
 		bool isReady(int deviceIndex){ return initialized.find(deviceIndex) != initialized.end(); }
 		void makeReady(int deviceIndex){ initialized[deviceIndex]=true; }
+		void makeUnready(int deviceIndex){ initialized.erase(deviceIndex); }
 
 		GrainState& refGrainState (){ return grainState; }
 
@@ -122,6 +145,10 @@ namespace LoadBalanceLib
 		// user must synchronize in this unless it is synchronized in other methods
 		std::function<void(State, GrainState&)> workSync;
 
+		// called when grain migrates away from a device (only in affinity mode)
+		// to release the per-device resources allocated in workInit
+		std::function<void(State, GrainState&)> workRelease;
+
 		std::map<int,bool> initialized;
 
 		GrainState grainState;
@@ -135,529 +162,5725 @@ namespace LoadBalanceLib
 	public:
 		ComputeDevice():state(){  }
 		ComputeDevice(State statePrm):state(statePrm){}
+
+		// identity: stable name of device (i.e. "RTX3090 PCI 0000:01:00.0") used as key in saved performance profiles
+		ComputeDevice(State statePrm, std::string identityPrm):state(statePrm),identity(identityPrm){}
 		State getState(){ return state; }
+		std::string getIdentity(){ return identity; }
 	private:
 		State state;
+		std::string identity;
 	};
 
-	template<typename GrainOfWork>
-	class Load
+	// stages of a grain, used for statistics
+	enum class Stage
+	{
+		Init=0,
+		Input,
+		Compute,
+		Output,
+		Sync
+	};
+
+	static const int numStages = 5;
+
+	/* default Kernel of LoadBalancerX: stage functions are the std::function objects given to each GrainOfWork
+	 * a user Kernel is a class with static stage functions shared by all grains, for example:
+	 * 		class MyKernel
+	 * 		{
+	 * 		public:
+	 * 			static void compute(const State & state, GrainState & grainState){ ... }
+	 * 		};
+	 * 		LoadBalancerX<State, GrainState, false, MyKernel> lb; lb.addWork(GrainOfWork<State, GrainState>(grainState));
+	 * any of init, input, compute, output, sync, release can be missing, missing stages compile to nothing
+	 * calls are direct (inlinable) and state is not copied
+	 * Kernel can also have range stages (inputRange, computeRange, outputRange, syncRange, see GrainSpan) to launch one batch of grains at once
+	 */
+	class FunctionKernel
+	{
+	};
+
+	// detection of static stage functions of a Kernel: call<Kernel>(state, grainState, 0) calls the stage if Kernel has it
+	class KernelInit
 	{
 	public:
-		int cmd; // 0:stop running, 1:compute
-		size_t start;
-		size_t grain;
-		bool pipelined;
-		GrainOfWork grainInfo;
+		template<typename K, typename S, typename G> static auto call(const S & s, G & g, int) -> decltype(K::init(s,g), void()) { K::init(s,g); }
+		template<typename K, typename S, typename G> static void call(const S &, G &, long) { }
+
+		template<typename K, typename S, typename G> static auto exists(int) -> decltype(K::init(std::declval<const S &>(),std::declval<G &>()), std::true_type());
+		template<typename K, typename S, typename G> static std::false_type exists(long);
 	};
 
-	class Response
+	class KernelInput
 	{
 	public:
-		int msg;
-		size_t ns;
+		template<typename K, typename S, typename G> static auto call(const S & s, G & g, int) -> decltype(K::input(s,g), void()) { K::input(s,g); }
+		template<typename K, typename S, typename G> static void call(const S &, G &, long) { }
+
+		template<typename K, typename S, typename G> static auto exists(int) -> decltype(K::input(std::declval<const S &>(),std::declval<G &>()), std::true_type());
+		template<typename K, typename S, typename G> static std::false_type exists(long);
 	};
 
-	// thread-safe queue
-	template<typename T, int sz>
-	class ThreadsafeQueue
+	class KernelCompute
 	{
 	public:
-		ThreadsafeQueue(){}
-		void push(T t)
-		{
-			std::unique_lock<std::mutex> lc(m);
-			q.push(t);
-			c.notify_one();
-		}
+		template<typename K, typename S, typename G> static auto call(const S & s, G & g, int) -> decltype(K::compute(s,g), void()) { K::compute(s,g); }
+		template<typename K, typename S, typename G> static void call(const S &, G &, long) { }
 
-		size_t size()
-		{
-			std::unique_lock<std::mutex> lc(m);
-			return q.size();
-		}
+		template<typename K, typename S, typename G> static auto exists(int) -> decltype(K::compute(std::declval<const S &>(),std::declval<G &>()), std::true_type());
+		template<typename K, typename S, typename G> static std::false_type exists(long);
+	};
 
-		T pop()
-		{
-			std::unique_lock<std::mutex> lc(m);
-			while(q.empty())
-			{
-				c.wait(lc);
-			}
-			T result = q.front();
-			q.pop();
-			return result;
-		}
-	private:
-		std::queue<T> q;
-		std::mutex m;
-		std::condition_variable c;
+	class KernelOutput
+	{
+	public:
+		template<typename K, typename S, typename G> static auto call(const S & s, G & g, int) -> decltype(K::output(s,g), void()) { K::output(s,g); }
+		template<typename K, typename S, typename G> static void call(const S &, G &, long) { }
+
+		template<typename K, typename S, typename G> static auto exists(int) -> decltype(K::output(std::declval<const S &>(),std::declval<G &>()), std::true_type());
+		template<typename K, typename S, typename G> static std::false_type exists(long);
 	};
 
-	template
-	<typename State, typename GrainState>
-	class FieldBlock
+	class KernelSync
 	{
 	public:
-		FieldBlock():initialized(false)
-		{
+		template<typename K, typename S, typename G> static auto call(const S & s, G & g, int) -> decltype(K::sync(s,g), void()) { K::sync(s,g); }
+		template<typename K, typename S, typename G> static void call(const S &, G &, long) { }
 
-		}
-		std::vector<ComputeDevice<State>> devices;
-		std::vector<GrainOfWork<State, GrainState>> totalWork;
+		template<typename K, typename S, typename G> static auto exists(int) -> decltype(K::sync(std::declval<const S &>(),std::declval<G &>()), std::true_type());
+		template<typename K, typename S, typename G> static std::false_type exists(long);
+	};
 
-		std::vector<double> performancesHistory;
-		std::vector<size_t> nsDev;
-		std::vector<size_t> grainDev;
-		std::vector<size_t> startDev;
-		std::vector<std::thread> thr;
-		std::vector<double> performances;
-		std::vector<std::shared_ptr<std::mutex>> mut;
-		std::vector<bool> running;
-		std::vector<bool> hasWork;
-		std::vector<bool> workComplete;
-		std::shared_ptr<std::mutex> mutGlobal;
-		bool initialized;
-		std::vector<std::shared_ptr<std::condition_variable>> cond;
-		std::vector<std::shared_ptr<ThreadsafeQueue<Load<GrainOfWork<State,GrainState>>,    100>>> loadQueue;
-		std::vector<std::shared_ptr<ThreadsafeQueue<Response,100>>> responseQueue;
+	class KernelRelease
+	{
+	public:
+		template<typename K, typename S, typename G> static auto call(const S & s, G & g, int) -> decltype(K::release(s,g), void()) { K::release(s,g); }
+		template<typename K, typename S, typename G> static void call(const S &, G &, long) { }
+
+		template<typename K, typename S, typename G> static auto exists(int) -> decltype(K::release(std::declval<const S &>(),std::declval<G &>()), std::true_type());
+		template<typename K, typename S, typename G> static std::false_type exists(long);
 	};
 
+	// grain states of a contiguous range of grains [first,last) given to range stage functions of a Kernel
+	template<typename GrainState>
+	class GrainSpan
+	{
+	public:
+		GrainSpan(GrainState * firstPrm, size_t stridePrm, size_t countPrm):first((char *)firstPrm),stride(stridePrm),count(countPrm){ }
+		GrainState & operator[](size_t k) const { return *(GrainState *)(first+k*stride); }
+		size_t size() const { return count; }
+	private:
+		char * first;
+		size_t stride; // bytes between consecutive grain states
+		size_t count;
+	};
 
-    template
-    <typename DeviceState, typename GrainState>
-    class GrainCache
-    {
-    public:
-    	GrainOfWork<DeviceState, GrainState> getGrain(	size_t id,
-    							std::function<void(DeviceState, GrainState&)> init,
-    							std::function<void(DeviceState, GrainState&)> input,
-    							std::function<void(DeviceState, GrainState&)> compute,
-    							std::function<void(DeviceState, GrainState&)> output,
-    							std::function<void(DeviceState, GrainState&)> sync
-    							)
-    	{
-    		auto it = grains.find(id);
-    		if(it!=grains.end())
-    		{
-    			it->second.workInit=init;
-    			it->second.workInput=input;
-    			it->second.workCompute=compute;
-    			it->second.workOutput=output;
-    			it->second.workSync=sync;
-    			return it->second;
-    		}
-    		else
-    		{
-    			grains[id]=GrainOfWork<DeviceState, GrainState>(init,input,compute,output,sync);
-    		}
-    		return grains.at(id);
-    	}
-    private:
-    	std::map<size_t,GrainOfWork<DeviceState, GrainState>> grains;
-    };
+	/* detection of range (batch) stage functions of a Kernel:
+	 * 		static void inputRange(const State & state, size_t first, size_t last, GrainSpan<GrainState> grainStates)
+	 * 		(same for computeRange, outputRange, syncRange)
+	 * a range stage is called once for each batch of contiguous grains instead of calling the grain stage once per grain
+	 */
+	class KernelInputRange
+	{
+	public:
+		template<typename K, typename S, typename G> static auto call(const S & s, size_t a, size_t b, GrainSpan<G> g, int) -> decltype(K::inputRange(s,a,b,g), void()) { K::inputRange(s,a,b,g); }
+		template<typename K, typename S, typename G> static void call(const S &, size_t, size_t, GrainSpan<G>, long) { }
+		template<typename K, typename S, typename G> static auto exists(int) -> decltype(K::inputRange(std::declval<const S &>(),0,0,std::declval<GrainSpan<G>>()), std::true_type());
+		template<typename K, typename S, typename G> static std::false_type exists(long);
+	};
 
+	class KernelComputeRange
+	{
+	public:
+		template<typename K, typename S, typename G> static auto call(const S & s, size_t a, size_t b, GrainSpan<G> g, int) -> decltype(K::computeRange(s,a,b,g), void()) { K::computeRange(s,a,b,g); }
+		template<typename K, typename S, typename G> static void call(const S &, size_t, size_t, GrainSpan<G>, long) { }
+		template<typename K, typename S, typename G> static auto exists(int) -> decltype(K::computeRange(std::declval<const S &>(),0,0,std::declval<GrainSpan<G>>()), std::true_type());
+		template<typename K, typename S, typename G> static std::false_type exists(long);
+	};
 
-	// GPGPU load balancing tool
-	// distributes work between different graphics cards
-	// in a way that minimizes total computation time
-	template
-	<typename State, typename GrainState>
-	class LoadBalancerX
+	class KernelOutputRange
 	{
 	public:
-		LoadBalancerX() // mutGlobal(std::make_shared<std::mutex>()),initialized(false)
+		template<typename K, typename S, typename G> static auto call(const S & s, size_t a, size_t b, GrainSpan<G> g, int) -> decltype(K::outputRange(s,a,b,g), void()) { K::outputRange(s,a,b,g); }
+		template<typename K, typename S, typename G> static void call(const S &, size_t, size_t, GrainSpan<G>, long) { }
+		template<typename K, typename S, typename G> static auto exists(int) -> decltype(K::outputRange(std::declval<const S &>(),0,0,std::declval<GrainSpan<G>>()), std::true_type());
+		template<typename K, typename S, typename G> static std::false_type exists(long);
+	};
+
+	class KernelSyncRange
+	{
+	public:
+		template<typename K, typename S, typename G> static auto call(const S & s, size_t a, size_t b, GrainSpan<G> g, int) -> decltype(K::syncRange(s,a,b,g), void()) { K::syncRange(s,a,b,g); }
+		template<typename K, typename S, typename G> static void call(const S &, size_t, size_t, GrainSpan<G>, long) { }
+		template<typename K, typename S, typename G> static auto exists(int) -> decltype(K::syncRange(std::declval<const S &>(),0,0,std::declval<GrainSpan<G>>()), std::true_type());
+		template<typename K, typename S, typename G> static std::false_type exists(long);
+	};
+
+	// calls stage functions of grains through Kernel
+	template<typename Kernel, typename State, typename GrainState>
+	class KernelStages
+	{
+	public:
+		static const bool hasInputRange = decltype(KernelInputRange::exists<Kernel,State,GrainState>(0))::value;
+		static const bool hasComputeRange = decltype(KernelComputeRange::exists<Kernel,State,GrainState>(0))::value;
+		static const bool hasOutputRange = decltype(KernelOutputRange::exists<Kernel,State,GrainState>(0))::value;
+		static const bool hasSyncRange = decltype(KernelSyncRange::exists<Kernel,State,GrainState>(0))::value;
+
+		// true when grains are computed in batches (Kernel has at least one range stage)
+		static const bool batched = hasInputRange || hasComputeRange || hasOutputRange || hasSyncRange;
+
+		// false when Kernel has neither grain nor range function for stage (stage is skipped without visiting grains)
+		static bool hasStage(Stage stage)
 		{
-			fields=std::make_shared<FieldBlock<State, GrainState>>();
-			fields->mutGlobal=std::make_shared<std::mutex>();
-			runCount=0;
+			switch(stage)
+			{
+				case Stage::Init: return decltype(KernelInit::exists<Kernel,State,GrainState>(0))::value;
+				case Stage::Input: return hasInputRange || decltype(KernelInput::exists<Kernel,State,GrainState>(0))::value;
+				case Stage::Compute: return hasComputeRange || decltype(KernelCompute::exists<Kernel,State,GrainState>(0))::value;
+				case Stage::Output: return hasOutputRange || decltype(KernelOutput::exists<Kernel,State,GrainState>(0))::value;
+				case Stage::Sync: return hasSyncRange || decltype(KernelSync::exists<Kernel,State,GrainState>(0))::value;
+				default: return true;
+			}
 		}
 
-		~LoadBalancerX()
+		static bool hasRange(Stage stage)
 		{
+			switch(stage)
+			{
+				case Stage::Input: return hasInputRange;
+				case Stage::Compute: return hasComputeRange;
+				case Stage::Output: return hasOutputRange;
+				case Stage::Sync: return hasSyncRange;
+				default: return false;
+			}
+		}
 
-			for(size_t i=0; i<fields->thr.size(); i++)
+		static void callRange(Stage stage, const State & state, size_t first, size_t last, GrainSpan<GrainState> grainStates)
+		{
+			switch(stage)
 			{
-				fields->loadQueue[i]->push(Load<GrainOfWork<State,GrainState>>({0,0,0}));
+				case Stage::Input: KernelInputRange::call<Kernel>(state, first, last, grainStates, 0); break;
+				case Stage::Compute: KernelComputeRange::call<Kernel>(state, first, last, grainStates, 0); break;
+				case Stage::Output: KernelOutputRange::call<Kernel>(state, first, last, grainStates, 0); break;
+				case Stage::Sync: KernelSyncRange::call<Kernel>(state, first, last, grainStates, 0); break;
+				default: break;
 			}
+		}
 
-			for(size_t i=0; i<fields->thr.size(); i++)
+		template<typename Functions>
+		static void call(Stage stage, const State & state, Functions &, GrainState & gState)
+		{
+			switch(stage)
 			{
-				fields->thr[i].join();
+				case Stage::Init: KernelInit::call<Kernel>(state, gState, 0); break;
+				case Stage::Input: KernelInput::call<Kernel>(state, gState, 0); break;
+				case Stage::Compute: KernelCompute::call<Kernel>(state, gState, 0); break;
+				case Stage::Output: KernelOutput::call<Kernel>(state, gState, 0); break;
+				case Stage::Sync: KernelSync::call<Kernel>(state, gState, 0); break;
 			}
 		}
 
-		void addWork(GrainOfWork<State, GrainState> work)
+		template<typename Functions>
+		static void release(const State & state, Functions &, GrainState & gState)
 		{
-			std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
-			fields->totalWork.push_back(work);
+			KernelRelease::call<Kernel>(state, gState, 0);
 		}
-		void addDevice(ComputeDevice<State> devPrm)
+
+		template<typename Functions>
+		static bool hasRelease(Functions &)
 		{
-			size_t indexThr;
-			{
-				std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
-				fields->initialized=false;
-				fields->loadQueue.push_back(    std::make_shared<ThreadsafeQueue<Load<GrainOfWork<State,GrainState>>,    100>>());
-				fields->responseQueue.push_back(std::make_shared<ThreadsafeQueue<Response,100>>());
-				indexThr = fields->thr.size();
+			return decltype(KernelRelease::exists<Kernel,State,GrainState>(0))::value;
+		}
+	};
 
-				fields->mut.push_back(std::make_shared<std::mutex>());
-				fields->cond.push_back(std::make_shared<std::condition_variable>());
-				{
-					std::unique_lock<std::mutex> lg(*(fields->mut[indexThr]));
-					fields->devices.push_back(devPrm);
-					fields->running.push_back(true);
-					fields->hasWork.push_back(false);
-					fields->workComplete.push_back(true);
+	// std::function adapter: calls the functions stored in each grain
+	template<typename State, typename GrainState>
+	class KernelStages<FunctionKernel, State, GrainState>
+	{
+	public:
+		static const bool batched = false;
 
-					fields->performances.push_back(1.0);
-					fields->nsDev.push_back(1);
-					fields->grainDev.push_back(1);
-					fields->startDev.push_back(0);
-				}
+		static bool hasStage(Stage){ return true; }
+
+		static bool hasRange(Stage){ return false; }
 
+		static void callRange(Stage, const State &, size_t, size_t, GrainSpan<GrainState>){ }
+
+		// functions: GrainOfWork (single grains) or StoredFunctions (total work)
+		template<typename Functions>
+		static void call(Stage stage, const State & state, Functions & functions, GrainState & gState)
+		{
+			switch(stage)
+			{
+				case Stage::Init: functions.init(state, gState); break;
+				case Stage::Input: functions.input(state, gState); break;
+				case Stage::Compute: functions.compute(state, gState); break;
+				case Stage::Output: functions.output(state, gState); break;
+				case Stage::Sync: functions.sync(state, gState); break;
 			}
+		}
 
-			fields->thr.push_back(std::thread([&,indexThr](){
+		template<typename Functions>
+		static void release(const State & state, Functions & functions, GrainState & gState)
+		{
+			functions.release(state, gState);
+		}
 
-				State state;
-				{
-					std::unique_lock<std::mutex> lg(*(fields->mut[indexThr]));
-					state = fields->devices[indexThr].getState();
-				}
-				bool isRunning = true;
-				bool hasWrk = false;
-				bool init=false;
-				bool pipelined=false;
-				size_t start = 0;
-				size_t grain = 0;
+		template<typename Functions>
+		static bool hasRelease(Functions & functions)
+		{
+			return functions.hasRelease();
+		}
+	};
 
+	inline const char * stageName(Stage stage)
+	{
+		static const char * names[numStages] = {"init","input","compute","output","sync"};
+		return names[(int)stage];
+	}
 
-				while(!init)
-				{
-					{
-						std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
-						init=fields->initialized;
-					}
-				}
+	inline size_t nowNanoseconds()
+	{
+		return std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
 
+	// lock-free latency histogram, 4 sub-buckets per power of 2 (percentiles have less than 19% error)
+	class LatencyHistogram
+	{
+	public:
+		static const int numBuckets = 256;
 
-				while(isRunning)
-				{
+		LatencyHistogram(){ reset(); }
 
+		void add(size_t ns)
+		{
+			buckets[bucketOf(ns)].fetch_add(1,std::memory_order_relaxed);
+			count.fetch_add(1,std::memory_order_relaxed);
+			total.fetch_add(ns,std::memory_order_relaxed);
+			size_t m = maximum.load(std::memory_order_relaxed);
+			while(ns>m && !maximum.compare_exchange_weak(m,ns,std::memory_order_relaxed)){ }
+		}
 
-					Load<GrainOfWork<State,GrainState>> load = fields->loadQueue[indexThr]->pop();
-					if(load.cmd>0)
-					{
-						start = load.start;
-						grain = load.grain;
-						pipelined=load.pipelined;
+		// upper bound of bucket that has p-th fraction of samples (p in [0,1])
+		size_t percentile(double p) const
+		{
+			const size_t n = count.load(std::memory_order_relaxed);
+			if(n==0)
+				return 0;
+			const size_t target = (size_t)(p*n)<n ? (size_t)(p*n)+1 : n;
+			size_t accumulated = 0;
+			for(int i=0;i<numBuckets;i++)
+			{
+				accumulated += buckets[i].load(std::memory_order_relaxed);
+				if(accumulated>=target)
+				{
+					return std::min(upperBoundOf(i),maximum.load(std::memory_order_relaxed));
+				}
+			}
+			return maximum.load(std::memory_order_relaxed);
+		}
 
-						// single work sync request
-						if(load.cmd==3)
-						{
+		size_t getCount() const { return count.load(std::memory_order_relaxed); }
+		size_t getTotal() const { return total.load(std::memory_order_relaxed); }
+		size_t getMaximum() const { return maximum.load(std::memory_order_relaxed); }
 
-							GrainOfWork<State,GrainState> grainInfo = load.grainInfo;
-							grainInfo.sync(state, grainInfo.refGrainState()); // user must synchronize in this unless it is synchronized in other methods
-							grainInfo.t2=std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::high_resolution_clock::now().time_since_epoch());
-							fields->responseQueue[indexThr]->push(Response({1,grainInfo.t2.count()-grainInfo.t1.count()}));
-						}
+		void reset()
+		{
+			for(int i=0;i<numBuckets;i++)
+				buckets[i].store(0,std::memory_order_relaxed);
+			count.store(0,std::memory_order_relaxed);
+			total.store(0,std::memory_order_relaxed);
+			maximum.store(0,std::memory_order_relaxed);
+		}
+	private:
+		static int bucketOf(size_t ns)
+		{
+			if(ns<4)
+				return (int)ns;
+			int msb = 63;
+			while(!(ns>>msb))
+				msb--;
+			const int sub = (int)((ns>>(msb-2))&3);
+			return std::min(numBuckets-1, (msb-1)*4 + sub);
+		}
 
-						// single work request
-						if(load.cmd==2)
-						{
+		static size_t upperBoundOf(int bucket)
+		{
+			if(bucket<4)
+				return bucket;
+			const int msb = bucket/4 + 1;
+			const size_t sub = bucket%4;
+			if(msb>=63)
+				return (size_t)-1;
+			return ((4+sub+1)<<(msb-2))-1;
+		}
 
-							size_t elapsedDevice = 0;
-							{
+		std::atomic<size_t> buckets[numBuckets];
+		std::atomic<size_t> count;
+		std::atomic<size_t> total;
+		std::atomic<size_t> maximum;
+	};
 
-								start = load.start;
-								grain = load.grain; // 1
-								GrainOfWork<State,GrainState> grainInfo = load.grainInfo;
-								grainInfo.t1=std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::high_resolution_clock::now().time_since_epoch());
-								if(!grainInfo.isReady(indexThr))
-								{
-									grainInfo.init(state, grainInfo.refGrainState()); // user should have asynchronous launch in this
-									grainInfo.makeReady(indexThr);
-								}
-								grainInfo.input(state, grainInfo.refGrainState()); // user should have asynchronous launch in this
-								grainInfo.compute(state, grainInfo.refGrainState()); // user should have asynchronous launch in this
-								grainInfo.output(state, grainInfo.refGrainState()); // user should have asynchronous launch in this
+	// hot-path statistics of a device thread (and worker threads of a composite device), readable at any time
+	class DeviceStats
+	{
+	public:
+		DeviceStats(){ reset(); }
 
-								// creates a self-sync command at the end of queue (to let others run asynchronously)
-								fields->loadQueue[indexThr]->push(Load<GrainOfWork<State,GrainState>>({3,0,0,false,grainInfo}));
-							}
+		void reset()
+		{
+			for(int i=0;i<numStages;i++)
+				stage[i].reset();
+			grains.store(0,std::memory_order_relaxed);
+			idleNs.store(0,std::memory_order_relaxed);
+			queueHighWater.store(0,std::memory_order_relaxed);
+		}
 
+		LatencyHistogram stage[numStages];
+		std::atomic<size_t> grains; // grains completed (sync called, a range sync covers all grains of its batch), items of range chunks (see LoadBalancerX::addRange) included
+		std::atomic<size_t> idleNs; // time spent waiting for a load
+		std::atomic<size_t> queueHighWater; // maximum number of loads found in queue
+	};
 
+	// latency summary of a stage
+	class StageLatency
+	{
+	public:
+		size_t calls;
+		size_t totalNs;
+		size_t p50Ns;
+		size_t p99Ns;
+		size_t maxNs;
+	};
 
-							continue;
-						}
+	// copy of statistics of a device at a point in time
+	class DeviceStatsSnapshot
+	{
+	public:
+		StageLatency stage[numStages]; // indexed by (int)Stage
+		size_t grains;
+		size_t initCalls;
+		size_t idleNs;
+		size_t queueHighWater;
+	};
 
-						hasWrk=true;
-					}
-					else if(load.cmd==0)
-					{
-						isRunning=false;
-						hasWrk=false;
-					}
+	// records statistics only when Enabled=true, compiles to nothing otherwise
+	template<bool Enabled>
+	class StatsRecorder
+	{
+	public:
+		static size_t now(){ return nowNanoseconds(); }
+		// completed: number of grains (or range items) finished by the call
+		static void stage(DeviceStats & stats, Stage st, size_t t0, size_t t1, size_t completed)
+		{
+			stats.stage[(int)st].add(t1-t0);
+			if(completed>0)
+				stats.grains.fetch_add(completed,std::memory_order_relaxed);
+		}
+		static void idle(DeviceStats & stats, size_t t0, size_t queueSize)
+		{
+			stats.idleNs.fetch_add(nowNanoseconds()-t0,std::memory_order_relaxed);
+			if(queueSize>stats.queueHighWater.load(std::memory_order_relaxed))
+				stats.queueHighWater.store(queueSize,std::memory_order_relaxed);
+		}
+	};
 
+	template<>
+	class StatsRecorder<false>
+	{
+	public:
+		static size_t now(){ return 0; }
+		static void stage(DeviceStats &, Stage, size_t, size_t, size_t){ }
+		static void idle(DeviceStats &, size_t, size_t){ }
+	};
 
-					if(hasWrk && isRunning)
-					{
-						hasWrk=false;
-						// compute grain
-						size_t elapsedDevice;
-						{
-							Bench benchDevice(&elapsedDevice);
-							if(grain>0)
-							{
-								const size_t first = start;
-								const size_t last = first+grain;
-								for(size_t j=first; j<last; j++)
-								{
-									if(!fields->totalWork[j].isReady(indexThr))
-									{
-										fields->totalWork[j].init(state, fields->totalWork[j].refGrainState()); // user should have asynchronous launch in this
-										fields->totalWork[j].makeReady(indexThr);
-									}
-								}
+	// single timeline event of a device thread or host thread
+	class TraceEvent
+	{
+	public:
+		int kind; // 0-4: (int)Stage, 5: run() call on host, 6: grains assigned to a device by run()
+		size_t device;
+		size_t grain; // grain index (first item for chunks of ranges) or number of assigned grains, -1 for grains of runSingleAsync
+		size_t begin;
+		size_t end;
+		size_t run;
+	};
 
-								if(!pipelined || grain<3)
-								{
+	// preallocated ring of trace events, written without locking by a device thread (and by worker threads of a composite device)
+	// only the latest events are kept when it overflows
+	// each slot is published by its sequence number, so a reader skips events that are being written instead of reading them torn
+	class TraceBuffer
+	{
+	public:
+		TraceBuffer(size_t capacity):slots(capacity>0?capacity:1),written(0){ }
 
+		size_t capacity() const { return slots.size(); }
 
-									for(size_t j=first; j<last; j++)
-									{
-										fields->totalWork[j].input(state, fields->totalWork[j].refGrainState()); // user should have asynchronous launch in this
-									}
+		void add(int kind, size_t device, size_t grain, size_t begin, size_t end, size_t run)
+		{
+			const size_t index = written.fetch_add(1,std::memory_order_relaxed);
+			Slot & slot = slots[index % slots.size()];
 
-									for(size_t j=first; j<last; j++)
-									{
-										fields->totalWork[j].compute(state, fields->totalWork[j].refGrainState()); // user should have asynchronous launch in this
-									}
+			// slot is claimed only if it holds an older event, a writer that is lapped by others while writing drops its event
+			// fields are release stores: a reader that sees a field of a newer writer also sees that its claim changed seq
+			size_t seq = slot.seq.load(std::memory_order_relaxed);
+			if((seq&1) || seq>=2*index+1 || !slot.seq.compare_exchange_strong(seq,2*index+1,std::memory_order_relaxed))
+				return;
+			slot.kind.store(kind,std::memory_order_release);
+			slot.device.store(device,std::memory_order_release);
+			slot.grain.store(grain,std::memory_order_release);
+			slot.begin.store(begin,std::memory_order_release);
+			slot.end.store(end,std::memory_order_release);
+			slot.run.store(run,std::memory_order_release);
+			slot.seq.store(2*index+2,std::memory_order_release);
+		}
 
-									for(size_t j=first; j<last; j++)
+		// events that are being written (or overwritten) while reading are skipped
+		template<typename Func>
+		void forEach(Func f) const
+		{
+			const size_t total = written.load();
+			const size_t n = std::min(total,slots.size());
+			for(size_t i=total-n;i<total;i++)
+			{
+				const Slot & slot = slots[i % slots.size()];
+				const size_t seq = slot.seq.load(std::memory_order_acquire);
+				if(seq!=2*i+2)
+					continue;
+				TraceEvent e;
+				e.kind=slot.kind.load(std::memory_order_acquire);
+				e.device=slot.device.load(std::memory_order_acquire);
+				e.grain=slot.grain.load(std::memory_order_acquire);
+				e.begin=slot.begin.load(std::memory_order_acquire);
+				e.end=slot.end.load(std::memory_order_acquire);
+				e.run=slot.run.load(std::memory_order_acquire);
+				if(slot.seq.load(std::memory_order_relaxed)==seq)
+				{
+					f(e);
+				}
+			}
+		}
+	private:
+		// seq: 2*index+1 while event of index is written, 2*index+2 after it is published (0 = empty)
+		class Slot
+		{
+		public:
+			std::atomic<size_t> seq;
+			std::atomic<int> kind;
+			std::atomic<size_t> device;
+			std::atomic<size_t> grain;
+			std::atomic<size_t> begin;
+			std::atomic<size_t> end;
+			std::atomic<size_t> run;
+		};
+		std::vector<Slot> slots;
+		std::atomic<size_t> written;
+	};
+
+	// writes trace events in Chrome Trace Event format (loadable in chrome://tracing and Perfetto)
+	// device threads are shown as tid 0..numDevices-1, host thread as tid numDevices
+	inline void writeChromeTraceEvents(std::ostream & out, const std::vector<std::shared_ptr<TraceBuffer>> & deviceBuffers,
+										const TraceBuffer & hostBuffer, size_t origin)
+	{
+		const size_t hostTid = deviceBuffers.size();
+		bool first = true;
+		out<<"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		for(size_t i=0;i<=hostTid;i++)
+		{
+			out<<(first?"":",")<<"\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"<<i<<",\"args\":{\"name\":\"";
+			if(i<hostTid)
+				out<<"device-"<<i;
+			else
+				out<<"host";
+			out<<"\"}}";
+			first=false;
+		}
+
+		auto micro = [origin](size_t ns){ return (ns>origin?ns-origin:0)/1000.0; };
+		auto writeEvent = [&](const TraceEvent & e){
+			if(e.kind<numStages)
+			{
+				out<<",\n{\"name\":\""<<stageName((Stage)e.kind)<<"\",\"cat\":\"grain\",\"ph\":\"X\",\"pid\":0,\"tid\":"<<e.device
+				   <<",\"ts\":"<<micro(e.begin)<<",\"dur\":"<<(e.end-e.begin)/1000.0<<",\"args\":{\"grain\":";
+				if(e.grain==(size_t)-1)
+					out<<"\"single\"";
+				else
+					out<<e.grain;
+				out<<",\"run\":"<<e.run<<"}}";
+			}
+			else if(e.kind==numStages)
+			{
+				out<<",\n{\"name\":\"run\",\"cat\":\"balancer\",\"ph\":\"X\",\"pid\":0,\"tid\":"<<hostTid
+				   <<",\"ts\":"<<micro(e.begin)<<",\"dur\":"<<(e.end-e.begin)/1000.0<<",\"args\":{\"run\":"<<e.run<<"}}";
+			}
+			else
+			{
+				out<<",\n{\"name\":\"grains of device-"<<e.device<<"\",\"cat\":\"balancer\",\"ph\":\"C\",\"pid\":0,\"tid\":"<<hostTid
+				   <<",\"ts\":"<<micro(e.begin)<<",\"args\":{\"grains\":"<<e.grain<<"}}";
+			}
+		};
+		for(size_t i=0;i<deviceBuffers.size();i++)
+		{
+			if(deviceBuffers[i])
+				deviceBuffers[i]->forEach(writeEvent);
+		}
+		hostBuffer.forEach(writeEvent);
+		out<<"\n]}\n";
+	}
+
+	// scheduling mode of run()
+	// Static: each device gets one contiguous range computed from smoothed performances
+	// WorkStealing: each device starts with its range of the performance split (as in Static), after finishing it steals chunks from back of slowest peer's range
+	// Affinity: grains stay on the device that initialized them, only the minimum number of grains migrate to follow new performance ratios
+	// Graph: grains are dispatched one by one as soon as all grains they depend on are complete (see addWork with dependencies)
+	enum class Mode
+	{
+		Static,
+		WorkStealing,
+		Affinity,
+		Graph
+	};
+
+	// completion flags of devices for a run, used to order overlapping runs
+	class RunCompletion
+	{
+	public:
+		RunCompletion(size_t numDevices):waitList(numDevices),done(numDevices,false){ }
+
+		void markDone(size_t device)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			done[device]=true;
+			c.notify_all();
+		}
+
+		void waitDone(size_t device)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			while(!done[device])
+			{
+				c.wait(lg);
+			}
+		}
+
+		// waits at most timeoutNs (0 = forever), returns false on timeout
+		bool waitDone(size_t device, size_t timeoutNs)
+		{
+			if(timeoutNs==0)
+			{
+				waitDone(device);
+				return true;
+			}
+			std::unique_lock<std::mutex> lg(m);
+			return c.wait_for(lg, std::chrono::nanoseconds(timeoutNs), [&]{ return (bool)done[device]; });
+		}
+
+		bool isDone(size_t device)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			return done[device];
+		}
+
+		// devices of previous run that must complete before device i starts (their ranges overlap range of device i)
+		std::vector<std::vector<size_t>> waitList;
+	private:
+		std::mutex m;
+		std::condition_variable c;
+		std::vector<bool> done;
+	};
+
+	// deadline of a load: device does not start a grain that is predicted to finish after time point end (nanoseconds, see nowNanoseconds)
+	class DeadlineSignal
+	{
+	public:
+		DeadlineSignal(size_t endPrm, size_t totWrk, size_t totDev):end(endPrm),completed(totWrk,0),grainNs(totDev,0){ }
+		bool expired(size_t device) const { return nowNanoseconds()+grainNs[device]>=end; }
+
+		size_t end;
+		std::vector<uint8_t> completed; // 1 after sync of grain (each grain is written only by the thread that computes it)
+		std::vector<size_t> grainNs; // predicted time of a grain in each device (0 before first measurement)
+	};
+
+	// index space [0,n) computed in parallel by all devices (see LoadBalancerX::addRange)
+	template<typename State>
+	class RangeWork
+	{
+	public:
+		size_t n;
+		double overheadFraction;
+		std::function<void(State, size_t, size_t)> body; // computes items [first,last)
+	};
+
+	// items [first,first+count) of range
+	class RangeChunk
+	{
+	public:
+		size_t range;
+		size_t first;
+		size_t count;
+	};
+
+	/* progress of ranges in a run, shared by device threads
+	 * devices take chunks from front of each range, chunk of a failed (or timed out) device is taken by others
+	 * shares: share of each device in total range throughput (chunks shrink near end of range in proportion to it)
+	 * previous: ranges of previous run still in flight, devices start after all its loads end
+	 */
+	template<typename State>
+	class RangeRun
+	{
+	public:
+		RangeRun(std::vector<std::shared_ptr<RangeWork<State>>> worksPrm, std::vector<double> sharesPrm, std::shared_ptr<RangeRun> previousPrm):
+			works(worksPrm),shares(sharesPrm),previous(previousPrm),loaded(sharesPrm.size(),false),probe(sharesPrm.size(),0),
+			cursor(worksPrm.size(),0),current(sharesPrm.size(),RangeChunk({0,0,0})),dropped(sharesPrm.size(),false),pending(sharesPrm.size(),0),
+			total(0),done(0),open(0)
+		{
+			for(const auto & work:works)
+			{
+				total+=work->n;
+			}
+		}
+
+		size_t remaining(size_t r)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			return works[r]->n-cursor[r];
+		}
+
+		// takes next chunk of at most maxCount items of range r, returns false if range is empty or device is dropped
+		bool take(size_t device, size_t r, size_t maxCount, size_t & first, size_t & count)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			if(dropped[device] || cursor[r]>=works[r]->n)
+				return false;
+			first=cursor[r];
+			count=std::min(std::max((size_t)1,maxCount),works[r]->n-cursor[r]);
+			cursor[r]+=count;
+			current[device]=RangeChunk({r,first,count});
+			return true;
+		}
+
+		// takes a chunk of a failed device, returns false if there is none
+		bool takeLost(size_t device, RangeChunk & chunk)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			if(dropped[device] || lost.empty())
+				return false;
+			chunk=lost.back();
+			lost.pop_back();
+			current[device]=chunk;
+			return true;
+		}
+
+		// chunk in progress of device is computed
+		void finish(size_t device)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			if(!dropped[device])
+			{
+				done+=current[device].count;
+			}
+			current[device].count=0;
+		}
+
+		// chunk in progress of device threw, it is given to other devices
+		void fail(size_t device)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			if(!dropped[device] && current[device].count>0)
+			{
+				lost.push_back(current[device]);
+			}
+			current[device].count=0;
+		}
+
+		// (host) device timed out: it does not take any more chunks and its loads count as ended
+		// redispatch: its chunk in progress is given to other devices (otherwise the chunk is left to the hung device and range is not complete)
+		void drop(size_t device, bool redispatch)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			if(dropped[device])
+				return;
+			if(current[device].count>0 && redispatch)
+			{
+				lost.push_back(current[device]);
+			}
+			dropped[device]=true;
+			open-=pending[device];
+			pending[device]=0;
+			c.notify_all();
+		}
+
+		// all items are computed
+		bool complete()
+		{
+			std::unique_lock<std::mutex> lg(m);
+			return done==total;
+		}
+
+		// (host) a load of device is queued
+		void startLoad(size_t device)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			loaded[device]=true;
+			if(!dropped[device])
+			{
+				pending[device]++;
+				open++;
+			}
+		}
+
+		// load of device ended (computed or failed)
+		void endLoad(size_t device)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			if(!dropped[device] && pending[device]>0)
+			{
+				pending[device]--;
+				open--;
+				c.notify_all();
+			}
+		}
+
+		bool finished()
+		{
+			std::unique_lock<std::mutex> lg(m);
+			return open==0;
+		}
+
+		void waitFinished()
+		{
+			std::unique_lock<std::mutex> lg(m);
+			while(open>0)
+			{
+				c.wait(lg);
+			}
+		}
+
+		const std::vector<std::shared_ptr<RangeWork<State>>> works;
+		const std::vector<double> shares;
+		const std::shared_ptr<RangeRun> previous;
+		std::vector<bool> loaded; // devices that got a load (host only)
+		std::vector<uint8_t> probe; // 1: quarantined device computes a single chunk (set by host before its load is queued)
+	private:
+		std::mutex m;
+		std::condition_variable c;
+		std::vector<size_t> cursor;
+		std::vector<RangeChunk> current;
+		std::vector<RangeChunk> lost;
+		std::vector<bool> dropped;
+		std::vector<size_t> pending;
+		size_t total;
+		size_t done;
+		size_t open;
+	};
+
+	// failure of a device during a run (see LoadBalancerX::getRunErrors and RunResult::errors)
+	class RunError
+	{
+	public:
+		size_t device;
+		size_t grain; // grain whose stage function threw (first grain of batch for range stages), (size_t)-1 if not known
+		int stage; // Stage of the call that threw, -1 if not known
+		bool timeout; // device did not respond within DeviceOptions::watchdogNs, its late load may still be writing grains that later runs compute too
+		bool recovered; // grains of the failed load were computed by other devices in same run (never after a timeout without redispatchOnTimeout)
+		std::exception_ptr exception; // thrown object (nullptr for timeout), can be rethrown with std::rethrow_exception
+	};
+
+	// result of a run started by LoadBalancerX::runAsync
+	class RunResult
+	{
+	public:
+		size_t elapsed; // nanoseconds from dispatch to completion of last device
+		std::vector<size_t> nsDev; // time spent by each device (0 for devices without work)
+		std::vector<size_t> grainDev; // number of grains computed by each device
+		std::vector<size_t> itemDev; // number of range items (see LoadBalancerX::addRange) computed by each device
+		std::vector<RunError> errors; // failed devices of run (empty when all grains are computed without exception and timeout)
+									  // a timed out device can still be computing grains of this run while later runs compute them (see runAsync)
+	};
+
+	// dispatched run whose responses are not collected yet
+	template<typename State>
+	class PendingRun
+	{
+	public:
+		size_t ticket;
+		size_t begin;
+		size_t traceRun;
+		bool pipelined;
+		std::vector<size_t> startDev;
+		std::vector<size_t> grainDev;
+		std::shared_ptr<RunCompletion> completion;
+		std::shared_ptr<RangeRun<State>> ranges; // nullptr if there is no range
+		std::shared_ptr<std::promise<RunResult>> result; // future of runAsync, set when run is collected
+	};
+
+	// run of runAsync for background collector: devices that got a load and their watchdog (0 = none)
+	class RunToCollect
+	{
+	public:
+		size_t ticket;
+		std::shared_ptr<RunCompletion> completion;
+		std::vector<size_t> devices;
+		std::vector<size_t> watchdogNs;
+	};
+
+	/* chunk size of a range in a device
+	 * time of a chunk is modeled as overhead + perItem*items from smoothed times of current size and half of it
+	 * size doubles while overhead is more than overheadFraction of chunk time (or not measurable yet)
+	 */
+	class ChunkTuner
+	{
+	public:
+		// initial: first chunk size (number of workers of a composite device, so that every chunk is divided between workers)
+		ChunkTuner(size_t initial = 1):current(std::max((size_t)1,initial)),samples(0),timeCurrent(0.0),timeHalf(0.0){ }
+
+		size_t size() const { return current; }
+
+		// measured time of a chunk, chunks of other sizes (shrunk near end of range) are ignored
+		void measure(size_t items, size_t ns, double overheadFraction)
+		{
+			if(items!=current)
+				return;
+			timeCurrent = (samples==0) ? ns : 0.5*timeCurrent+0.5*ns;
+			if(++samples<2)
+				return;
+
+			// t(c) = overhead + perItem*c, t(c/2) = overhead + perItem*c/2
+			bool grow = true;
+			if(timeHalf>0.0)
+			{
+				const double perHalf = timeCurrent-timeHalf;
+				const double overhead = timeCurrent-2.0*perHalf;
+				grow = perHalf<=0.0 || overhead>overheadFraction*timeCurrent;
+			}
+			if(grow)
+			{
+				timeHalf=timeCurrent;
+				current*=2;
+				samples=0;
+			}
+		}
+	private:
+		size_t current;
+		size_t samples;
+		double timeCurrent;
+		double timeHalf;
+	};
+
+	template<typename GrainOfWork>
+	class Load
+	{
+	public:
+		int cmd; // 0:stop running, 1:compute, 2:single grain, 3:single grain sync, 4:compute with work stealing, 5:release migrated grains, 6:compute assigned grain list, 7:graph grain, 8:release all grains and stop, 9:compute deadline grain list, 10:compute range chunks
+		size_t start;
+		size_t grain;
+		bool pipelined;
+		GrainOfWork * grainInfo; // single grain (cmd 2 and 3), not copied into queue
+		bool ownsGrain; // grainInfo is deleted after sync when true
+		std::shared_ptr<RunCompletion> completion; // marked when device completes its range (cmd 1)
+		std::shared_ptr<RunCompletion> dependency; // previous run still in flight, device waits for devices in completion->waitList first
+		size_t ticket; // run of the load, copied to its response
+		std::exception_ptr error; // exception thrown by stages of single grain before sync (cmd 3)
+		std::shared_ptr<DeadlineSignal> deadline; // no new grain is started after deadline (cmd 9)
+		std::shared_ptr<RangeRun<typename GrainOfWork::DeviceState>> ranges; // chunks of ranges are taken from it (cmd 10)
+	};
+
+	class Response
+	{
+	public:
+		int msg; // 1: success, 0: a stage function threw
+		size_t ns;
+		size_t grains; // number of grains computed (only for work-stealing mode, others use the assigned grain count)
+		size_t finish; // time point (nanoseconds) when device completed the load
+		size_t ticket; // run of the load
+		size_t failedGrain; // grain whose stage threw (when msg==0), (size_t)-1 if not known
+		int failedStage;
+		std::exception_ptr error;
+
+		// ticket of responses of single grains (runSingleAsync), never given to a run
+		static const size_t singleTicket = (size_t)-1;
+	};
+
+	// consumers of a device's response queue: run collectors (mutRun locked) and syncSingle of any thread
+	// one consumer at a time pops from the queue (without holding mut) and files each response for its own kind of consumer
+	class ResponseStream
+	{
+	public:
+		ResponseStream():reading(false){ }
+		std::mutex mut;
+		std::condition_variable filed; // notified after a popped response is filed
+		bool reading; // a consumer is blocked in pop of the response queue
+		std::deque<Response> runs; // responses of runs popped by syncSingle, in queue order
+		std::deque<Response> singles; // responses of single grains popped by run collectors
+	};
+
+	// exception thrown by a stage function, with the grain and stage that threw it
+	class StageFailure
+	{
+	public:
+		size_t grain;
+		int stage;
+		std::exception_ptr error;
+	};
+
+	// result of LoadBalancerX::run(budget)
+	class DeadlineResult
+	{
+	public:
+		size_t elapsed; // nanoseconds from dispatch to response of last device
+		bool met; // elapsed is within budget
+		size_t attempted; // number of grains given to devices (most important first, see setImportanceOrder)
+		std::vector<size_t> completed; // grains computed in this run, in order of importance
+		std::vector<size_t> nsDev; // time spent by each device
+		std::vector<size_t> grainDev; // number of grains computed by each device
+		std::vector<RunError> errors; // failed devices of run, their grains are not computed again
+	};
+
+	// grain index selectors for the compute loop of device threads
+	class RangeIndex
+	{
+	public:
+		static const bool contiguous = true;
+		RangeIndex(size_t firstPrm):first(firstPrm){ }
+		size_t operator()(size_t k) const { return first+k; }
+		RangeIndex shifted(size_t k) const { return RangeIndex(first+k); }
+	private:
+		size_t first;
+	};
+
+	class ListIndex
+	{
+	public:
+		static const bool contiguous = false;
+		ListIndex(const size_t * listPrm):list(listPrm){ }
+		size_t operator()(size_t k) const { return list[k]; }
+		ListIndex shifted(size_t k) const { return ListIndex(list+k); }
+	private:
+		const size_t * list;
+	};
+
+	// range of grains owned by a device in work-stealing mode
+	// owner takes chunks from front, thieves take chunks from back
+	class StealableRange
+	{
+	public:
+		StealableRange():begin(0),end(0),chunk(1),speed(1.0),current(0){ }
+
+		void seed(size_t beginPrm, size_t endPrm, size_t chunkPrm, double speedPrm)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			begin=beginPrm;
+			end=endPrm;
+			chunk=chunkPrm;
+			speed=speedPrm;
+		}
+
+		// owner side: takes next chunk from front, returns false if empty
+		bool takeFront(size_t & first, size_t & count)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			if(begin>=end)
+				return false;
+			first=begin;
+			count=std::min(chunk,end-begin);
+			begin+=count;
+			current=count;
+			return true;
+		}
+
+		// owner side: chunk taken by last takeFront is computed
+		void finishCurrent()
+		{
+			std::unique_lock<std::mutex> lg(m);
+			current=0;
+		}
+
+		// takes chunk in progress of owner and all remaining grains (owner failed), returns false if there is none
+		bool takeAll(size_t & first, size_t & count)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			first=begin-current;
+			count=end-first;
+			begin=end;
+			current=0;
+			return count>0;
+		}
+
+		// predicted time to finish remaining grains (in units of relative performance)
+		double remainingTime()
+		{
+			std::unique_lock<std::mutex> lg(m);
+			return (end-begin)/speed;
+		}
+
+		// thief side: takes a fair share of the remaining grains from back, depending on relative speeds
+		bool takeBack(double thiefSpeed, size_t & first, size_t & count)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			if(begin>=end)
+				return false;
+			const size_t remaining = end-begin;
+			count = (size_t)(remaining * (thiefSpeed/(thiefSpeed+speed)));
+			if(count<1)
+				count=1;
+			end-=count;
+			first=end;
+			return true;
+		}
+
+		double getSpeed(){ std::unique_lock<std::mutex> lg(m); return speed; }
+	private:
+		std::mutex m;
+		size_t begin;
+		size_t end;
+		size_t chunk;
+		double speed;
+		size_t current; // size of chunk that owner is computing, it ends at begin
+	};
+
+	/* computes own range chunk by chunk, then steals from back of the peer that is predicted to finish last until all ranges are empty
+	 * stolen grains are put into own range so that they can be stolen back by others
+	 * compute(first, count) computes a chunk, returns number of grains computed
+	 */
+	template<typename Func>
+	size_t computeAndSteal(const std::vector<std::shared_ptr<StealableRange>> & ranges, size_t self, Func compute)
+	{
+		size_t computed = 0;
+		size_t first = 0;
+		size_t count = 0;
+		const std::shared_ptr<StealableRange> & own = ranges[self];
+		while(true)
+		{
+			while(own->takeFront(first,count))
+			{
+				compute(first, count);
+				own->finishCurrent();
+				computed += count;
+			}
+
+			int victim = -1;
+			double victimTime = 0.0;
+			for(size_t i=0;i<ranges.size();i++)
+			{
+				if(i==self)
+					continue;
+				const double remaining = ranges[i]->remainingTime();
+				if(remaining>victimTime)
+				{
+					victimTime=remaining;
+					victim=i;
+				}
+			}
+
+			if(victim<0)
+				break;
+
+			if(ranges[victim]->takeBack(own->getSpeed(),first,count))
+			{
+				own->seed(first, first+count, std::max((size_t)1,count/8), own->getSpeed());
+			}
+		}
+		return computed;
+	}
+
+	// binds calling thread to a cpu core (only on linux, ignored when core<0)
+	inline void pinThisThread(int core)
+	{
+#if defined(__linux__)
+		if(core>=0)
+		{
+			cpu_set_t cpuSet;
+			CPU_ZERO(&cpuSet);
+			CPU_SET(core, &cpuSet);
+			pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+		}
+#else
+		(void)core;
+#endif
+	}
+
+	/* worker threads of a composite device (see DeviceOptions::workers)
+	 * work of the device is divided equally between workers (device thread is worker 0),
+	 * a worker that runs out of work steals from back of the worker that is predicted to finish last
+	 * a worker that throws stops, its remaining grains are computed by other workers and run() rethrows the first exception
+	 */
+	class WorkerPool
+	{
+	public:
+		// cores: core of each worker (-1 or missing = not pinned), core of worker 0 is set by DeviceOptions::cpuCore
+		WorkerPool(size_t numWorkers, const std::vector<int> & cores):task(nullptr),generation(0),busy(0),stop(false)
+		{
+			for(size_t w=0;w<std::max((size_t)1,numWorkers);w++)
+			{
+				ranges.push_back(std::make_shared<StealableRange>());
+			}
+			for(size_t w=1;w<ranges.size();w++)
+			{
+				const int core = (w<cores.size()) ? cores[w] : -1;
+				workers.push_back(std::thread([this,w,core]{ pinThisThread(core); workerLoop(w); }));
+			}
+		}
+
+		~WorkerPool()
+		{
+			{
+				std::unique_lock<std::mutex> lg(m);
+				stop=true;
+			}
+			start.notify_all();
+			for(size_t w=0;w<workers.size();w++)
+			{
+				workers[w].join();
+			}
+		}
+
+		size_t size() const { return ranges.size(); }
+
+		// calls compute(first, count) for chunks of [0,n) on all workers, returns when all chunks are complete
+		void run(size_t n, const std::function<void(size_t,size_t)> & compute)
+		{
+			error=nullptr;
+			const size_t numWorkers = ranges.size();
+			for(size_t w=0;w<numWorkers;w++)
+			{
+				const size_t begin = n*w/numWorkers;
+				const size_t end = n*(w+1)/numWorkers;
+				ranges[w]->seed(begin, end, std::max((size_t)1,(end-begin)/8), 1.0);
+			}
+
+			{
+				std::unique_lock<std::mutex> lg(m);
+				task=&compute;
+				busy=numWorkers-1;
+				generation++;
+			}
+			start.notify_all();
+
+			computeWorker(0, compute);
+
+			std::unique_lock<std::mutex> lg(m);
+			while(busy>0)
+			{
+				done.wait(lg);
+			}
+			task=nullptr;
+			if(error)
+			{
+				std::rethrow_exception(error);
+			}
+		}
+	private:
+		void workerLoop(size_t w)
+		{
+			size_t seen = 0;
+			while(true)
+			{
+				const std::function<void(size_t,size_t)> * compute;
+				{
+					std::unique_lock<std::mutex> lg(m);
+					while(generation==seen && !stop)
+					{
+						start.wait(lg);
+					}
+					if(stop)
+						return;
+					seen=generation;
+					compute=task;
+				}
+
+				computeWorker(w, *compute);
+
+				std::unique_lock<std::mutex> lg(m);
+				if(--busy==0)
+				{
+					done.notify_all();
+				}
+			}
+		}
+
+		void computeWorker(size_t w, const std::function<void(size_t,size_t)> & compute)
+		{
+			try
+			{
+				computeAndSteal(ranges, w, compute);
+			}
+			catch(...)
+			{
+				// chunk that threw is not computed again, device reports its whole load as failed
+				ranges[w]->finishCurrent();
+				std::unique_lock<std::mutex> lg(m);
+				if(!error)
+				{
+					error=std::current_exception();
+				}
+			}
+		}
+
+		std::vector<std::shared_ptr<StealableRange>> ranges;
+		std::vector<std::thread> workers;
+		std::mutex m;
+		std::condition_variable start;
+		std::condition_variable done;
+		const std::function<void(size_t,size_t)> * task;
+		size_t generation;
+		size_t busy;
+		bool stop;
+		std::exception_ptr error; // first exception of current run
+	};
+
+	// device time given to a tenant of a DeviceExecutor
+	class TenantUsage
+	{
+	public:
+		int priority;
+		double weight;
+		size_t loads; // loads computed
+		size_t busyNs; // time spent computing loads of tenant
+		size_t waitNs; // time loads of tenant waited in executor (mostly for loads of other tenants)
+	};
+
+	/* device thread shared by devices of several LoadBalancerX instances (tenants, see DeviceOptions::executor)
+	 * each tenant has its own queue of loads, executor computes one load at a time and a load is not preempted
+	 * tenant with highest priority that has a load goes first, tenants of same priority share device time in proportion to their weights
+	 * (tenant with least device time per weight goes first, a tenant that was idle starts from least device time per weight of busy tenants)
+	 * time of a load measured by its balancer includes only its own computation, so other tenants do not change its learned ratios
+	 */
+	class DeviceExecutor
+	{
+	public:
+		// cpuCore: >=0: executor thread is pinned to this cpu core (linux only)
+		DeviceExecutor(int cpuCore = -1):nextTenant(0),stop(false)
+		{
+			thread = std::thread([this,cpuCore]{ pinThisThread(cpuCore); executorLoop(); });
+		}
+
+		~DeviceExecutor()
+		{
+			{
+				std::unique_lock<std::mutex> lg(m);
+				stop=true;
+			}
+			wake.notify_all();
+			thread.join();
+		}
+
+		/* adds a tenant, returns its id
+		 * step: computes next load of tenant in executor thread, returns false without computing it if load has to wait for another device
+		 * (executor tries again after a load of another tenant or after a short sleep)
+		 */
+		size_t attach(int priority, double weight, std::function<bool()> step)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			Tenant & tenant = tenants[nextTenant];
+			tenant.step = step;
+			tenant.usage = TenantUsage({priority, weight>0.0 ? weight : 1.0, 0, 0, 0});
+			return nextTenant++;
+		}
+
+		// a load is queued for tenant
+		void notify(size_t id)
+		{
+			{
+				std::unique_lock<std::mutex> lg(m);
+				Tenant & tenant = tenants.at(id);
+				if(tenant.queued.empty())
+				{
+					// idle tenant does not get the device time it did not use while idle
+					double least = -1.0;
+					for(const auto & other:tenants)
+					{
+						if(!other.second.queued.empty() && other.second.usage.priority==tenant.usage.priority &&
+						   (least<0.0 || other.second.virtualTime<least))
+						{
+							least = other.second.virtualTime;
+						}
+					}
+					tenant.virtualTime = std::max(tenant.virtualTime, least);
+				}
+				tenant.queued.push_back(nowNanoseconds());
+			}
+			wake.notify_all();
+		}
+
+		// waits until all queued loads of tenant are computed and removes tenant
+		void detach(size_t id)
+		{
+			std::unique_lock<std::mutex> lg(m);
+			while(!tenants.at(id).queued.empty() || tenants.at(id).running)
+			{
+				idle.wait(lg);
+			}
+			tenants.erase(id);
+		}
+
+		// device time given to each attached tenant (in order of attaching)
+		std::vector<TenantUsage> getUsage()
+		{
+			std::unique_lock<std::mutex> lg(m);
+			std::vector<TenantUsage> result;
+			for(const auto & tenant:tenants)
+			{
+				result.push_back(tenant.second.usage);
+			}
+			return result;
+		}
+	private:
+		class Tenant
+		{
+		public:
+			Tenant():virtualTime(0.0),running(false),blocked(false){ }
+			std::function<bool()> step;
+			TenantUsage usage;
+			std::deque<size_t> queued; // time points of queued loads
+			double virtualTime; // device time per weight
+			bool running;
+			bool blocked; // last step could not compute its load
+		};
+
+		void executorLoop()
+		{
+			std::unique_lock<std::mutex> lg(m);
+			while(true)
+			{
+				Tenant * selected = nullptr;
+				bool waiting = false;
+				for(auto & entry:tenants)
+				{
+					Tenant & tenant = entry.second;
+					if(tenant.queued.empty())
+						continue;
+					waiting = true;
+					if(tenant.blocked)
+						continue;
+					if(selected==nullptr || tenant.usage.priority>selected->usage.priority ||
+					   (tenant.usage.priority==selected->usage.priority && tenant.virtualTime<selected->virtualTime))
+					{
+						selected=&tenant;
+					}
+				}
+
+				if(selected==nullptr)
+				{
+					if(stop && !waiting)
+						return;
+					if(waiting)
+					{
+						// loads of all tenants wait for other devices
+						wake.wait_for(lg, std::chrono::microseconds(20));
+						for(auto & entry:tenants)
+						{
+							entry.second.blocked=false;
+						}
+					}
+					else
+					{
+						wake.wait(lg);
+					}
+					continue;
+				}
+
+				selected->running=true;
+				lg.unlock();
+				const size_t t0 = nowNanoseconds();
+				const bool computed = selected->step();
+				const size_t t1 = nowNanoseconds();
+				lg.lock();
+				selected->running=false;
+
+				// a computed load may be what blocked loads of other tenants were waiting for
+				for(auto & entry:tenants)
+				{
+					entry.second.blocked=false;
+				}
+				if(computed)
+				{
+					selected->usage.loads++;
+					selected->usage.busyNs += t1-t0;
+					selected->usage.waitNs += t0-selected->queued.front();
+					selected->queued.pop_front();
+					selected->virtualTime += (t1-t0)/selected->usage.weight;
+				}
+				else
+				{
+					selected->blocked=true;
+				}
+				idle.notify_all();
+			}
+		}
+
+		std::mutex m;
+		std::condition_variable wake;
+		std::condition_variable idle;
+		std::map<size_t,Tenant> tenants;
+		size_t nextTenant;
+		bool stop;
+		std::thread thread;
+	};
+
+	// padding to keep frequently written atomics of different threads on different cache lines
+	static const size_t cacheLineSize = 64;
+
+	constexpr size_t roundUpPowerOfTwo(size_t n, size_t c = 1)
+	{
+		return c>=n ? c : roundUpPowerOfTwo(n, c<<1);
+	}
+
+	// blocking point for threads that spin on a lock-free structure for too long
+	// waiter registers itself before re-checking its condition so that no wake-up is lost
+	class WaitPoint
+	{
+	public:
+		WaitPoint():epoch(0),waiters(0){ }
+
+		unsigned int prepareWait()
+		{
+			waiters.fetch_add(1);
+			return epoch.load();
+		}
+
+		void cancelWait()
+		{
+			waiters.fetch_sub(1);
+		}
+
+		// sleeps until a notify() happens after prepareWait()
+		void commitWait(unsigned int ticket)
+		{
+#if defined(__cpp_lib_atomic_wait)
+			epoch.wait(ticket);
+#else
+			std::unique_lock<std::mutex> lc(m);
+			while(epoch.load()==ticket)
+			{
+				c.wait(lc);
+			}
+#endif
+			waiters.fetch_sub(1);
+		}
+
+		void notify()
+		{
+			epoch.fetch_add(1);
+			if(waiters.load()>0)
+			{
+#if defined(__cpp_lib_atomic_wait)
+				epoch.notify_all();
+#else
+				{
+					std::unique_lock<std::mutex> lc(m);
+				}
+				c.notify_all();
+#endif
+			}
+		}
+	private:
+		std::atomic<unsigned int> epoch;
+		std::atomic<int> waiters;
+#if !defined(__cpp_lib_atomic_wait)
+		std::mutex m;
+		std::condition_variable c;
+#endif
+	};
+
+	// thread-safe bounded queue (lock-free ring buffer with per-slot sequence numbers)
+	// MultiProducer/MultiConsumer: false when only one thread at a time pushes/pops, that side then moves its index without compare-exchange
+	// 		loads: host threads push, only the device pops (self-syncs of single grains are kept by the device, see DeviceContext::selfSyncs)
+	// 		responses: only the device pushes, host threads (run collectors, syncSingle of any thread) pop one at a time through ResponseStream
+	// capacity is sz rounded up to a power of 2, push blocks while queue is full and pop blocks while queue is empty
+	// blocked threads spin for a short time before sleeping
+	template<typename T, int sz, bool MultiProducer = true, bool MultiConsumer = true>
+	class ThreadsafeQueue
+	{
+	public:
+		static const size_t capacity = roundUpPowerOfTwo(sz>1?sz:2);
+
+		ThreadsafeQueue():slots(capacity),head(0),tail(0)
+		{
+			for(size_t i=0;i<capacity;i++)
+			{
+				slots[i].seq.store(i,std::memory_order_relaxed);
+			}
+		}
+
+		void push(T t)
+		{
+			int spin = 0;
+			while(!tryPush(t))
+			{
+				if(spin++<spinCount)
+				{
+					if(spin>spinCount/2)
+						std::this_thread::yield();
+					continue;
+				}
+				unsigned int ticket = notFull.prepareWait();
+				if(tryPush(t))
+				{
+					notFull.cancelWait();
+					break;
+				}
+				notFull.commitWait(ticket);
+			}
+			notEmpty.notify();
+		}
+
+		// approximate number of elements
+		size_t size()
+		{
+			const size_t t = tail.load(std::memory_order_acquire);
+			const size_t h = head.load(std::memory_order_acquire);
+			return t>h?t-h:0;
+		}
+
+		T pop()
+		{
+			T result;
+			int spin = 0;
+			while(!tryPop(result))
+			{
+				if(spin++<spinCount)
+				{
+					if(spin>spinCount/2)
+						std::this_thread::yield();
+					continue;
+				}
+				unsigned int ticket = notEmpty.prepareWait();
+				if(tryPop(result))
+				{
+					notEmpty.cancelWait();
+					break;
+				}
+				notEmpty.commitWait(ticket);
+			}
+			notFull.notify();
+			return result;
+		}
+
+		bool tryPush(T & t)
+		{
+			size_t pos = tail.load(std::memory_order_relaxed);
+			while(true)
+			{
+				Slot & slot = slots[pos & mask];
+				const size_t seq = slot.seq.load(std::memory_order_acquire);
+				const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+				if(dif==0)
+				{
+					if(!MultiProducer)
+					{
+						tail.store(pos+1,std::memory_order_relaxed);
+					}
+					else if(!tail.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed))
+					{
+						continue;
+					}
+					slot.data = std::move(t);
+					slot.seq.store(pos+1,std::memory_order_release);
+					return true;
+				}
+				else if(dif<0)
+				{
+					return false; // full
+				}
+				else
+				{
+					pos = tail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		bool tryPop(T & t)
+		{
+			size_t pos = head.load(std::memory_order_relaxed);
+			while(true)
+			{
+				Slot & slot = slots[pos & mask];
+				const size_t seq = slot.seq.load(std::memory_order_acquire);
+				const intptr_t dif = (intptr_t)seq - (intptr_t)(pos+1);
+				if(dif==0)
+				{
+					if(!MultiConsumer)
+					{
+						head.store(pos+1,std::memory_order_relaxed);
+					}
+					else if(!head.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed))
+					{
+						continue;
+					}
+					t = std::move(slot.data);
+					slot.seq.store(pos+capacity,std::memory_order_release);
+					return true;
+				}
+				else if(dif<0)
+				{
+					return false; // empty
+				}
+				else
+				{
+					pos = head.load(std::memory_order_relaxed);
+				}
+			}
+		}
+	private:
+		static const size_t mask = capacity-1;
+		static const int spinCount = 2000;
+
+		class Slot
+		{
+		public:
+			std::atomic<size_t> seq;
+			T data;
+		};
+
+		std::vector<Slot> slots;
+		alignas(cacheLineSize) std::atomic<size_t> head;
+		alignas(cacheLineSize) std::atomic<size_t> tail;
+		alignas(cacheLineSize) WaitPoint notEmpty;
+		WaitPoint notFull;
+	};
+
+	template<typename T, int sz, bool MultiProducer, bool MultiConsumer>
+	const size_t ThreadsafeQueue<T, sz, MultiProducer, MultiConsumer>::capacity;
+
+	// rounding method that converts fractional shares of devices into integer grain counts
+	// RoundRobin: floor of each share, leftover grains are given one by one starting from first device
+	// LargestRemainder: floor of each share, leftover grains are given to devices with largest fractional parts
+	enum class Rounding
+	{
+		RoundRobin,
+		LargestRemainder
+	};
+
+	/* performance model & work distribution strategy of LoadBalancerX::run()
+	 * update: computes share of each device (sum=1) for next run from last run's measurement
+	 * 			grains: number of grains computed by each device in last run
+	 * 			ns: time spent by each device in last run (nanoseconds)
+	 * split: converts shares to grain counts (sum=totWrk)
+	 */
+	class BalancingPolicy
+	{
+	public:
+		BalancingPolicy(Rounding roundingPrm = Rounding::RoundRobin):rounding(roundingPrm){ }
+		virtual ~BalancingPolicy(){ }
+
+		virtual void update(const std::vector<size_t> & grains, const std::vector<size_t> & ns, size_t totWrk, std::vector<double> & performances)=0;
+
+		// starts the model from previously learned state (shares, grains and ns of each device) instead of uniform shares
+		virtual void seed(const std::vector<double> & performances, const std::vector<size_t> & grains, const std::vector<size_t> & ns)=0;
+
+		// called after devices are added (performances has more elements) or removed (their share is 0)
+		// keeps learned ratios between remaining devices instead of starting again from uniform shares
+		virtual void rescale(const std::vector<double> & /*performances*/){ }
+
+		virtual void split(const std::vector<double> & performances, size_t totWrk, std::vector<size_t> & grainDev)
+		{
+			const size_t totDev = performances.size();
+			size_t ct=0;
+			std::vector<std::pair<double,size_t>> remainders;
+			for(size_t i=0;i<totDev;i++)
+			{
+				const double share = performances[i]*totWrk;
+				grainDev[i]=share;
+				ct+=grainDev[i];
+				remainders.push_back(std::make_pair(share-grainDev[i],i));
+			}
+
+			if(rounding==Rounding::LargestRemainder)
+			{
+				std::stable_sort(remainders.begin(),remainders.end(),
+						[](const std::pair<double,size_t> & a, const std::pair<double,size_t> & b){ return a.first>b.first; });
+				for(size_t k=0; ct<totWrk; k++)
+				{
+					grainDev[remainders[k%totDev].second]++;
+					ct++;
+				}
+			}
+			else
+			{
+				// if all devices have 0 work or num work < num device or not enough work allocated
+				size_t ctct=0;
+				while(ct < totWrk)
+				{
+					grainDev[ctct%totDev]++;
+					ct++;ctct++;
+				}
+			}
+		}
+	protected:
+		// shares of oldDev devices in old extended to performances.size() devices (sum=1)
+		// new devices get their share in performances, removed devices (share 0) get 0
+		static void rescaleShares(const double * old, size_t oldDev, const std::vector<double> & performances, double * result)
+		{
+			const size_t totDev = performances.size();
+			double total = 0.0;
+			for(size_t i=0;i<totDev;i++)
+			{
+				result[i] = (performances[i]<=0.0) ? 0.0 : (i<oldDev ? old[i] : performances[i]);
+				total += result[i];
+			}
+			for(size_t i=0;i<totDev && total>0.0;i++)
+			{
+				result[i] /= total;
+			}
+		}
+
+		// throughput (grains per nanosecond) of each device, normalized to sum=1
+		static void normalizedThroughput(const std::vector<size_t> & grains, const std::vector<size_t> & ns, std::vector<double> & result)
+		{
+			const size_t totDev = grains.size();
+			double totPerf = 0.0;
+			result.resize(totDev);
+			for(size_t i=0;i<totDev;i++)
+			{
+				result[i] = (grains[i]+0.1)/(double)ns[i];
+				totPerf += result[i];
+			}
+			for(size_t i=0;i<totDev;i++)
+			{
+				result[i] /= totPerf;
+			}
+		}
+
+		Rounding rounding;
+	};
+
+	// default policy: plain moving average of last numSmoothing throughput measurements
+	class MovingAveragePolicy: public BalancingPolicy
+	{
+	public:
+		MovingAveragePolicy(int numSmoothingPrm = 5, Rounding roundingPrm = Rounding::RoundRobin):
+			BalancingPolicy(roundingPrm),numSmoothing(numSmoothingPrm),count(0){ }
+
+		void update(const std::vector<size_t> & grains, const std::vector<size_t> & ns, size_t /*totWrk*/, std::vector<double> & performances) override
+		{
+			const size_t totDev = grains.size();
+			const int curHistoryIndex = count % numSmoothing;
+			if(history.size()!=totDev*numSmoothing)
+			{
+				history = std::vector<double>(totDev*numSmoothing, 1.0/totDev);
+			}
+
+			std::vector<double> perf;
+			normalizedThroughput(grains, ns, perf);
+			count++;
+			for(size_t i=0;i<totDev;i++)
+			{
+				// smoothing the performance measurement
+				double smooth = 0.0;
+				history[curHistoryIndex*totDev + i]=perf[i];
+				for(int j=0;j<numSmoothing;j++)
+				{
+					smooth += history[j*totDev + i];
+				}
+				smooth /= (double)numSmoothing;
+				performances[i]=smooth;
+			}
+		}
+
+		void seed(const std::vector<double> & performances, const std::vector<size_t> & /*grains*/, const std::vector<size_t> & /*ns*/) override
+		{
+			const size_t totDev = performances.size();
+			history = std::vector<double>(totDev*numSmoothing);
+			for(size_t i=0;i<totDev;i++)
+			{
+				for(int j=0;j<numSmoothing;j++)
+				{
+					history[j*totDev + i]=performances[i];
+				}
+			}
+		}
+
+		void rescale(const std::vector<double> & performances) override
+		{
+			if(history.empty())
+				return;
+			const size_t oldDev = history.size()/numSmoothing;
+			const size_t totDev = performances.size();
+			std::vector<double> rescaled(totDev*numSmoothing);
+			for(int j=0;j<numSmoothing;j++)
+			{
+				rescaleShares(&history[j*oldDev], oldDev, performances, &rescaled[j*totDev]);
+			}
+			history = rescaled;
+		}
+	private:
+		int numSmoothing;
+		int count;
+		std::vector<double> history;
+	};
+
+	// exponentially weighted moving average of throughput, reacts faster to step changes with higher alpha
+	class EwmaPolicy: public BalancingPolicy
+	{
+	public:
+		EwmaPolicy(double alphaPrm = 0.5, Rounding roundingPrm = Rounding::LargestRemainder):
+			BalancingPolicy(roundingPrm),alpha(alphaPrm){ }
+
+		void update(const std::vector<size_t> & grains, const std::vector<size_t> & ns, size_t /*totWrk*/, std::vector<double> & performances) override
+		{
+			const size_t totDev = grains.size();
+			if(average.size()!=totDev)
+			{
+				average = std::vector<double>(totDev, 1.0/totDev);
+			}
+
+			std::vector<double> perf;
+			normalizedThroughput(grains, ns, perf);
+			for(size_t i=0;i<totDev;i++)
+			{
+				average[i] = alpha*perf[i] + (1.0-alpha)*average[i];
+				performances[i] = average[i];
+			}
+		}
+
+		void seed(const std::vector<double> & performances, const std::vector<size_t> & /*grains*/, const std::vector<size_t> & /*ns*/) override
+		{
+			average = performances;
+		}
+
+		void rescale(const std::vector<double> & performances) override
+		{
+			if(average.empty())
+				return;
+			std::vector<double> rescaled(performances.size());
+			rescaleShares(average.data(), average.size(), performances, rescaled.data());
+			average = rescaled;
+		}
+	private:
+		double alpha;
+		std::vector<double> average;
+	};
+
+	/* models time of each device as ns = a + b * grains (a: per-launch overhead, b: time per grain)
+	 * a and b are tracked by a 2-state Kalman filter per device, process noise lets the model follow throttling
+	 * shares are chosen to make predicted finish times of all devices equal
+	 */
+	class LinearFitPolicy: public BalancingPolicy
+	{
+	public:
+		LinearFitPolicy(double processNoisePrm = 0.05, double measurementNoisePrm = 0.05, Rounding roundingPrm = Rounding::LargestRemainder):
+			BalancingPolicy(roundingPrm),processNoise(processNoisePrm),measurementNoise(measurementNoisePrm){ }
+
+		void update(const std::vector<size_t> & grains, const std::vector<size_t> & ns, size_t totWrk, std::vector<double> & performances) override
+		{
+			const size_t totDev = grains.size();
+			if(models.size()!=totDev)
+			{
+				models = std::vector<Model>(totDev);
+			}
+
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(grains[i]>0)
+				{
+					models[i].measure(grains[i], ns[i], processNoise, measurementNoise);
+				}
+			}
+
+			// finish time T is same for all devices: sum over devices of (T-a)/b = totWrk
+			// devices with a>=T get no work and are excluded
+			std::vector<bool> used(totDev,true);
+			double finish = 0.0;
+			for(size_t iteration=0;iteration<totDev;iteration++)
+			{
+				double sumInvB = 0.0;
+				double sumAOverB = 0.0;
+				for(size_t i=0;i<totDev;i++)
+				{
+					if(used[i] && models[i].valid)
+					{
+						sumInvB += 1.0/models[i].b;
+						sumAOverB += models[i].a/models[i].b;
+					}
+				}
+				if(sumInvB<=0.0)
+					break;
+				finish = (totWrk + sumAOverB)/sumInvB;
+				bool changed = false;
+				for(size_t i=0;i<totDev;i++)
+				{
+					if(used[i] && models[i].valid && models[i].a>=finish)
+					{
+						used[i]=false;
+						changed=true;
+					}
+				}
+				if(!changed)
+					break;
+			}
+
+			double total = 0.0;
+			for(size_t i=0;i<totDev;i++)
+			{
+				double g = 0.0;
+				if(!models[i].valid)
+				{
+					g = totWrk/(double)totDev; // not measured yet: equal share
+				}
+				else if(used[i])
+				{
+					g = (finish-models[i].a)/models[i].b;
+				}
+				performances[i] = g>0.0?g:0.0;
+				total += performances[i];
+			}
+			for(size_t i=0;i<totDev;i++)
+			{
+				performances[i] = total>0.0 ? performances[i]/total : 1.0/totDev;
+			}
+		}
+
+		void seed(const std::vector<double> & performances, const std::vector<size_t> & grains, const std::vector<size_t> & ns) override
+		{
+			models = std::vector<Model>(performances.size());
+			for(size_t i=0;i<performances.size();i++)
+			{
+				if(grains[i]>0)
+				{
+					models[i].measure(grains[i], ns[i], processNoise, measurementNoise);
+				}
+			}
+		}
+
+		// models of remaining devices are kept, new and removed devices start without a model
+		void rescale(const std::vector<double> & performances) override
+		{
+			models.resize(performances.size());
+			for(size_t i=0;i<performances.size();i++)
+			{
+				if(performances[i]<=0.0)
+				{
+					models[i] = Model();
+				}
+			}
+		}
+	private:
+		class Model
+		{
+		public:
+			Model():valid(false),a(0),b(0),p00(0),p01(0),p11(0){ }
+
+			void measure(size_t grains, size_t ns, double processNoise, double measurementNoise)
+			{
+				const double g = grains;
+				const double t = ns;
+				if(!valid)
+				{
+					// first measurement: no overhead assumed, uncertain overhead
+					valid = true;
+					a = 0.0;
+					b = t/g;
+					p00 = (0.5*t)*(0.5*t);
+					p01 = 0.0;
+					p11 = (0.5*b)*(0.5*b);
+					return;
+				}
+
+				// predict: parameters drift proportionally to their magnitude
+				const double qa = processNoise*(std::abs(a)+b*g);
+				const double qb = processNoise*b;
+				p00 += qa*qa;
+				p11 += qb*qb;
+
+				// correct with measurement t = a + b*g
+				const double r = (measurementNoise*t)*(measurementNoise*t);
+				const double y = t - (a + b*g);
+				const double s = p00 + 2.0*g*p01 + g*g*p11 + r;
+				const double k0 = (p00 + g*p01)/s;
+				const double k1 = (p01 + g*p11)/s;
+				a += k0*y;
+				b += k1*y;
+				const double n00 = p00 - k0*(p00 + g*p01);
+				const double n01 = p01 - k0*(p01 + g*p11);
+				const double n11 = p11 - k1*(p01 + g*p11);
+				p00 = n00;
+				p01 = n01;
+				p11 = n11;
+
+				// time per grain can not be negative, overhead can not be negative
+				const double minB = 1e-3*t/g;
+				if(b<minB)
+					b = minB;
+				if(a<0.0)
+					a = 0.0;
+			}
+
+			bool valid;
+			double a;
+			double b;
+			double p00,p01,p11;
+		};
+
+		double processNoise;
+		double measurementNoise;
+		std::vector<Model> models;
+	};
+
+	/* grains of total work in structure-of-arrays layout
+	 * grain states are contiguous, each stage has its own function table and per-grain index into it (0 = no function)
+	 * so a pass over a range for one stage touches only that stage's data, grains without a stage function share entry 0
+	 * readiness (init called) is a bitset per device so that scanning a range touches only a few cache lines
+	 * a device thread changes only its own bitset
+	 */
+	template<typename State, typename GrainState>
+	class GrainStore
+	{
+	public:
+		static const int numFunctions = numStages+1; // stages and release
+
+		GrainStore()
+		{
+			for(int f=0;f<numFunctions;f++)
+			{
+				functionTable[f].push_back(nullptr);
+			}
+		}
+
+		size_t size() const { return grainStates.size(); }
+
+		void add(const GrainOfWork<State,GrainState> & work)
+		{
+			const std::function<void(State, GrainState&)> * functions[numFunctions] = {&work.workInit,&work.workInput,&work.workCompute,&work.workOutput,&work.workSync,&work.workRelease};
+			for(int f=0;f<numFunctions;f++)
+			{
+				if(*functions[f])
+				{
+					functionTable[f].push_back(*functions[f]);
+					functionOf[f].push_back((uint32_t)(functionTable[f].size()-1));
+				}
+				else
+				{
+					functionOf[f].push_back(0);
+				}
+			}
+			grainStates.push_back(work.grainState);
+		}
+
+		// adds count grains with one shared entry per stage function
+		void addBulk(size_t count, const GrainOfWork<State,GrainState> & work, const std::function<GrainState(size_t)> & generator)
+		{
+			const std::function<void(State, GrainState&)> * functions[numFunctions] = {&work.workInit,&work.workInput,&work.workCompute,&work.workOutput,&work.workSync,&work.workRelease};
+			for(int f=0;f<numFunctions;f++)
+			{
+				uint32_t k = 0;
+				if(*functions[f])
+				{
+					functionTable[f].push_back(*functions[f]);
+					k = (uint32_t)(functionTable[f].size()-1);
+				}
+				functionOf[f].resize(functionOf[f].size()+count, k);
+			}
+
+			const size_t first = grainStates.size();
+			if(generator)
+			{
+				grainStates.reserve(first+count);
+				for(size_t k=0;k<count;k++)
+				{
+					grainStates.push_back(generator(first+k));
+				}
+			}
+			else
+			{
+				grainStates.resize(first+count, work.grainState);
+			}
+		}
+
+		GrainState & state(size_t j){ return grainStates[j]; }
+
+		// function: Stage or numStages for release
+		void call(int function, size_t j, const State & state, GrainState & gState)
+		{
+			const uint32_t k = functionOf[function][j];
+			if(k>0)
+			{
+				functionTable[function][k](state, gState);
+			}
+		}
+
+		bool hasFunction(int function, size_t j) const { return functionOf[function][j]>0; }
+
+		void addDevice(){ ready.push_back(std::vector<uint64_t>()); readyCount.push_back(0); }
+
+		// forgets initialization of all grains in device
+		void clearDevice(size_t device){ ready[device].clear(); readyCount[device]=0; }
+
+		// true when device initialized all grains (lets device skip scanning for grains to initialize)
+		bool allReady(size_t device) const { return readyCount[device]==grainStates.size(); }
+
+		// true when device initialized all grains in [first,last), checks 64 grains at once
+		bool rangeReady(size_t device, size_t first, size_t last) const
+		{
+			const std::vector<uint64_t> & bits = ready[device];
+			if(first>=last)
+				return true;
+			if(((last-1)>>6)>=bits.size())
+				return false;
+			size_t j = first;
+			while(j<last && (j&63)!=0)
+			{
+				if(!((bits[j>>6]>>(j&63))&1))
+					return false;
+				j++;
+			}
+			while(j+64<=last)
+			{
+				if(bits[j>>6]!=~(uint64_t)0)
+					return false;
+				j+=64;
+			}
+			while(j<last)
+			{
+				if(!((bits[j>>6]>>(j&63))&1))
+					return false;
+				j++;
+			}
+			return true;
+		}
+
+		bool isReady(size_t device, size_t j) const
+		{
+			const std::vector<uint64_t> & bits = ready[device];
+			return (j>>6)<bits.size() && ((bits[j>>6]>>(j&63))&1);
+		}
+
+		void makeReady(size_t device, size_t j)
+		{
+			std::vector<uint64_t> & bits = ready[device];
+			if((j>>6)>=bits.size())
+			{
+				bits.resize(std::max((j>>6)+1, grainStates.size()/64+1), 0);
+			}
+			const uint64_t bit = ((uint64_t)1)<<(j&63);
+			readyCount[device] += ((bits[j>>6]&bit)==0);
+			bits[j>>6] |= bit;
+		}
+
+		void makeUnready(size_t device, size_t j)
+		{
+			std::vector<uint64_t> & bits = ready[device];
+			if((j>>6)<bits.size())
+			{
+				const uint64_t bit = ((uint64_t)1)<<(j&63);
+				readyCount[device] -= ((bits[j>>6]&bit)!=0);
+				bits[j>>6] &= ~bit;
+			}
+		}
+	private:
+		std::vector<GrainState> grainStates;
+		std::vector<uint32_t> functionOf[numFunctions];
+		std::vector<std::function<void(State, GrainState&)>> functionTable[numFunctions];
+		std::vector<std::vector<uint64_t>> ready;
+		std::vector<size_t> readyCount; // number of set bits in ready of each device
+	};
+
+	// stage functions of grain j of a GrainStore, same interface as GrainOfWork for KernelStages
+	template<typename State, typename GrainState>
+	class StoredFunctions
+	{
+	public:
+		StoredFunctions(GrainStore<State,GrainState> & storePrm, size_t jPrm):store(storePrm),j(jPrm){ }
+		void init(const State & state, GrainState& gState){ store.call((int)Stage::Init, j, state, gState); }
+		void input(const State & state, GrainState& gState){ store.call((int)Stage::Input, j, state, gState); }
+		void compute(const State & state, GrainState& gState){ store.call((int)Stage::Compute, j, state, gState); }
+		void output(const State & state, GrainState& gState){ store.call((int)Stage::Output, j, state, gState); }
+		void sync(const State & state, GrainState& gState){ store.call((int)Stage::Sync, j, state, gState); }
+		void release(const State & state, GrainState& gState){ store.call(numStages, j, state, gState); }
+		bool hasRelease(){ return store.hasFunction(numStages, j); }
+	private:
+		GrainStore<State,GrainState> & store;
+		size_t j;
+	};
+
+	/* per-grain cost estimates for cost-aware partitioning (see LoadBalancerX::setGrainCosts)
+	 * device threads record time of each grain (sum of its stage call durations), host learns from them after each run
+	 * cost of a grain = its time / nanoseconds per cost unit of the device that computed it (device factor),
+	 * device factor is measured on grains whose cost was learned on another device (or given as hint), so that an expensive stretch
+	 * of grains is not mistaken for a slow device (device speed itself is learned by BalancingPolicy in cost units)
+	 * costs are normalized to mean 1 (a cost unit is the cost of an average grain), grains without estimate cost 1
+	 * when not enabled every grain costs 1 and nothing is recorded
+	 */
+	class CostModel
+	{
+	public:
+		CostModel():enabled(false),learning(false),rebased(false),numSamples(0),prefix(1,0.0){ }
+
+		bool active() const { return enabled; }
+
+		/* hints: relative cost of each grain (missing or non-positive: not known), learn: estimates are refined from measured times
+		 * no run may be in flight
+		 */
+		void configure(const std::vector<double> & hints, bool learn, size_t totWrk)
+		{
+			enabled = true;
+			learning = learn;
+			rebased = false;
+			cost.assign(totWrk,1.0);
+			origin.assign(totWrk,unknown);
+			factor.clear();
+			linked.clear();
+			for(size_t j=0;j<totWrk && j<hints.size();j++)
+			{
+				if(hints[j]>0.0)
+				{
+					cost[j]=hints[j];
+					origin[j]=hinted;
+				}
+			}
+			resize(totWrk);
+			normalize();
+		}
+
+		// follows number of grains (new grains cost 1), no run may be in flight
+		void resize(size_t totWrk)
+		{
+			if(cost.size()<totWrk)
+			{
+				cost.resize(totWrk,1.0);
+				origin.resize(totWrk,unknown);
+			}
+			if(numSamples!=totWrk)
+			{
+				numSamples = totWrk;
+				sampleNs.reset(new std::atomic<size_t>[totWrk]);
+				sampleDev.reset(new std::atomic<uint32_t>[totWrk]);
+				for(size_t j=0;j<totWrk;j++)
+				{
+					sampleNs[j].store(0);
+					sampleDev[j].store(0);
+				}
+			}
+			buildPrefix();
+		}
+
+		size_t size() const { return numSamples; }
+
+		// device side: duration of a stage call of grain j, sample is complete after Sync
+		void record(size_t device, size_t j, Stage stage, size_t ns)
+		{
+			if(j>=numSamples)
+				return;
+			if(stage==Stage::Input)
+			{
+				sampleNs[j].store(ns,std::memory_order_relaxed);
+			}
+			else
+			{
+				sampleNs[j].fetch_add(ns,std::memory_order_relaxed);
+			}
+			if(stage==Stage::Sync)
+			{
+				sampleDev[j].store((uint32_t)device+1,std::memory_order_release);
+			}
+		}
+
+		double getCost(size_t j) const { return (enabled && j<cost.size()) ? cost[j] : 1.0; }
+
+		// cost units as measured grain count of a BalancingPolicy (at least 1)
+		static size_t toGrains(double units){ return (size_t)std::max(1.0,std::round(units)); }
+
+		// total cost of grains [first,first+count)
+		double units(size_t first, size_t count) const
+		{
+			if(!enabled)
+				return (double)count;
+			// grains after the estimated ones cost 1
+			const size_t last = first+count;
+			const size_t known = prefix.size()-1;
+			const size_t extra = (last>std::max(first,known)) ? last-std::max(first,known) : 0;
+			return prefix[std::min(last,known)]-prefix[std::min(first,known)]+extra;
+		}
+
+		/* learns costs from grains recorded since last call, returns cost units computed by each device (0 for devices without samples)
+		 * mutRun must be locked
+		 */
+		std::vector<double> learn(size_t totDev)
+		{
+			std::vector<double> computed(totDev,0.0);
+			if(!enabled)
+				return computed;
+
+			// (grain, device, ns) of complete samples
+			std::vector<size_t> grains;
+			std::vector<size_t> devices;
+			std::vector<size_t> times;
+			for(size_t j=0;j<numSamples;j++)
+			{
+				const uint32_t d = sampleDev[j].exchange(0,std::memory_order_acquire);
+				if(d>0 && d<=totDev)
+				{
+					grains.push_back(j);
+					devices.push_back(d-1);
+					times.push_back(sampleNs[j].load(std::memory_order_relaxed));
+				}
+			}
+
+			if(learning && !grains.empty())
+			{
+				factor.resize(totDev,0.0);
+				linked.resize(totDev,false);
+
+				// device factors from grains priced by another device (or hint), first measurement assumes average grains
+				std::vector<double> crossNs(totDev,0.0), crossCost(totDev,0.0), ownNs(totDev,0.0), ownCost(totDev,0.0);
+				for(size_t k=0;k<grains.size();k++)
+				{
+					const size_t j = grains[k];
+					const size_t d = devices[k];
+					if(origin[j]!=unknown && origin[j]!=d)
+					{
+						crossNs[d]+=times[k];
+						crossCost[d]+=cost[j];
+					}
+					ownNs[d]+=times[k];
+					ownCost[d]+=cost[j];
+				}
+				for(size_t d=0;d<totDev;d++)
+				{
+					if(crossCost[d]>0.0 && crossNs[d]>0.0)
+					{
+						const double sample = crossNs[d]/crossCost[d];
+						rebased = rebased || !linked[d] || sample>1.5*factor[d] || 1.5*sample<factor[d];
+						factor[d] = linked[d] ? 0.5*factor[d]+0.5*sample : sample;
+						linked[d] = true;
+					}
+					else if(factor[d]<=0.0 && ownCost[d]>0.0 && ownNs[d]>0.0)
+					{
+						factor[d] = ownNs[d]/ownCost[d];
+					}
+				}
+
+				for(size_t k=0;k<grains.size();k++)
+				{
+					const size_t j = grains[k];
+					const size_t d = devices[k];
+					if(factor[d]<=0.0 || times[k]==0)
+						continue;
+					const double sample = times[k]/factor[d];
+					cost[j] = (origin[j]==unknown) ? sample : 0.5*cost[j]+0.5*sample;
+					origin[j] = (uint32_t)d;
+				}
+				normalize();
+			}
+
+			for(size_t k=0;k<grains.size();k++)
+			{
+				computed[devices[k]]+=getCost(grains[k]);
+			}
+			return computed;
+		}
+
+		/* moves boundaries of contiguous ranges so that each device gets the same share of total cost as its share of grains in grainDev
+		 * (prefix sums of costs, a boundary goes to the nearest grain)
+		 */
+		void partition(std::vector<size_t> & grainDev, size_t totWrk) const
+		{
+			if(!enabled)
+				return;
+			size_t sumCount = 0;
+			for(const size_t g:grainDev)
+			{
+				sumCount+=g;
+			}
+			if(sumCount==0 || totWrk==0)
+				return;
+
+			const double total = units(0,totWrk);
+			size_t acc = 0;
+			size_t begin = 0;
+			for(size_t i=0;i<grainDev.size();i++)
+			{
+				acc+=grainDev[i];
+				size_t end = totWrk;
+				if(acc<sumCount)
+				{
+					const double target = total*acc/(double)sumCount;
+					size_t lo = begin;
+					size_t hi = totWrk;
+					while(lo<hi)
+					{
+						const size_t mid = lo+(hi-lo)/2;
+						if(units(0,mid)<target)
+							lo=mid+1;
+						else
+							hi=mid;
+					}
+					end = lo;
+					if(end>begin && target-units(0,end-1)<units(0,end)-target)
+					{
+						end--;
+					}
+				}
+				grainDev[i]=end-begin;
+				begin=end;
+			}
+		}
+
+		// true once after a device factor is linked to other devices for the first time or changes a lot,
+		// earlier measurements of devices are in other cost units then
+		bool takeRebased()
+		{
+			const bool result = rebased;
+			rebased = false;
+			return result;
+		}
+
+		std::vector<double> getCosts(size_t totWrk) const
+		{
+			std::vector<double> result(totWrk,1.0);
+			for(size_t j=0;j<totWrk;j++)
+			{
+				result[j]=getCost(j);
+			}
+			return result;
+		}
+	private:
+		enum : uint32_t { unknown = 0xFFFFFFFF, hinted = 0xFFFFFFFE }; // origin of a grain without estimate or with a hint
+
+		// mean cost of grains is 1, device factors follow the scale
+		void normalize()
+		{
+			double sum = 0.0;
+			for(const double c:cost)
+			{
+				sum+=c;
+			}
+			if(sum>0.0)
+			{
+				const double mean = sum/cost.size();
+				for(double & c:cost)
+				{
+					c/=mean;
+				}
+				for(double & f:factor)
+				{
+					f*=mean;
+				}
+			}
+			buildPrefix();
+		}
+
+		void buildPrefix()
+		{
+			prefix.assign(cost.size()+1,0.0);
+			for(size_t j=0;j<cost.size();j++)
+			{
+				prefix[j+1]=prefix[j]+cost[j];
+			}
+		}
+
+		bool enabled;
+		bool learning;
+		bool rebased;
+		std::vector<double> cost;
+		std::vector<uint32_t> origin; // device that measured latest cost of grain, hinted or unknown
+		std::vector<double> factor; // nanoseconds per cost unit of each device (per thread), 0: not measured
+		std::vector<bool> linked; // factor is measured on grains priced elsewhere
+		size_t numSamples;
+		std::unique_ptr<std::atomic<size_t>[]> sampleNs; // time of latest computation of each grain
+		std::unique_ptr<std::atomic<uint32_t>[]> sampleDev; // device+1 after sync of grain, 0 after host took the sample
+		std::vector<double> prefix; // prefix[j]: total cost of grains before j
+	};
+
+	/* shape of the pipeline of a device when run() is called with pipelined = true
+	 * grains are scheduled in steps, in step t: sync(t-syncWindow) input(t) compute(t-inputLead) output(t-inputLead-outputLag)
+	 * default (1,1,0) is 3-way overlap: input of grain j, compute of grain j-1, output of grain j-2
+	 */
+	class PipelineOptions
+	{
+	public:
+		PipelineOptions():inputLead(1),outputLag(1),syncWindow(0),batchSize(0){ }
+		PipelineOptions(size_t inputLeadPrm, size_t outputLagPrm, size_t syncWindowPrm, size_t batchSizePrm = 0):inputLead(inputLeadPrm),outputLag(outputLagPrm),syncWindow(syncWindowPrm),batchSize(batchSizePrm){ }
+
+		// number of grains that input stage runs ahead of compute stage (2 = input j+2 while compute j)
+		size_t inputLead;
+
+		// number of grains that output stage runs behind compute stage
+		size_t outputLag;
+
+		// maximum number of grains in flight (started but not synced) before a sync is forced, 0 = sync after all grains
+		// sync of grain j runs just before input of grain j+syncWindow so that per-device buffers can be reused in a ring of syncWindow slots
+		// it is raised to inputLead+outputLag+1 if smaller (a grain is synced only after its output)
+		// non-pipelined runs are computed in blocks of syncWindow grains
+		size_t syncWindow;
+
+		// only for a Kernel with range stages: maximum number of grains in a batch, 0 = whole contiguous range of device
+		// balancing is still per grain, inputLead/outputLag/syncWindow count batches instead of grains
+		size_t batchSize;
+
+		// effective in-flight window for n grains
+		size_t window(size_t n) const
+		{
+			if(syncWindow==0)
+				return n;
+			return std::max(syncWindow, inputLead+outputLag+1);
+		}
+	};
+
+	// options of a device thread, given to LoadBalancerX::addDevice
+	class DeviceOptions
+	{
+	public:
+		DeviceOptions():lazyStart(false),cpuCore(-1),workers(1),watchdogNs(0),redispatchOnTimeout(false),priority(0),weight(1.0){ }
+
+		// true: dedicated thread is created on first run() / runSingleAsync() call instead of addDevice()
+		bool lazyStart;
+
+		// >=0: dedicated thread is pinned to this cpu core when it starts (linux only)
+		int cpuCore;
+
+		// pipeline depth and in-flight window of this device
+		PipelineOptions pipeline;
+
+		// >1: composite device (i.e. cpu cores), work of device is computed by this many threads with work stealing between them
+		// balancer sees only the total throughput of the device, all threads use same device state
+		size_t workers;
+
+		// core of each worker thread when workers>1 (worker 0 is device thread, pinned by cpuCore), missing or -1 = not pinned
+		std::vector<int> workerCores;
+
+		// >0: maximum time (nanoseconds) the host waits for a response of this device in a run, 0 = waits forever
+		// a late load is reported as an unrecovered timeout in run errors (RunError::timeout) and the run returns without its grains,
+		// device is quarantined and gets no loads until its late responses arrive (a grain is not given to two devices in same run)
+		size_t watchdogNs;
+
+		// true: a load that is late by watchdogNs is abandoned, device is quarantined and its grains are computed by other devices
+		// while the hung device may still be computing them (its late responses are dropped)
+		// only for idempotent grains that do not race with another computation of themselves (a grain's state is written by two devices
+		// at the same time, in affinity mode all grains of the device's list are computed again)
+		bool redispatchOnTimeout;
+
+		// (optional) time source of measurements of this device in nanoseconds instead of wall clock
+		// read by device thread at begin and end of each load of a run, used by simulated devices with a virtual clock (see LoadBalancerXSim.h)
+		std::function<size_t()> clock;
+
+		// (optional) called by device thread when a load begins (after clock is read) and ends (before clock is read)
+		// a virtual clock advances here for per-load work such as kernel launch
+		std::function<void()> loadBegin;
+		std::function<void()> loadEnd;
+
+		// (optional) shared device thread: device has no dedicated thread, its loads are computed by executor
+		// in turns with loads of other LoadBalancerX instances using same executor (lazyStart and cpuCore are not used)
+		// time a load waits for other tenants counts for watchdogNs
+		std::shared_ptr<DeviceExecutor> executor;
+
+		// only with executor: tenants with higher priority are served first, tenants of same priority share device time by weight
+		int priority;
+		double weight;
+	};
+
+	template
+	<typename State, typename GrainState>
+	class FieldBlock
+	{
+	public:
+		// responses of single grains wait in response queue until syncSingle, runSingleAsync keeps room in it for a response of every load a run can queue
+		// (device thread would block on a full response queue while host waits for a free load slot)
+		static const size_t maxUnsynced = ThreadsafeQueue<Response,4096,false,true>::capacity - ThreadsafeQueue<Load<GrainOfWork<State,GrainState>>,100,true,false>::capacity;
+
+		FieldBlock():newMeasurement(false),initialized(false),singleInFlight(0),singlePaused(false),tracing(false),traceRun(0),traceOrigin(0),migrations(0),nextTicket(0),stopCollector(false),deadlineScale(1.0)
+		{
+
+		}
+		std::vector<DeviceOptions> options;
+		std::vector<ComputeDevice<State>> devices;
+		GrainStore<State, GrainState> totalWork;
+		std::vector<std::vector<size_t>> dependsOn; // grains that must complete before each grain in graph mode (grains after end have none)
+
+		std::shared_ptr<BalancingPolicy> policy;
+		std::vector<size_t> nsDev;
+		std::vector<size_t> measuredGrains; // grains (cost units with cost model) computed in last collected run (paired with nsDev)
+		bool newMeasurement; // nsDev/measuredGrains changed since last policy update (initial values are placeholders, not a measurement)
+		std::vector<bool> measured; // nsDev/measuredGrains of device are a measurement (or an estimate from loadProfile or from measured devices), not placeholders
+		std::vector<size_t> grainDev;
+		std::vector<size_t> startDev;
+		CostModel costs; // per-grain cost estimates (see LoadBalancerX::setGrainCosts)
+		std::vector<std::thread> thr;
+		std::vector<double> performances;
+		std::vector<std::shared_ptr<std::mutex>> mut;
+		std::vector<bool> running;
+		std::vector<bool> hasWork;
+		std::vector<bool> workComplete;
+		std::shared_ptr<std::mutex> mutGlobal;
+		std::shared_ptr<std::condition_variable> condGlobal; // wakes device threads up when initialized becomes true
+		std::shared_ptr<WaitPoint> slotFreed; // notified by device threads after taking a load from their queue
+		std::shared_ptr<WaitPoint> graphResponded; // notified by device threads after completing a graph grain
+		bool initialized;
+		std::vector<bool> removed; // slot of a removed device (ids of other devices do not change), changed with mutRun and mutGlobal locked
+		std::atomic<size_t> singleInFlight; // grains of runSingleAsync that are not synced by their device yet
+		bool singlePaused; // runSingleAsync waits (on condSingle) while a device is added or removed, changed with mutGlobal locked
+		std::condition_variable condSingle;
+		std::vector<std::shared_ptr<std::condition_variable>> cond;
+		std::vector<std::shared_ptr<ThreadsafeQueue<Load<GrainOfWork<State,GrainState>>,    100,true,false>>> loadQueue;
+		std::vector<std::shared_ptr<ThreadsafeQueue<Response,4096,false,true>>> responseQueue;
+		std::vector<std::shared_ptr<ResponseStream>> responseStreams; // filing of responses of runs and single grains popped from responseQueue
+		std::vector<std::shared_ptr<std::atomic<size_t>>> unsynced; // grains of runSingleAsync given to each device and not returned by syncSingle yet
+		std::vector<std::shared_ptr<StealableRange>> stealRange;
+		std::vector<std::shared_ptr<WorkerPool>> pools; // worker threads of composite devices (created and used only by device thread)
+		std::vector<std::shared_ptr<DeviceStats>> stats;
+		std::vector<std::shared_ptr<DeviceExecutor>> executors; // shared thread of each device (nullptr: dedicated thread)
+		std::vector<size_t> tenants; // tenant id of each device in its executor
+
+		// timeline tracing (enabled between runs, buffers are only written by their own threads)
+		std::atomic<bool> tracing;
+		std::atomic<size_t> traceRun;
+		size_t traceOrigin;
+		std::vector<std::shared_ptr<TraceBuffer>> traceBuffers;
+		std::shared_ptr<TraceBuffer> hostTrace;
+
+		// affinity mode
+		std::vector<int> grainOwner; // device that computed the grain last time, -1 if none
+		std::vector<std::vector<size_t>> assigned; // grains of each device
+		std::vector<std::vector<size_t>> releaseList; // grains that migrated away from each device and need release
+		size_t migrations; // number of grains that changed device in last run
+
+		// runs in flight (runAsync)
+		std::shared_ptr<std::mutex> mutRun;
+		std::deque<PendingRun<State>> pendingRuns;
+		size_t nextTicket;
+
+		// background collector of runAsync: futures become ready when runs complete, without waiting on them
+		std::thread collector;
+		std::mutex mutCollect;
+		std::condition_variable condCollect;
+		std::deque<RunToCollect> toCollect;
+		bool stopCollector;
+
+		// device health (changed only with mutRun locked)
+		std::vector<bool> quarantined; // failed or timed out, gets only a single probe grain per run until a load succeeds
+		std::vector<size_t> abandoned; // responses of timed out loads that are not arrived yet
+		std::vector<std::deque<Response>> stash; // responses that arrived before responses of earlier runs were taken
+		std::vector<RunError> lastErrors; // errors of latest completed run
+
+		// deadline runs
+		std::vector<size_t> importance; // grains in order of importance (see setImportanceOrder)
+		std::vector<std::vector<size_t>> deadlineList; // grains given to each device in latest deadline run, in order of importance
+		double deadlineScale; // measured time / predicted time of latest deadline runs
+
+		// index ranges (see LoadBalancerX::addRange), appended only when no run is in flight
+		std::vector<std::shared_ptr<RangeWork<State>>> ranges;
+		std::vector<size_t> rangeItems; // range items computed by each device in its latest range load (paired with rangeNs, 0: not measured)
+		std::vector<size_t> rangeNs;
+	};
+
+
+    template
+    <typename DeviceState, typename GrainState>
+    class GrainCache
+    {
+    public:
+    	GrainOfWork<DeviceState, GrainState> getGrain(	size_t id,
+    							std::function<void(DeviceState, GrainState&)> init,
+    							std::function<void(DeviceState, GrainState&)> input,
+    							std::function<void(DeviceState, GrainState&)> compute,
+    							std::function<void(DeviceState, GrainState&)> output,
+    							std::function<void(DeviceState, GrainState&)> sync
+    							)
+    	{
+    		auto it = grains.find(id);
+    		if(it!=grains.end())
+    		{
+    			it->second.workInit=init;
+    			it->second.workInput=input;
+    			it->second.workCompute=compute;
+    			it->second.workOutput=output;
+    			it->second.workSync=sync;
+    			return it->second;
+    		}
+    		else
+    		{
+    			grains[id]=GrainOfWork<DeviceState, GrainState>(init,input,compute,output,sync);
+    		}
+    		return grains.at(id);
+    	}
+
+    	// returns a stable pointer to cached grain (created with given functions on first request, not modified later)
+    	// can be given to LoadBalancerX::runSingleAsync to keep grain state between single runs without copying the grain
+    	GrainOfWork<DeviceState, GrainState> * getGrainHandle(	size_t id,
+    							std::function<void(DeviceState, GrainState&)> init,
+    							std::function<void(DeviceState, GrainState&)> input,
+    							std::function<void(DeviceState, GrainState&)> compute,
+    							std::function<void(DeviceState, GrainState&)> output,
+    							std::function<void(DeviceState, GrainState&)> sync
+    							)
+    	{
+    		auto it = grains.find(id);
+    		if(it==grains.end())
+    		{
+    			it = grains.insert(std::make_pair(id,GrainOfWork<DeviceState, GrainState>(init,input,compute,output,sync))).first;
+    		}
+    		return &(it->second);
+    	}
+    private:
+    	std::map<size_t,GrainOfWork<DeviceState, GrainState>> grains;
+    };
+
+
+	// GPGPU load balancing tool
+	// distributes work between different graphics cards
+	// in a way that minimizes total computation time
+	// EnableStats: records per-device stage latencies, idle time and queue depth (see getDeviceStats), no overhead when false
+	// Kernel: FunctionKernel calls std::function objects of each grain, a user Kernel type has static stage functions (see FunctionKernel)
+	template
+	<typename State, typename GrainState, bool EnableStats = false, typename Kernel = FunctionKernel>
+	class LoadBalancerX
+	{
+	public:
+		LoadBalancerX() // mutGlobal(std::make_shared<std::mutex>()),initialized(false)
+		{
+			fields=std::make_shared<FieldBlock<State, GrainState>>();
+			fields->mutGlobal=std::make_shared<std::mutex>();
+			fields->condGlobal=std::make_shared<std::condition_variable>();
+			fields->slotFreed=std::make_shared<WaitPoint>();
+			fields->graphResponded=std::make_shared<WaitPoint>();
+			fields->policy=std::make_shared<MovingAveragePolicy>();
+			fields->mutRun=std::make_shared<std::mutex>();
+			runCount=0;
+		}
+
+		~LoadBalancerX()
+		{
+			// futures of runAsync that are still in flight are completed before devices stop
+			{
+				std::unique_lock<std::mutex> lg(fields->mutCollect);
+				fields->stopCollector=true;
+				fields->condCollect.notify_all();
+			}
+			if(fields->collector.joinable())
+			{
+				fields->collector.join();
+			}
+
+			// threads that were never given work are still waiting for initialization
+			{
+				std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+				fields->initialized=true;
+				fields->condGlobal->notify_all();
+			}
+
+			// tenants of removed devices are already detached from their executors
+			for(size_t i=0; i<fields->thr.size(); i++)
+			{
+				if(!fields->executors[i] || !fields->removed[i])
+				{
+					pushLoad(fields, i, Load<GrainOfWork<State,GrainState>>({0,0,0,false,nullptr,false,nullptr,nullptr,0,nullptr,nullptr,nullptr}));
+				}
+			}
+
+			for(size_t i=0; i<fields->thr.size(); i++)
+			{
+				if(fields->thr[i].joinable())
+				{
+					fields->thr[i].join();
+				}
+				else if(fields->executors[i] && !fields->removed[i])
+				{
+					fields->executors[i]->detach(fields->tenants[i]);
+				}
+			}
+		}
+
+		// waits for runs in flight (runAsync) before adding the grain
+		void addWork(GrainOfWork<State, GrainState> work)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+
+			std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+			fields->totalWork.add(work);
+		}
+
+		/* adds count grains that share stage functions of work (stored once), useful for hundreds of thousands of grains
+		 * generator: (optional) returns grain state of grain with given index (index of first new grain + k), otherwise state of work is copied
+		 * waits for runs in flight, returns index of first new grain
+		 */
+		size_t addWorkBulk(size_t count, GrainOfWork<State, GrainState> work, std::function<GrainState(size_t)> generator = nullptr)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+
+			std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+			const size_t first = fields->totalWork.size();
+			fields->totalWork.addBulk(count, work, generator);
+			return first;
+		}
+
+		/* adds a grain that is computed only after all grains in dependsOn complete, when run(Mode::Graph) is called
+		 * dependsOn: indices of earlier grains (index of a grain is its order of adding, starting from 0)
+		 * returns index of the new grain, or (size_t)-1 without adding it if a dependency is not an earlier grain
+		 * other modes ignore dependencies, waits for runs in flight
+		 */
+		size_t addWork(GrainOfWork<State, GrainState> work, std::vector<size_t> dependsOn)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+
+			std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+			const size_t index = fields->totalWork.size();
+			for(const size_t j:dependsOn)
+			{
+				if(j>=index)
+				{
+					std::cout<<"Error: grain-"<<index<<" can not depend on grain-"<<j<<std::endl;
+					return (size_t)-1;
+				}
+			}
+			fields->totalWork.add(work);
+			fields->dependsOn.resize(index+1);
+			fields->dependsOn[index]=dependsOn;
+			return index;
+		}
+
+		/* adds index space [0,n) that is computed in parallel by all devices in every run (parallel-for), body(state, first, last) computes items [first,last)
+		 * chunk size is picked per device: it grows until per-chunk overhead (part of chunk time that does not grow with item count) is at most
+		 * overheadFraction of chunk time, and it shrinks near end of range so that devices finish together (no need to tune grain count by hand)
+		 * each device starts taking chunks after its grains (a device that finishes its grains early computes more items)
+		 * computed by run() in all modes and by runAsync (not by run(budget)), items of a range and ranges of a run are computed in any order
+		 * a chunk whose body throws is computed again by another device (see RunError::grain, it is first item of chunk)
+		 * waits for runs in flight, returns index of range (ranges are given in order of adding, starting from 0)
+		 */
+		size_t addRange(size_t n, std::function<void(State, size_t, size_t)> body, double overheadFraction = 0.05)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+
+			std::shared_ptr<RangeWork<State>> work = std::make_shared<RangeWork<State>>();
+			work->n = n;
+			work->overheadFraction = overheadFraction;
+			work->body = body;
+			fields->ranges.push_back(work);
+			return fields->ranges.size()-1;
+		}
+		/* adds a device with a dedicated thread, returns id of device (ids are given in order of adding, starting from 0)
+		 * options: lazy creation of thread and cpu core pinning, or a DeviceExecutor shared with other LoadBalancerX instances instead of a thread
+		 * can be called between or during runs: waits for runs in flight and single grains that are not computed yet, other devices keep running
+		 * new device starts with average learned throughput of other devices, their learned ratios are kept
+		 */
+		size_t addDevice(ComputeDevice<State> devPrm, DeviceOptions options = DeviceOptions())
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+
+			size_t indexThr;
+			pauseSingleGrains();
+			{
+				std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+				fields->loadQueue.push_back(    std::make_shared<ThreadsafeQueue<Load<GrainOfWork<State,GrainState>>,    100,true,false>>());
+				fields->responseQueue.push_back(std::make_shared<ThreadsafeQueue<Response,4096,false,true>>());
+				fields->responseStreams.push_back(std::make_shared<ResponseStream>());
+				fields->unsynced.push_back(std::make_shared<std::atomic<size_t>>(0));
+				fields->stealRange.push_back(std::make_shared<StealableRange>());
+				fields->pools.push_back(nullptr);
+				fields->stats.push_back(std::make_shared<DeviceStats>());
+				fields->executors.push_back(options.executor);
+				fields->tenants.push_back(0);
+				indexThr = fields->thr.size();
+				fields->thr.push_back(std::thread());
+				fields->options.push_back(options);
+
+				fields->mut.push_back(std::make_shared<std::mutex>());
+				fields->cond.push_back(std::make_shared<std::condition_variable>());
+				{
+					std::unique_lock<std::mutex> lg(*(fields->mut[indexThr]));
+					fields->devices.push_back(devPrm);
+					fields->running.push_back(true);
+					fields->hasWork.push_back(false);
+					fields->workComplete.push_back(true);
+
+					fields->performances.push_back(1.0);
+					fields->nsDev.push_back(1);
+					fields->measuredGrains.push_back(1);
+					fields->measured.push_back(false);
+					fields->grainDev.push_back(1);
+					fields->startDev.push_back(0);
+					fields->assigned.push_back(std::vector<size_t>());
+					fields->totalWork.addDevice();
+					fields->releaseList.push_back(std::vector<size_t>());
+					fields->deadlineList.push_back(std::vector<size_t>());
+					fields->rangeItems.push_back(0);
+					fields->rangeNs.push_back(0);
+					fields->quarantined.push_back(false);
+					fields->abandoned.push_back(0);
+					fields->stash.push_back(std::deque<Response>());
+					fields->removed.push_back(false);
+				}
+				if(fields->hostTrace)
+				{
+					fields->traceBuffers.push_back(std::make_shared<TraceBuffer>(fields->hostTrace->capacity()));
+				}
+				rescaleForNewDevice(indexThr);
+
+				// thread waits for initialization before accessing any field
+				if(options.executor)
+				{
+					// executor computes loads of device only after they are queued by a run or single grain
+					std::shared_ptr<DeviceContext> context = std::make_shared<DeviceContext>();
+					fields->tenants[indexThr] = options.executor->attach(options.priority, options.weight,
+																		 [this,indexThr,context](){ return stepDevice(indexThr, *context); });
+				}
+				else if(!options.lazyStart)
+				{
+					startDevice(indexThr);
+				}
+				else
+				{
+					fields->initialized=false;
+				}
+				resumeSingleGrains();
+			}
+			return indexThr;
+		}
+
+		/* stops a device: waits for runs in flight and single grains that are not computed yet, releases grains initialized in device
+		 * (calls release function of each grain that has one, in device thread) and joins its thread (or detaches it from its executor)
+		 * id of removed device is not given to another device, responses of its single grains can still be taken by syncSingle
+		 * remaining devices keep their learned ratios and share the work of removed device from next run on
+		 * returns false if there is no such device or it is already removed
+		 */
+		bool removeDevice(size_t id)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+
+			std::thread thread;
+			pauseSingleGrains();
+			{
+				std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+				if(id>=fields->removed.size() || fields->removed[id])
+				{
+					std::cout<<"Error: device-"<<id<<" does not exist"<<std::endl;
+					resumeSingleGrains();
+					return false;
+				}
+				fields->removed[id]=true;
+				resumeSingleGrains();
+				thread = std::move(fields->thr[id]);
+
+				// thread may still be waiting for initialization
+				fields->condGlobal->notify_all();
+			}
+
+			if(thread.joinable())
+			{
+				fields->loadQueue[id]->push(Load<GrainOfWork<State,GrainState>>({8,0,0,false,nullptr,false,nullptr,nullptr,0,nullptr,nullptr,nullptr}));
+				thread.join();
+			}
+			else if(fields->executors[id])
+			{
+				pushLoad(fields, id, Load<GrainOfWork<State,GrainState>>({8,0,0,false,nullptr,false,nullptr,nullptr,0,nullptr,nullptr,nullptr}));
+				fields->executors[id]->detach(fields->tenants[id]);
+			}
+
+			fields->totalWork.clearDevice(id);
+			fields->releaseList[id].clear();
+			for(const size_t j:fields->assigned[id])
+			{
+				fields->grainOwner[j]=-1; // moves to another device in next affinity partitioning without release
+			}
+			fields->quarantined[id]=false;
+
+			fields->performances[id]=0.0;
+			normalizePerformances();
+			fields->policy->rescale(fields->performances);
+			return true;
+		}
+
+
+
+
+		// runs a copy of grain asynchronously in a device (state changes of grain are not visible to caller)
+		// returns id of selected device, to be given to syncSingle ((size_t)-1 if all devices are removed)
+		// up to 3968 grains per device can wait for syncSingle, beyond that this waits until another thread calls syncSingle
+		size_t runSingleAsync(GrainOfWork<State, GrainState> grain)
+		{
+			return runSingleAsync(new GrainOfWork<State, GrainState>(std::move(grain)), true);
+		}
+
+		// runs grain asynchronously in a device without copying it
+		// grain state and per-device initialization are kept in the pointed grain, so init runs only once per device
+		// grain must stay alive and must not be given again until syncSingle of returned device id returns for it
+		// returns id of selected device, to be given to syncSingle ((size_t)-1 if all devices are removed)
+		size_t runSingleAsync(GrainOfWork<State, GrainState> * grain)
+		{
+			return runSingleAsync(grain, false);
+		}
+
+		// returns latency of grain's operation from being acquired by dedicated device thread to being sent to synchronization queue
+		// most of this latency can be hidden behind other grains' operations
+		size_t syncSingle(size_t id)
+		{
+			std::exception_ptr error;
+			return syncSingle(id, error);
+		}
+
+		// same as syncSingle(id), error: exception thrown by a stage function of the grain (nullptr if grain is computed)
+		size_t syncSingle(size_t id, std::exception_ptr & error)
+		{
+			Response response = takeSingleResponse(id);
+			fields->unsynced[id]->fetch_sub(1);
+			fields->slotFreed->notify();
+			error = response.error;
+			if(response.msg==0)
+			{
+				std::cout<<"Error: compute failed in device-"<<id<<std::endl;
+			}
+			return response.ns;
+		}
+
+		/* returns elapsed time in nanoseconds (this is minimized by load-balancer)
+		* pipelined: uses skewed concurrency (3-way by default, see PipelineOptions of each device) in launch pattern of input/compute/output/sync methods for supporting any CUDA/OpenCL-like efficient stream overlapping
+		*/
+		size_t run(bool pipelined = false)
+		{
+			return run(Mode::Static, pipelined);
+		}
+
+		/* returns elapsed time in nanoseconds (this is minimized by load-balancer)
+		* mode: Mode::Static gives each device a single range, Mode::WorkStealing lets idle devices steal from back of slowest device's range
+		* 		Mode::Affinity keeps grains on devices that initialized them and moves only the minimum number of grains (see getMigrationCount)
+		* exception of a stage function (or timeout with DeviceOptions::redispatchOnTimeout) fails the load of a device, its grains are computed again
+		* 		by healthy devices in same run and the device is quarantined until a probe grain succeeds (see getRunErrors)
+		* 		grains of a failed load are computed at least once, some of them may be computed twice
+		* 		a timeout without redispatchOnTimeout quarantines the device too, but the run returns without grains of the late load
+		* 		(RunError::recovered is false)
+		* pipelined: uses skewed concurrency (3-way by default, see PipelineOptions of each device) in launch pattern of input/compute/output/sync methods for supporting any CUDA/OpenCL-like efficient stream overlapping
+		*/
+		size_t run(Mode mode, bool pipelined = false)
+		{
+			if(mode == Mode::Static)
+			{
+				std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+				std::future<RunResult> result;
+				const size_t ticket = dispatchRun(pipelined, false, result);
+				collectRuns(fields, ticket);
+				return result.get().elapsed;
+			}
+
+			// other modes change shared per-device ranges/lists that runs in flight may still be using
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+
+			const size_t totDev = fields->devices.size();
+			const size_t traceBegin = prepareRun(mode);
+			const size_t ticket = fields->nextTicket++;
+			std::vector<RunError> errors;
+
+			size_t elapsedTotal;
+			{
+				Bench bench(&elapsedTotal);
+
+				// grains of failed devices, computed again by healthy devices after all devices respond
+				std::vector<std::pair<size_t,size_t>> lost;
+				std::vector<size_t> failures; // indices of errors of the failed loads
+				std::shared_ptr<RangeRun<State>> ranges;
+				if(mode == Mode::Graph)
+				{
+					computeGraph(pipelined, ticket, errors);
+					ranges = dispatchRanges(ticket, nullptr);
+				}
+				else if(mode == Mode::WorkStealing)
+				{
+					// each device starts with its predicted range and all devices join stealing when they are out of work
+					// a quarantined device computes only its probe grain and does not steal
+					for(size_t i=0; i<totDev; i++)
+					{
+						const size_t end = (fields->quarantined[i] || fields->removed[i]) ? fields->startDev[i] : fields->startDev[i]+fields->grainDev[i];
+						fields->stealRange[i]->seed(fields->startDev[i],end,
+													std::max((size_t)1,fields->grainDev[i]/8),fields->performances[i]);
+					}
+
+					std::vector<bool> loaded(totDev,false);
+					for(size_t i=0; i<totDev; i++)
+					{
+						if(fields->removed[i])
+							continue;
+						if(!fields->quarantined[i])
+						{
+							pushLoad(fields, i, Load<GrainOfWork<State,GrainState>>({4,0,0,pipelined,nullptr,false,nullptr,nullptr,ticket,nullptr,nullptr,nullptr}));
+							loaded[i]=true;
+						}
+						else if(fields->grainDev[i]>0)
+						{
+							pushLoad(fields, i, Load<GrainOfWork<State,GrainState>>({1,fields->startDev[i],fields->grainDev[i],pipelined,nullptr,false,nullptr,nullptr,ticket,nullptr,nullptr,nullptr}));
+							loaded[i]=true;
+						}
+					}
+					ranges = dispatchRanges(ticket, nullptr);
+
+					std::vector<bool> failed(totDev,false);
+					std::vector<bool> redispatch(totDev,false); // grains of failed device can be given to others
+					for(size_t i=0; i<totDev; i++)
+					{
+						if(!loaded[i])
+							continue;
+
+						Response response;
+						const bool responded = takeResponse(fields, i, ticket, response);
+						if(!responded || response.msg==0)
+						{
+							const bool probe = fields->quarantined[i];
+							failed[i]=true;
+							redispatch[i]=deviceFailed(fields, i, !responded, response, errors);
+							if(redispatch[i])
+							{
+								if(probe)
+								{
+									lost.push_back(std::make_pair(fields->startDev[i],fields->grainDev[i]));
+								}
+								failures.push_back(errors.size()-1);
+							}
+							continue;
+						}
+						fields->quarantined[i]=false;
+
+						// a device without any grain has no new information about its performance
+						if(response.grains>0)
+						{
+							fields->nsDev[i]=response.ns;
+							fields->measured[i]=true;
+							fields->measuredGrains[i]=response.grains;
+						}
+					}
+
+					// chunk in progress and remaining grains of failed devices (healthy devices may have stolen some of them)
+					// a hung device keeps its chunk in progress, the rest of its range is already stolen by healthy devices
+					for(size_t i=0; i<totDev; i++)
+					{
+						size_t first = 0;
+						size_t count = 0;
+						if(redispatch[i] && fields->stealRange[i]->takeAll(first,count))
+						{
+							lost.push_back(std::make_pair(first,count));
+						}
+					}
+
+					// stolen chunks are known only from timed grains
+					const std::vector<double> units = fields->costs.learn(totDev);
+					for(size_t i=0; i<totDev && fields->costs.active(); i++)
+					{
+						if(loaded[i] && !failed[i] && units[i]>0.0)
+						{
+							fields->measuredGrains[i]=CostModel::toGrains(units[i]);
+						}
+					}
+				}
+				else
+				{
+					// grains that left a device are released before any device starts initializing them
+					releaseMigratedGrains(ticket, errors, failures);
+
+					// parallel run for real work & time measurement
+					std::vector<bool> measured(totDev,false);
+					for(size_t i=0; i<totDev; i++)
+					{
+
+						if(fields->grainDev[i]>0)
+						{
+							pushLoad(fields, i, Load<GrainOfWork<State,GrainState>>({6,fields->startDev[i],fields->grainDev[i],pipelined,nullptr,false,nullptr,nullptr,ticket,nullptr,nullptr,nullptr}));
+
+						}
+					}
+					ranges = dispatchRanges(ticket, nullptr);
+
+					for(size_t i=0; i<totDev; i++)
+					{
+						if(fields->grainDev[i]>0)
+						{
+
+							Response response;
+							const bool responded = takeResponse(fields, i, ticket, response);
+							if(!responded || response.msg==0)
+							{
+								if(!deviceFailed(fields, i, !responded, response, errors))
+									continue;
+								failures.push_back(errors.size()-1);
+
+								// contiguous parts of assigned list
+								const std::vector<size_t> & list = fields->assigned[i];
+								for(size_t k=0; k<list.size(); k++)
+								{
+									if(k>0 && list[k]==lost.back().first+lost.back().second)
+									{
+										lost.back().second++;
+									}
+									else
 									{
-										fields->totalWork[j].output(state, fields->totalWork[j].refGrainState()); // user should have asynchronous launch in this
+										lost.push_back(std::make_pair(list[k],(size_t)1));
 									}
+								}
+								continue;
+							}
+							fields->quarantined[i]=false;
+							fields->nsDev[i]=response.ns;
+							fields->measured[i]=true;
+							fields->measuredGrains[i]=fields->grainDev[i];
+							measured[i]=true;
+						}
+					}
+
+					// lists are priced with costs learned from this run (same units as targets of next partitionAffinity)
+					fields->costs.learn(totDev);
+					for(size_t i=0; i<totDev && fields->costs.active(); i++)
+					{
+						if(measured[i])
+						{
+							double units = 0.0;
+							for(const size_t j:fields->assigned[i])
+							{
+								units+=fields->costs.getCost(j);
+							}
+							fields->measuredGrains[i]=CostModel::toGrains(units);
+						}
+					}
+				}
+				bool rangesComplete = true;
+				if(ranges)
+				{
+					std::vector<size_t> itemDev(totDev,0);
+					collectRanges(fields, ranges, ticket, errors, itemDev, rangesComplete);
+				}
+				recover(fields, lost, failures, ticket, pipelined, errors);
+				fields->costs.learn(totDev);
+				fields->newMeasurement=true;
+				reseedIfRebased(fields);
+			}
+			fields->lastErrors=errors;
+
+			if(traceBegin>0)
+			{
+				fields->hostTrace->add(numStages, 0, 0, traceBegin, nowNanoseconds(), runCount);
+			}
+			return elapsedTotal;
+
+		}
+
+		/* computes the most important grains that can be completed within budget (counted from the call), returns which grains are completed
+		 * grains are given to devices in order of importance (see setImportanceOrder), each grain to the device that is predicted to finish it first
+		 * (from learned performances), until the next grain would finish later than budget on every device
+		 * devices do not start a grain after budget (grains in flight are completed), grains of a failed device are not computed again
+		 * prediction is corrected by measured/predicted time of previous deadline runs, so the number of attempted grains follows the budget
+		 * over consecutive runs (before the first measurement all grains are attempted and devices stop at budget)
+		 * pipelined: see run(bool)
+		 */
+		DeadlineResult run(std::chrono::nanoseconds budget, bool pipelined = false)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+
+			const size_t begin = nowNanoseconds();
+			const size_t budgetNs = budget.count()>0 ? (size_t)budget.count() : 0;
+			const size_t totDev = fields->devices.size();
+			const size_t totWrk = fields->totalWork.size();
+			const size_t traceBegin = prepareRun(Mode::Static);
+			const size_t ticket = fields->nextTicket++;
+			std::shared_ptr<DeadlineSignal> deadline = std::make_shared<DeadlineSignal>(begin+budgetNs, totWrk, totDev);
+			const std::vector<size_t> order = importanceOrder();
+
+			// predicted time per grain of each device: its share of total throughput of latest measurement
+			// devices do not start a grain that is predicted to finish after budget
+			bool measured = true;
+			double throughput = 0.0;
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(!fields->removed[i])
+				{
+					throughput += fields->measuredGrains[i]/(double)fields->nsDev[i];
+					measured = measured && fields->measured[i];
+				}
+			}
+
+			// quarantined device gets a single probe grain after responses of its timed out loads arrive
+			std::vector<size_t> limit(totDev,totWrk);
+			std::vector<double> perGrain(totDev,0.0);
+			std::priority_queue<std::pair<double,size_t>,std::vector<std::pair<double,size_t>>,std::greater<std::pair<double,size_t>>> next;
+			// grain list of a device that is still computing a timed out load is kept until it responds
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(fields->quarantined[i] && fields->abandoned[i]>0)
+					continue;
+				fields->deadlineList[i].clear();
+				if(fields->removed[i] || fields->performances[i]<=0.0)
+					continue;
+				if(fields->quarantined[i])
+				{
+					limit[i] = 1;
+				}
+				perGrain[i] = measured ? fields->deadlineScale/(fields->performances[i]*throughput) : 1.0/fields->performances[i];
+				deadline->grainNs[i] = measured ? (size_t)perGrain[i] : 0;
+				next.push(std::make_pair(perGrain[i],i));
+			}
+
+			size_t attempted = 0;
+			double predicted = 0.0;
+			while(attempted<order.size() && !next.empty() && !(measured && next.top().first>budgetNs))
+			{
+				const std::pair<double,size_t> earliest = next.top();
+				next.pop();
+				const size_t i = earliest.second;
+				fields->deadlineList[i].push_back(order[attempted++]);
+				predicted = std::max(predicted, earliest.first);
+				if(fields->deadlineList[i].size()<limit[i])
+				{
+					next.push(std::make_pair(earliest.first+perGrain[i],i));
+				}
+			}
+
+			// kept list of a device with a timed out load is only read by that load, it is not sent again
+			for(size_t i=0; i<totDev; i++)
+			{
+				if(!fields->deadlineList[i].empty() && fields->abandoned[i]==0)
+				{
+					pushLoad(fields, i, Load<GrainOfWork<State,GrainState>>({9,0,fields->deadlineList[i].size(),pipelined,nullptr,false,nullptr,nullptr,ticket,nullptr,deadline,nullptr}));
+				}
+			}
+
+			DeadlineResult result;
+			result.attempted = attempted;
+			result.nsDev = std::vector<size_t>(totDev,0);
+			result.grainDev = std::vector<size_t>(totDev,0);
+			size_t numCompleted = 0;
+			std::vector<uint8_t> completed(totWrk,0);
+			for(size_t i=0; i<totDev; i++)
+			{
+				if(fields->deadlineList[i].empty() || fields->abandoned[i]>0)
+					continue;
+
+				// grains synced before a failure are completed too (completion of a timed out device is not known)
+				Response response;
+				const bool responded = takeResponse(fields, i, ticket, response);
+				for(const size_t j:fields->deadlineList[i])
+				{
+					if(responded && deadline->completed[j])
+					{
+						completed[j]=1;
+						result.grainDev[i]++;
+					}
+				}
+				numCompleted += result.grainDev[i];
+				if(!responded || response.msg==0)
+				{
+					deviceFailed(fields, i, !responded, response, result.errors);
+					continue;
+				}
+				fields->quarantined[i]=false;
+				result.nsDev[i] = response.ns;
+
+				// a device that completed no grain has no new information about its performance
+				if(result.grainDev[i]>0)
+				{
+					double units = 0.0;
+					for(const size_t j:fields->deadlineList[i])
+					{
+						units += completed[j] ? fields->costs.getCost(j) : 0.0;
+					}
+					fields->nsDev[i]=std::max((size_t)1,response.ns);
+					fields->measured[i]=true;
+					fields->measuredGrains[i]=CostModel::toGrains(units);
+					fields->newMeasurement=true;
+				}
+			}
+			fields->costs.learn(totDev);
+			reseedIfRebased(fields);
+			result.elapsed = nowNanoseconds()-begin;
+			result.met = result.elapsed<=budgetNs;
+
+			// attempted grains would take elapsed*attempted/completed, prediction of next run is scaled by its ratio to predicted time
+			if(measured && predicted>0.0 && numCompleted>0)
+			{
+				const double ratio = (result.elapsed*(double)attempted/numCompleted) / (predicted/fields->deadlineScale);
+				fields->deadlineScale = 0.5*fields->deadlineScale + 0.5*ratio;
+			}
+
+			for(size_t k=0;k<attempted;k++)
+			{
+				if(completed[order[k]])
+				{
+					result.completed.push_back(order[k]);
+				}
+			}
+			fields->lastErrors=result.errors;
+
+			if(traceBegin>0)
+			{
+				fields->hostTrace->add(numStages, 0, 0, traceBegin, nowNanoseconds(), runCount);
+			}
+			return result;
+		}
+
+		/* order of importance of grains for run(budget): most important grain first
+		 * grains that are not in order come after them in order of index, invalid and repeated indices are ignored
+		 */
+		void setImportanceOrder(std::vector<size_t> order)
+		{
+			std::unique_lock<std::mutex> lg(*(fields->mutRun));
+			fields->importance = order;
+		}
+
+		/* makes run() partition grains by predicted cost instead of grain count: each device gets a contiguous range whose total predicted cost
+		 * (prefix sums of per-grain costs) is its share of total cost, and device performance is learned in cost units
+		 * hints: relative cost of each grain (missing or non-positive: not known, starts as an average grain)
+		 * learn: per-grain costs are learned from measured grain times (sum of stage call durations of grain) separately from device speed,
+		 * 		hints are refined by measurements, without learning the hints are used as they are
+		 * applies to modes Static and WorkStealing (their ranges and shares) and Affinity (total predicted cost of grain list of each device
+		 * 		follows its share, grains still move only when a list is over its share), waits for runs in flight
+		 */
+		void setGrainCosts(std::vector<double> hints = std::vector<double>(), bool learn = true)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+			fields->costs.configure(hints, learn, fields->totalWork.size());
+		}
+
+		// returns predicted relative cost of each grain (mean is 1, all 1 before setGrainCosts)
+		std::vector<double> getGrainCosts()
+		{
+			std::unique_lock<std::mutex> lg(*(fields->mutRun));
+			return fields->costs.getCosts(fields->totalWork.size());
+		}
+
+		/* starts a run (Mode::Static) without waiting for it, returned future gives elapsed time and per-device results
+		 * future becomes ready when the run is complete (responses are collected by a background thread), so it can be polled with wait_for
+		 * can be called again before previous runs complete: devices that finish early start next run's grains immediately
+		 * a device waits only for the devices whose previous-run ranges overlap its new range, so no grain is computed by two runs at the same time
+		 * (per-grain order of runs is preserved)
+		 * work distribution of a run is based on the latest completed run
+		 * grains of a failed device are computed again when the run is collected, possibly after grains of later runs (see RunResult::errors)
+		 * exception: a device that times out (RunError::timeout) is not waited for, devices of later runs (and re-dispatched grains with
+		 * redispatchOnTimeout) can compute grains of its late load while it is still computing them, grains must tolerate this or use no watchdog
+		 */
+		std::future<RunResult> runAsync(bool pipelined = false)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			std::future<RunResult> result;
+			dispatchRun(pipelined, true, result);
+			return result;
+		}
+
+		// returns a snapshot of per-device statistics (all zero unless EnableStats=true), can be called while devices are running
+		// latencies are durations of user stage function calls (asynchronous launches return early)
+		std::vector<DeviceStatsSnapshot> getDeviceStats()
+		{
+			std::vector<std::shared_ptr<DeviceStats>> stats;
+			{
+				std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+				stats = fields->stats;
+			}
+			std::vector<DeviceStatsSnapshot> result(stats.size());
+			for(size_t i=0;i<stats.size();i++)
+			{
+				for(int j=0;j<numStages;j++)
+				{
+					const LatencyHistogram & h = stats[i]->stage[j];
+					result[i].stage[j].calls = h.getCount();
+					result[i].stage[j].totalNs = h.getTotal();
+					result[i].stage[j].p50Ns = h.percentile(0.5);
+					result[i].stage[j].p99Ns = h.percentile(0.99);
+					result[i].stage[j].maxNs = h.getMaximum();
+				}
+				result[i].grains = stats[i]->grains.load(std::memory_order_relaxed);
+				result[i].initCalls = result[i].stage[(int)Stage::Init].calls;
+				result[i].idleNs = stats[i]->idleNs.load(std::memory_order_relaxed);
+				result[i].queueHighWater = stats[i]->queueHighWater.load(std::memory_order_relaxed);
+			}
+			return result;
+		}
+
+		// clears statistics of all devices
+		void resetDeviceStats()
+		{
+			std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+			for(size_t i=0;i<fields->stats.size();i++)
+			{
+				fields->stats[i]->reset();
+			}
+		}
+
+		// starts recording begin/end time of every stage call of every grain into preallocated per-thread buffers
+		// eventsPerDevice: capacity of each device buffer, only the latest events are kept
+		// must be called between runs (not while any device is computing)
+		void enableTracing(size_t eventsPerDevice = 1000000)
+		{
+			std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+			fields->traceBuffers.clear();
+			for(size_t i=0;i<fields->devices.size();i++)
+			{
+				fields->traceBuffers.push_back(std::make_shared<TraceBuffer>(eventsPerDevice));
+			}
+			fields->hostTrace = std::make_shared<TraceBuffer>(eventsPerDevice);
+			fields->traceOrigin = nowNanoseconds();
+			fields->tracing.store(true);
+		}
+
+		// stops recording, recorded events are kept until next enableTracing call
+		void disableTracing()
+		{
+			fields->tracing.store(false);
+		}
+
+		// writes recorded events in Chrome Trace Event JSON format (chrome://tracing, ui.perfetto.dev)
+		// must be called between runs
+		void writeChromeTrace(std::ostream & out)
+		{
+			std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+			if(fields->hostTrace)
+			{
+				writeChromeTraceEvents(out, fields->traceBuffers, *fields->hostTrace, fields->traceOrigin);
+			}
+		}
+
+		// writes recorded events to a json file, returns false if file can not be written
+		bool saveChromeTrace(std::string path)
+		{
+			std::ofstream file(path);
+			if(!file)
+				return false;
+			writeChromeTrace(file);
+			return (bool)file;
+		}
+
+		// returns failures of latest completed run (empty if all devices computed their grains)
+		std::vector<RunError> getRunErrors()
+		{
+			std::unique_lock<std::mutex> lg(*(fields->mutRun));
+			return fields->lastErrors;
+		}
+
+		// returns true if device failed and is not given work until a probe grain succeeds
+		bool isDeviceQuarantined(size_t indexThr)
+		{
+			std::unique_lock<std::mutex> lg(*(fields->mutRun));
+			return fields->quarantined[indexThr];
+		}
+
+		// returns number of grains that moved to another device in last run() with Mode::Affinity
+		size_t getMigrationCount()
+		{
+			std::unique_lock<std::mutex> lg(*(fields->mutRun));
+			return fields->migrations;
+		}
+
+		// changes performance model and work distribution strategy of run()
+		// default: MovingAveragePolicy (5-sample moving average of throughput)
+		// new policy starts from current performances of devices (measured ones are also given their latest grains and time)
+		void setBalancingPolicy(std::shared_ptr<BalancingPolicy> policy)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			fields->policy=policy;
+
+			// placeholder of a device that is not measured yet is not given to the model
+			std::vector<size_t> grains = fields->measuredGrains;
+			std::vector<double> performances = fields->performances;
+			double total = 0.0;
+			for(const double performance:performances)
+			{
+				total+=performance;
+			}
+			for(size_t i=0;i<grains.size();i++)
+			{
+				if(!fields->measured[i])
+				{
+					grains[i]=0;
+				}
+				if(total>0.0)
+				{
+					performances[i]/=total;
+				}
+			}
+			fields->policy->seed(performances, grains, fields->nsDev);
+		}
+
+		/* writes learned performance of devices to a file, returns false if file can not be written
+		 * devices are keyed by identity given in ComputeDevice (or "device-<index>" if not given)
+		 * format (text): header line, then one line per device: share grains nanoseconds identity
+		 */
+		bool saveProfile(std::string path)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+
+			std::ofstream file(path);
+			if(!file)
+				return false;
+			const size_t totDev = fields->devices.size();
+			file<<"LoadBalancerX-profile 1 "<<std::count(fields->removed.begin(),fields->removed.end(),false)<<"\n";
+			file.precision(17);
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(fields->removed[i])
+					continue;
+				file<<fields->performances[i]<<" "<<fields->measuredGrains[i]<<" "<<fields->nsDev[i]<<" "<<deviceIdentity(i)<<"\n";
+			}
+			return (bool)file;
+		}
+
+		/* loads performance of devices saved by saveProfile so that first run() uses the learned work distribution
+		 * devices are matched by identity, devices that are not in the profile get average throughput of matched devices
+		 * removed devices keep their zero share
+		 * returns false (and changes nothing) if file can not be read, has unknown format or has no matching device
+		 * should be called after adding devices and work, before first run() (waits for runs in flight)
+		 */
+		bool loadProfile(std::string path)
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			collectRuns(fields, (size_t)-1);
+
+			std::ifstream file(path);
+			std::string magic;
+			int version = 0;
+			size_t numSaved = 0;
+			if(!(file>>magic>>version>>numSaved) || magic!="LoadBalancerX-profile" || version!=1)
+				return false;
+
+			// throughput (grains per nanosecond) of each saved device
+			std::map<std::string,double> saved;
+			for(size_t k=0;k<numSaved;k++)
+			{
+				double share = 0.0;
+				size_t grains = 0;
+				size_t ns = 0;
+				std::string identity;
+				if(!(file>>share>>grains>>ns))
+					return false;
+				std::getline(file,identity);
+				identity.erase(0,identity.find_first_not_of(' '));
+				if(ns>0 && grains>0)
+				{
+					saved[identity]=grains/(double)ns;
+				}
+			}
+
+			const size_t totDev = fields->devices.size();
+			const size_t totWrk = fields->totalWork.size();
+			std::vector<double> throughput(totDev,0.0);
+			double sumMatched = 0.0;
+			size_t numMatched = 0;
+			for(size_t i=0;i<totDev;i++)
+			{
+				auto it = saved.find(deviceIdentity(i));
+				if(it!=saved.end() && !fields->removed[i])
+				{
+					throughput[i]=it->second;
+					sumMatched+=it->second;
+					numMatched++;
+				}
+			}
+			if(numMatched==0)
+				return false;
+
+			double total = 0.0;
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(throughput[i]<=0.0 && !fields->removed[i])
+				{
+					throughput[i]=sumMatched/numMatched;
+				}
+				total+=throughput[i];
+			}
+
+			// same measurement as if devices computed their learned shares of current work
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(fields->removed[i])
+				{
+					fields->performances[i]=0.0;
+					fields->grainDev[i]=0;
+					continue;
+				}
+				fields->performances[i]=throughput[i]/total;
+				fields->grainDev[i]=std::max((size_t)1,(size_t)(fields->performances[i]*totWrk));
+				fields->nsDev[i]=std::max((size_t)1,(size_t)(fields->grainDev[i]/throughput[i]));
+				fields->measuredGrains[i]=fields->grainDev[i];
+				fields->measured[i]=true;
+			}
+			fields->policy->seed(fields->performances, fields->grainDev, fields->nsDev);
+			return true;
+		}
+
+		// returns percentage of total system performance
+		std::vector<double> getRelativePerformancesOfDevices()
+		{
+			std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+			std::vector<double> result;
+			size_t sz=fields->performances.size();
+			for(size_t i=0;i<sz;i++)
+			{
+				result.push_back(fields->performances[i]*100.0);
+			}
+			return result;
+		}
+	private:
+
+		/* dispatches loads of a Mode::Static run, result: future of its RunResult, returns ticket of run
+		 * background: run is collected by collector thread (otherwise caller collects it), mutRun must be locked
+		 */
+		size_t dispatchRun(bool pipelined, bool background, std::future<RunResult> & result)
+		{
+			const size_t totDev = fields->devices.size();
+			const size_t traceBegin = prepareRun(Mode::Static);
+
+			PendingRun<State> record;
+			record.ticket = fields->nextTicket++;
+			record.begin = nowNanoseconds();
+			record.traceRun = traceBegin>0 ? runCount : (size_t)-1;
+			record.pipelined = pipelined;
+			record.startDev = fields->startDev;
+			record.grainDev = fields->grainDev;
+			record.completion = std::make_shared<RunCompletion>(totDev);
+			record.result = std::make_shared<std::promise<RunResult>>();
+			result = record.result->get_future();
+
+			// ranges of previous run that is still in flight
+			std::shared_ptr<RunCompletion> dependency;
+			if(!fields->pendingRuns.empty())
+			{
+				const PendingRun<State> & previous = fields->pendingRuns.back();
+				dependency = previous.completion;
+				for(size_t i=0;i<totDev;i++)
+				{
+					for(size_t k=0;k<previous.grainDev.size();k++)
+					{
+						const bool overlap = previous.startDev[k] < record.startDev[i]+record.grainDev[i] &&
+											 record.startDev[i] < previous.startDev[k]+previous.grainDev[k];
+						if(k!=i && record.grainDev[i]>0 && previous.grainDev[k]>0 && overlap)
+						{
+							record.completion->waitList[i].push_back(k);
+						}
+					}
+				}
+			}
+
+			for(size_t i=0; i<totDev; i++)
+			{
+				if(record.grainDev[i]>0)
+				{
+					pushLoad(fields, i, Load<GrainOfWork<State,GrainState>>({1,record.startDev[i],record.grainDev[i],pipelined,nullptr,false,record.completion,dependency,record.ticket,nullptr,nullptr,nullptr}));
+				}
+			}
+			record.ranges = dispatchRanges(record.ticket, fields->pendingRuns.empty() ? nullptr : fields->pendingRuns.back().ranges);
+
+			const size_t ticket = record.ticket;
+			fields->pendingRuns.push_back(record);
+			if(background)
+			{
+				RunToCollect run;
+				run.ticket = ticket;
+				run.completion = record.completion;
+				for(size_t i=0; i<totDev; i++)
+				{
+					if(record.grainDev[i]>0)
+					{
+						run.devices.push_back(i);
+						run.watchdogNs.push_back(fields->options[i].watchdogNs);
+					}
+				}
+				std::unique_lock<std::mutex> lg(fields->mutCollect);
+				fields->toCollect.push_back(run);
+				fields->condCollect.notify_one();
+				if(!fields->collector.joinable())
+				{
+					std::shared_ptr<FieldBlock<State, GrainState>> fieldsPtr = fields;
+					fields->collector = std::thread([fieldsPtr](){ collectorLoop(fieldsPtr); });
+				}
+			}
+			return ticket;
+		}
+
+		// collects runs of runAsync in order of dispatch until destructor, waits for devices without mutRun so that runs can be started meanwhile
+		static void collectorLoop(std::shared_ptr<FieldBlock<State, GrainState>> fields)
+		{
+			while(true)
+			{
+				RunToCollect run;
+				{
+					std::unique_lock<std::mutex> lg(fields->mutCollect);
+					while(fields->toCollect.empty() && !fields->stopCollector)
+					{
+						fields->condCollect.wait(lg);
+					}
+					if(fields->toCollect.empty())
+						return;
+					run = fields->toCollect.front();
+					fields->toCollect.pop_front();
+				}
+
+				// a hung device is handled by watchdog of collectRuns
+				for(size_t k=0; k<run.devices.size(); k++)
+				{
+					run.completion->waitDone(run.devices[k], run.watchdogNs[k]);
+				}
+				std::unique_lock<std::mutex> lgRun(*(fields->mutRun));
+				collectRuns(fields, run.ticket);
+			}
+		}
+
+		// computes work distribution for next run from latest measurement, returns trace begin time (0 when not tracing)
+		size_t prepareRun(Mode mode)
+		{
+			startDevices();
+			const size_t totWrk = fields->totalWork.size();
+			const size_t totDev = fields->devices.size();
+
+			// performance model decides share of each device from last measurement
+			if(fields->newMeasurement)
+			{
+				fields->policy->update(fields->measuredGrains, fields->nsDev, totWrk, fields->performances);
+				fields->newMeasurement=false;
+			}
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(fields->removed[i])
+				{
+					fields->performances[i]=0.0;
+				}
+			}
+			normalizePerformances();
+			fields->policy->split(fields->performances, totWrk, fields->grainDev);
+
+			// same shares of total predicted cost instead of grain count (new grains are timed after runs in flight are collected)
+			// affinity mode keeps non-contiguous lists, partitionAffinity balances their costs instead
+			if(fields->costs.active())
+			{
+				if(fields->costs.size()!=totWrk && fields->pendingRuns.empty())
+				{
+					fields->costs.resize(totWrk);
+				}
+				if(mode != Mode::Affinity)
+				{
+					fields->costs.partition(fields->grainDev, totWrk);
+				}
+			}
+			excludeQuarantined();
+
+			runCount++;
+
+			size_t ct=0;
+			for(size_t i=0;i<totDev;i++)
+			{
+
+				fields->startDev[i]=ct;
+				ct+=fields->grainDev[i];
+
+			}
+
+			if(mode == Mode::Affinity)
+			{
+				partitionAffinity();
+
+				// counts of lists (differ from shares of grains with cost model)
+				ct=0;
+				for(size_t i=0;i<totDev;i++)
+				{
+					fields->grainDev[i]=fields->assigned[i].size();
+					fields->startDev[i]=ct;
+					ct+=fields->grainDev[i];
+				}
+			}
+
+			const bool trace = fields->tracing.load();
+			const size_t traceBegin = trace ? nowNanoseconds() : 0;
+			if(trace)
+			{
+				fields->traceRun.store(runCount);
+				for(size_t i=0;i<totDev;i++)
+				{
+					fields->hostTrace->add(numStages+1, i, fields->grainDev[i], traceBegin, traceBegin, runCount);
+				}
+			}
+			return traceBegin;
+		}
+
+		// collects responses of pending runs in dispatch order up to (including) ticket and completes their futures, mutRun must be locked
+		static void collectRuns(std::shared_ptr<FieldBlock<State, GrainState>> fields, size_t ticket)
+		{
+			while(!fields->pendingRuns.empty() && fields->pendingRuns.front().ticket<=ticket)
+			{
+				PendingRun<State> record = fields->pendingRuns.front();
+				fields->pendingRuns.pop_front();
+
+				RunResult current;
+				current.grainDev = record.grainDev;
+				current.nsDev = std::vector<size_t>(record.grainDev.size(),0);
+				current.itemDev = std::vector<size_t>(record.grainDev.size(),0);
+				size_t latest = record.begin;
+				std::vector<std::pair<size_t,size_t>> lost;
+				std::vector<size_t> failures; // indices of errors of the loads in lost
+				for(size_t i=0;i<record.grainDev.size();i++)
+				{
+					if(record.grainDev[i]>0)
+					{
+						Response response;
+						const bool responded = takeResponse(fields, i, record.ticket, response);
+						if(!responded || response.msg==0)
+						{
+							if(deviceFailed(fields, i, !responded, response, current.errors))
+							{
+								failures.push_back(current.errors.size()-1);
+								lost.push_back(std::make_pair(record.startDev[i],record.grainDev[i]));
+							}
+
+							// devices of next run that wait for this range are not blocked by a hung device (see runAsync: grains of its late load
+							// can be computed by two runs at the same time), a device that failed with an exception marked it done already
+							record.completion->markDone(i);
+							continue;
+						}
+						fields->quarantined[i]=false;
+						current.nsDev[i]=response.ns;
+						fields->nsDev[i]=response.ns;
+						fields->measured[i]=true;
+						fields->measuredGrains[i]=CostModel::toGrains(fields->costs.units(record.startDev[i],record.grainDev[i]));
+						latest=std::max(latest,response.finish);
+					}
+				}
+				bool rangesComplete = true;
+				if(record.ranges)
+				{
+					latest=std::max(latest,collectRanges(fields, record.ranges, record.ticket, current.errors, current.itemDev, rangesComplete));
+				}
+				latest=std::max(latest,recover(fields, lost, failures, record.ticket, record.pipelined, current.errors));
+				fields->costs.learn(record.grainDev.size());
+				for(size_t i=0;i<record.grainDev.size() && fields->costs.active();i++)
+				{
+					if(current.nsDev[i]>0)
+					{
+						fields->measuredGrains[i]=CostModel::toGrains(fields->costs.units(record.startDev[i],record.grainDev[i]));
+					}
+				}
+				fields->newMeasurement=true;
+				reseedIfRebased(fields);
+				current.elapsed = latest-record.begin;
+				fields->lastErrors = current.errors;
+
+				if(record.traceRun!=(size_t)-1 && fields->hostTrace)
+				{
+					fields->hostTrace->add(numStages, 0, 0, record.begin, latest, record.traceRun);
+				}
+
+				record.result->set_value(current);
+			}
+		}
+
+		// grains in order of importance given by setImportanceOrder, followed by the rest in order of index
+		std::vector<size_t> importanceOrder()
+		{
+			const size_t totWrk = fields->totalWork.size();
+			std::vector<size_t> order;
+			std::vector<bool> listed(totWrk,false);
+			order.reserve(totWrk);
+			for(const size_t j:fields->importance)
+			{
+				if(j<totWrk && !listed[j])
+				{
+					listed[j]=true;
+					order.push_back(j);
+				}
+			}
+			for(size_t j=0;j<totWrk;j++)
+			{
+				if(!listed[j])
+				{
+					order.push_back(j);
+				}
+			}
+			return order;
+		}
+
+		// quarantined devices get no share of work except a single probe grain after responses of their timed out loads arrive
+		// rest of their share (and any rounding remainder given to a removed device) goes to the healthy device with largest share
+		void excludeQuarantined()
+		{
+			const size_t totDev = fields->devices.size();
+			size_t receiver = totDev;
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(!fields->quarantined[i] && !fields->removed[i] && (receiver==totDev || fields->grainDev[i]>fields->grainDev[receiver]))
+				{
+					receiver=i;
+				}
+			}
+
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(fields->removed[i])
+				{
+					if(receiver<totDev)
+					{
+						fields->grainDev[receiver]+=fields->grainDev[i];
+					}
+					else if(fields->grainDev[i]>0)
+					{
+						std::cout<<"Error: no device to compute grains"<<std::endl;
+					}
+					fields->grainDev[i]=0;
+					continue;
+				}
+				if(!fields->quarantined[i])
+					continue;
+
+				// late responses of abandoned loads arrive before responses of newer loads
+				Response response;
+				while(fields->abandoned[i]>0 && nextRunResponse(fields, i, false, response))
+				{
+					fields->abandoned[i]--;
+				}
+
+				if(receiver<totDev)
+				{
+					const size_t probe = (fields->abandoned[i]==0 && fields->grainDev[i]+fields->grainDev[receiver]>1) ? 1 : 0;
+					fields->grainDev[receiver]+=fields->grainDev[i]-probe;
+					fields->grainDev[i]=probe;
+				}
+			}
+		}
+
+		// cost units changed a lot (see CostModel::takeRebased): history of balancing policy is replaced by latest measurement
+		static void reseedIfRebased(std::shared_ptr<FieldBlock<State, GrainState>> fields)
+		{
+			if(!fields->costs.takeRebased())
+				return;
+			const size_t totDev = fields->devices.size();
+			double total = 0.0;
+			for(size_t i=0;i<totDev;i++)
+			{
+				total += fields->removed[i] ? 0.0 : fields->measuredGrains[i]/(double)fields->nsDev[i];
+			}
+			for(size_t i=0;i<totDev && total>0.0;i++)
+			{
+				fields->performances[i] = fields->removed[i] ? 0.0 : fields->measuredGrains[i]/(double)fields->nsDev[i]/total;
+			}
+			fields->policy->seed(fields->performances, fields->measuredGrains, fields->nsDev);
+			fields->newMeasurement=false;
+		}
+
+		/* queues a range load (cmd 10) to each device that is not removed, returns nullptr if there is no range
+		 * a quarantined device computes a single chunk as a probe after responses of its timed out loads arrive
+		 * previous: ranges of previous run still in flight (runAsync), devices start after all of its loads end
+		 * chunks shrink near end of range in proportion to learned range throughput of devices (equal before first measurement)
+		 */
+		std::shared_ptr<RangeRun<State>> dispatchRanges(size_t ticket, std::shared_ptr<RangeRun<State>> previous)
+		{
+			if(fields->ranges.empty())
+				return nullptr;
+
+			const size_t totDev = fields->devices.size();
+			std::vector<bool> use(totDev,false);
+			std::vector<double> throughput(totDev,0.0);
+			double sumMeasured = 0.0;
+			size_t numMeasured = 0;
+			size_t numUsed = 0;
+			for(size_t i=0;i<totDev;i++)
+			{
+				use[i] = !fields->removed[i] && !(fields->quarantined[i] && fields->abandoned[i]>0);
+				if(use[i] && fields->rangeNs[i]>0)
+				{
+					throughput[i] = fields->rangeItems[i]/(double)fields->rangeNs[i];
+					sumMeasured += throughput[i];
+					numMeasured++;
+				}
+				numUsed += use[i] ? 1 : 0;
+			}
+			if(numUsed==0)
+			{
+				std::cout<<"Error: no device to compute ranges"<<std::endl;
+				return nullptr;
+			}
+
+			double total = 0.0;
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(use[i] && throughput[i]<=0.0)
+				{
+					throughput[i] = (numMeasured>0) ? sumMeasured/numMeasured : 1.0;
+				}
+				total += throughput[i];
+			}
+			for(size_t i=0;i<totDev;i++)
+			{
+				throughput[i] /= total;
+			}
+
+			std::shared_ptr<RangeRun<State>> ranges = std::make_shared<RangeRun<State>>(fields->ranges, throughput, previous);
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(use[i])
+				{
+					ranges->probe[i] = fields->quarantined[i];
+					ranges->startLoad(i);
+					pushLoad(fields, i, Load<GrainOfWork<State,GrainState>>({10,0,0,false,nullptr,false,nullptr,nullptr,ticket,nullptr,nullptr,ranges}));
+				}
+			}
+			return ranges;
+		}
+
+		/* takes responses of range loads of a run (they come after grain responses of same device), updates range throughput of devices
+		 * remaining items of failed devices are computed by healthy devices until all are computed or no healthy device is left
+		 * itemDev: items computed by each device, complete: all items are computed
+		 * failures of range loads are marked as recovered when all items are computed
+		 * returns completion time point of last range load, mutRun must be locked
+		 */
+		static size_t collectRanges(std::shared_ptr<FieldBlock<State, GrainState>> fields, std::shared_ptr<RangeRun<State>> ranges, size_t ticket,
+									std::vector<RunError> & errors, std::vector<size_t> & itemDev, bool & complete)
+		{
+			const size_t totDev = fields->devices.size();
+			size_t latest = 0;
+			std::vector<bool> loaded = ranges->loaded;
+			std::vector<size_t> failures; // indices of errors of failed range loads
+			while(true)
+			{
+				for(size_t i=0;i<totDev;i++)
+				{
+					if(!loaded[i])
+						continue;
+
+					// timeout of an earlier load is already recorded, range load behind it is abandoned too
+					const bool hung = fields->abandoned[i]>0;
+					Response response;
+					const bool responded = takeResponse(fields, i, ticket, response);
+					if(!responded)
+					{
+						ranges->drop(i, fields->options[i].redispatchOnTimeout);
+					}
+					if(!responded && hung)
+					{
+						fields->abandoned[i]++;
+						continue;
+					}
+					if(!responded || response.msg==0)
+					{
+						if(deviceFailed(fields, i, !responded, response, errors))
+						{
+							failures.push_back(errors.size()-1);
+						}
+						continue;
+					}
+					fields->quarantined[i]=false;
+					itemDev[i]+=response.grains;
+					latest=std::max(latest,response.finish);
+
+					// a device that took no chunk has no new information about its range throughput
+					if(response.grains>0)
+					{
+						fields->rangeItems[i]=response.grains;
+						fields->rangeNs[i]=std::max((size_t)1,response.ns);
+					}
+				}
+
+				complete = ranges->complete();
+				std::fill(loaded.begin(),loaded.end(),false);
+				bool any = false;
+				for(size_t i=0;i<totDev && !complete;i++)
+				{
+					if(!fields->quarantined[i] && !fields->removed[i])
+					{
+						ranges->probe[i]=0;
+						ranges->startLoad(i);
+						pushLoad(fields, i, Load<GrainOfWork<State,GrainState>>({10,0,0,false,nullptr,false,nullptr,nullptr,ticket,nullptr,nullptr,ranges}));
+						loaded[i]=true;
+						any=true;
+					}
+				}
+				if(!any)
+				{
+					for(const size_t k:failures)
+					{
+						errors[k].recovered=complete;
+					}
+					return latest;
+				}
+			}
+		}
+
+		/* takes response of device i to its load of run ticket, responses of other runs are kept for their own collectors
+		 * returns false if device does not respond within DeviceOptions::watchdogNs or is still computing a timed out load
+		 * mutRun must be locked
+		 */
+		static bool takeResponse(std::shared_ptr<FieldBlock<State, GrainState>> fields, size_t i, size_t ticket, Response & response)
+		{
+			std::deque<Response> & stash = fields->stash[i];
+			for(auto it=stash.begin(); it!=stash.end(); it++)
+			{
+				if(it->ticket==ticket)
+				{
+					response=*it;
+					stash.erase(it);
+					return true;
+				}
+			}
+
+			const size_t watchdog = fields->options[i].watchdogNs;
+			const size_t deadline = nowNanoseconds()+watchdog;
+			size_t polls = 0;
+			while(true)
+			{
+				if(watchdog==0 && fields->abandoned[i]==0)
+				{
+					nextRunResponse(fields, i, true, response);
+				}
+				else if(!nextRunResponse(fields, i, false, response))
+				{
+					if(fields->abandoned[i]>0)
+						return false;
+					if(nowNanoseconds()>deadline)
+						return false;
+
+					// device threads do not notify host, short sleeps keep polling cheap
+					if(polls++<64)
+						std::this_thread::yield();
+					else
+						std::this_thread::sleep_for(std::chrono::microseconds(20));
+					continue;
+				}
+
+				if(fields->abandoned[i]>0)
+				{
+					fields->abandoned[i]--;
+				}
+				else if(response.ticket==ticket)
+				{
+					return true;
+				}
+				else
+				{
+					stash.push_back(response);
+				}
+			}
+		}
+
+		/* takes next response of a run from device i in queue order, responses of single grains are filed for syncSingle
+		 * wait: blocks until a response of a run arrives, otherwise returns false when none is available now
+		 * mutRun must be locked
+		 */
+		static bool nextRunResponse(std::shared_ptr<FieldBlock<State, GrainState>> fields, size_t i, bool wait, Response & response)
+		{
+			ResponseStream & stream = *fields->responseStreams[i];
+			std::unique_lock<std::mutex> lg(stream.mut);
+			while(stream.runs.empty())
+			{
+				if(stream.reading)
+				{
+					// syncSingle of another thread is popping, it files responses of runs in stream.runs
+					if(!wait)
+						return false;
+					stream.filed.wait(lg);
+					continue;
+				}
+
+				if(wait)
+				{
+					stream.reading=true;
+					lg.unlock();
+					response = fields->responseQueue[i]->pop();
+					lg.lock();
+					stream.reading=false;
+				}
+				else if(!fields->responseQueue[i]->tryPop(response))
+				{
+					return false;
+				}
+
+				if(response.ticket!=Response::singleTicket)
+				{
+					stream.filed.notify_all();
+					return true;
+				}
+				stream.singles.push_back(response);
+				stream.filed.notify_all();
+			}
+			response = stream.runs.front();
+			stream.runs.pop_front();
+			return true;
+		}
+
+		// waits for next response of single grains from device id, responses of runs are filed for run collectors
+		Response takeSingleResponse(size_t id)
+		{
+			ResponseStream & stream = *fields->responseStreams[id];
+			std::unique_lock<std::mutex> lg(stream.mut);
+			while(stream.singles.empty())
+			{
+				if(stream.reading)
+				{
+					stream.filed.wait(lg);
+					continue;
+				}
+				stream.reading=true;
+				lg.unlock();
+				Response response = fields->responseQueue[id]->pop();
+				lg.lock();
+				stream.reading=false;
+				stream.filed.notify_all();
+				if(response.ticket==Response::singleTicket)
+					return response;
+				stream.runs.push_back(response);
+			}
+			Response response = stream.singles.front();
+			stream.singles.pop_front();
+			return response;
+		}
+
+		/* records failure of device i (exception in response or timeout) and quarantines it
+		 * a timed out load is abandoned, its response is dropped when it arrives
+		 * returns true if grains of the failed load can be computed by other devices: always after an exception, after a timeout
+		 * only with DeviceOptions::redispatchOnTimeout (hung device may still be writing them, its error stays unrecovered)
+		 */
+		static bool deviceFailed(std::shared_ptr<FieldBlock<State, GrainState>> fields, size_t i, bool timeout, const Response & response, std::vector<RunError> & errors)
+		{
+			RunError error = {i,(size_t)-1,-1,timeout,false,nullptr};
+			if(timeout)
+			{
+				fields->abandoned[i]++;
+				std::cout<<"Error: timeout in device-"<<i<<std::endl;
+			}
+			else
+			{
+				error.grain=response.failedGrain;
+				error.stage=response.failedStage;
+				error.exception=response.error;
+				std::cout<<"Error: compute failed in device-"<<i<<std::endl;
+			}
+			fields->quarantined[i]=true;
+			errors.push_back(error);
+			return !timeout || fields->options[i].redispatchOnTimeout;
+		}
+
+		/* computes lost grain ranges (first, count) of a run on devices that are not quarantined, in proportion to their performances
+		 * grains of devices that fail during recovery are re-dispatched again until all are computed or no healthy device is left
+		 * (grains of a recovery load that times out are not, see deviceFailed)
+		 * failures: indices (in errors) of the failed loads whose grains are lost, they and the failures of recovery loads are marked
+		 * as recovered when all grains are computed (other errors are not changed)
+		 * returns completion time point of last recovery load (0 if nothing is re-dispatched), mutRun must be locked
+		 */
+		static size_t recover(std::shared_ptr<FieldBlock<State, GrainState>> fields, std::vector<std::pair<size_t,size_t>> lost,
+							  std::vector<size_t> failures, size_t ticket, bool pipelined, std::vector<RunError> & errors)
+		{
+			const size_t totDev = fields->devices.size();
+			size_t latest = 0;
+			bool kept = false; // grains of a timed out recovery load are left to its device
+			while(!lost.empty())
+			{
+				double total = 0.0;
+				size_t last = totDev;
+				for(size_t i=0;i<totDev;i++)
+				{
+					if(!fields->quarantined[i] && !fields->removed[i])
+					{
+						total+=std::max(fields->performances[i],0.001);
+						last=i;
+					}
+				}
+				if(last==totDev)
+					break;
+
+				// (device, first, count) of each load
+				std::vector<std::pair<size_t,std::pair<size_t,size_t>>> pieces;
+				for(const std::pair<size_t,size_t> & range:lost)
+				{
+					double sum = 0.0;
+					size_t begin = 0;
+					for(size_t i=0;i<=last;i++)
+					{
+						if(fields->quarantined[i] || fields->removed[i])
+							continue;
+						sum+=std::max(fields->performances[i],0.001);
+						const size_t end = (i==last) ? range.second : std::min(range.second,(size_t)(range.second*sum/total));
+						if(end>begin)
+						{
+							pieces.push_back(std::make_pair(i,std::make_pair(range.first+begin,end-begin)));
+							pushLoad(fields, i, Load<GrainOfWork<State,GrainState>>({1,range.first+begin,end-begin,pipelined,nullptr,false,nullptr,nullptr,ticket,nullptr,nullptr,nullptr}));
+							begin=end;
+						}
+					}
+				}
+
+				lost.clear();
+				for(const auto & piece:pieces)
+				{
+					Response response;
+					const bool responded = takeResponse(fields, piece.first, ticket, response);
+					if(!responded || response.msg==0)
+					{
+						if(deviceFailed(fields, piece.first, !responded, response, errors))
+						{
+							failures.push_back(errors.size()-1);
+							lost.push_back(piece.second);
+						}
+						else
+						{
+							kept=true;
+						}
+					}
+					else
+					{
+						latest=std::max(latest,response.finish);
+					}
+				}
+			}
+
+			for(const size_t k:failures)
+			{
+				errors[k].recovered=lost.empty() && !kept;
+			}
+			return latest;
+		}
+
+		// blocks new single grains (runSingleAsync) and waits until device threads complete the ones in flight, mutRun must be locked
+		// mutGlobal must not be locked: a device thread that is not started yet needs it to leave its start barrier
+		void pauseSingleGrains()
+		{
+			{
+				std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+				fields->singlePaused=true;
+			}
+			while(fields->singleInFlight.load()>0)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(20));
+			}
+		}
+
+		// lets runSingleAsync continue after pauseSingleGrains, mutGlobal must be locked
+		void resumeSingleGrains()
+		{
+			fields->singlePaused=false;
+			fields->condSingle.notify_all();
+		}
+
+		// shares of devices (sum=1), removed devices have 0
+		void normalizePerformances()
+		{
+			double total = 0.0;
+			for(size_t i=0;i<fields->performances.size();i++)
+			{
+				total+=fields->performances[i];
+			}
+			for(size_t i=0;i<fields->performances.size() && total>0.0;i++)
+			{
+				fields->performances[i]/=total;
+			}
+		}
+
+		// new device gets average share and throughput of other devices, learned ratios of others are kept
+		void rescaleForNewDevice(size_t indexThr)
+		{
+			double share = 0.0;
+			double throughput = 0.0;
+			double grains = 0.0;
+			size_t active = 0;
+			bool measured = true;
+			for(size_t i=0;i<indexThr;i++)
+			{
+				if(!fields->removed[i])
+				{
+					share+=fields->performances[i];
+					throughput+=fields->measuredGrains[i]/(double)fields->nsDev[i];
+					grains+=fields->measuredGrains[i];
+					measured = measured && fields->measured[i];
+					active++;
+				}
+			}
+			if(active==0)
+				return;
+
+			// estimate is a measurement only if all devices it is averaged from are measured
+			fields->performances[indexThr]=share/active;
+			fields->measuredGrains[indexThr]=std::max((size_t)1,(size_t)(grains/active));
+			fields->nsDev[indexThr]=std::max((size_t)1,(size_t)(fields->measuredGrains[indexThr]/(throughput/active)));
+			fields->measured[indexThr]=measured;
+			normalizePerformances();
+			fields->policy->rescale(fields->performances);
+		}
+
+		std::string deviceIdentity(size_t indexThr)
+		{
+			std::string identity = fields->devices[indexThr].getIdentity();
+			return identity.empty() ? "device-"+std::to_string(indexThr) : identity;
+		}
+
+		// creates dedicated thread of device
+		void startDevice(size_t indexThr)
+		{
+			fields->thr[indexThr]=std::thread([&,indexThr](){ deviceLoop(indexThr); });
+		}
+
+		// creates threads of devices that were added with lazyStart option and wakes all device threads up
+		void startDevices()
+		{
+			std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+			if(fields->initialized)
+				return;
+			for(size_t i=0;i<fields->thr.size();i++)
+			{
+				if(!fields->thr[i].joinable() && !fields->removed[i] && !fields->executors[i])
+				{
+					startDevice(i);
+				}
+			}
+			fields->initialized=true;
+			fields->condGlobal->notify_all();
+		}
+
+		// queues a load of device i, executor of a device without dedicated thread is told to compute it
+		static void pushLoad(const std::shared_ptr<FieldBlock<State, GrainState>> & fields, size_t i, Load<GrainOfWork<State,GrainState>> load)
+		{
+			fields->loadQueue[i]->push(load);
+			if(fields->executors[i])
+			{
+				fields->executors[i]->notify(fields->tenants[i]);
+			}
+		}
+
+		// locals of a device, kept by its dedicated thread or between steps of its executor
+		// per-device vectors can grow while device is idle (addDevice), so queues are kept in local pointers
+		class DeviceContext
+		{
+		public:
+			DeviceContext():started(false),parked(false),selfSyncHead(0),taken(0),tenant(0){ }
+			bool started; // fields below are read from device options
+			bool parked; // (executor only) load is taken from queue but waits for devices of previous run
+			Load<GrainOfWork<State,GrainState>> load;
+			// self-sync commands of single grains, each with number of loads that must be taken from queue before it
+			// (kept out of the queue: device would block on its own queue while host waits for a free slot in it)
+			// taken from selfSyncHead, cleared when all are taken so that its capacity is reused without allocation
+			std::vector<std::pair<size_t,Load<GrainOfWork<State,GrainState>>>> selfSyncs;
+			size_t selfSyncHead; // oldest self-sync not taken yet
+			size_t taken; // loads taken from queue
+			PipelineOptions pipeline;
+			std::shared_ptr<ThreadsafeQueue<Load<GrainOfWork<State,GrainState>>,    100,true,false>> loadQueue;
+			std::shared_ptr<ThreadsafeQueue<Response,4096,false,true>> responseQueue;
+			std::shared_ptr<DeviceStats> stats;
+			std::function<size_t()> clock;
+			std::function<void()> loadBegin;
+			std::function<void()> loadEnd;
+			std::shared_ptr<DeviceExecutor> executor;
+			size_t tenant;
+			std::vector<ChunkTuner> tuners; // chunk size of each range, learned over runs
+			State state;
+		};
+
+		// reads options of device into context, mutGlobal must be locked
+		void startContext(size_t indexThr, DeviceContext & context)
+		{
+			const DeviceOptions & options = fields->options[indexThr];
+			context.pipeline = options.pipeline;
+			context.clock = options.clock;
+			context.loadBegin = options.loadBegin;
+			context.loadEnd = options.loadEnd;
+			context.executor = fields->executors[indexThr];
+			context.tenant = fields->tenants[indexThr];
+			context.loadQueue = fields->loadQueue[indexThr];
+			context.responseQueue = fields->responseQueue[indexThr];
+			context.stats = fields->stats[indexThr];
+			if(options.workers>1)
+			{
+				fields->pools[indexThr]=std::make_shared<WorkerPool>(options.workers, options.workerCores);
+			}
+			std::unique_lock<std::mutex> lgDev(*(fields->mut[indexThr]));
+			context.state = fields->devices[indexThr].getState();
+			context.started = true;
+		}
+
+		// dedicated thread of a device, runs loads from its queue until stop command
+		void deviceLoop(size_t indexThr)
+		{
+
+			// sleeps until first run() / runSingleAsync() (or destructor) so that devices can be added without any cpu usage
+			int core = -1;
+			DeviceContext context;
+			{
+				std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+				while(!fields->initialized && !fields->removed[indexThr])
+				{
+					fields->condGlobal->wait(lg);
+				}
+				if(fields->removed[indexThr])
+					return;
+				core = fields->options[indexThr].cpuCore;
+				startContext(indexThr, context);
+			}
+			pinThisThread(core);
+			bool isRunning = true;
+			while(isRunning)
+			{
+				const size_t tIdle = StatsRecorder<EnableStats>::now();
+				const size_t queueSize = EnableStats ? context.loadQueue->size() : 0;
+				Load<GrainOfWork<State,GrainState>> load = nextLoad(context);
+				StatsRecorder<EnableStats>::idle(*context.stats, tIdle, queueSize);
+				isRunning = computeLoad(indexThr, context, load);
+			}
+
+		}
+
+		// next load of a device: its oldest self-sync once the loads queued before it are taken, otherwise next load of its queue
+		Load<GrainOfWork<State,GrainState>> nextLoad(DeviceContext & context)
+		{
+			if(context.selfSyncHead<context.selfSyncs.size() && context.selfSyncs[context.selfSyncHead].first<=context.taken)
+			{
+				Load<GrainOfWork<State,GrainState>> load = std::move(context.selfSyncs[context.selfSyncHead].second);
+				if(++context.selfSyncHead==context.selfSyncs.size())
+				{
+					context.selfSyncs.clear();
+					context.selfSyncHead = 0;
+				}
+				return load;
+			}
+			Load<GrainOfWork<State,GrainState>> load = context.loadQueue->pop();
+			context.taken++;
+			fields->slotFreed->notify();
+			return load;
+		}
+
+		// step of a device on a shared executor: computes next load of its queue
+		// returns false without computing it if the load waits for devices of previous run (executor computes loads of other tenants meanwhile)
+		bool stepDevice(size_t indexThr, DeviceContext & context)
+		{
+			if(!context.started)
+			{
+				std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+				startContext(indexThr, context);
+			}
+			if(!context.parked)
+			{
+				context.load = nextLoad(context);
+				context.parked = true;
+			}
+			if(context.load.dependency)
+			{
+				for(const size_t k:context.load.completion->waitList[indexThr])
+				{
+					if(!context.load.dependency->isDone(k))
+						return false;
+				}
+			}
+			if(context.load.ranges && context.load.ranges->previous && !context.load.ranges->previous->finished())
+			{
+				return false;
+			}
+			context.parked = false;
+			Load<GrainOfWork<State,GrainState>> load = std::move(context.load);
+			computeLoad(indexThr, context, load);
+			return true;
+		}
+
+		// runs a load in device thread (or executor thread), returns false after a stop command
+		bool computeLoad(size_t indexThr, DeviceContext & context, Load<GrainOfWork<State,GrainState>> & load)
+		{
+			const State & state = context.state;
+			const size_t start = load.start;
+			const size_t grain = load.grain;
+			const bool pipelined = load.pipelined;
+			const PipelineOptions & pipeline = context.pipeline;
+
+			if(load.cmd==0)
+			{
+				fields->pools[indexThr].reset();
+				return false;
+			}
+
+			// single work sync request
+			if(load.cmd==3)
+			{
+
+				GrainOfWork<State,GrainState> & grainInfo = *load.grainInfo;
+				std::exception_ptr error = load.error;
+				if(!error)
+				{
+					try
+					{
+						callStage(Stage::Sync, state, indexThr, grainInfo, grainInfo.refGrainState(), (size_t)-1); // user must synchronize in this unless it is synchronized in other methods
+					}
+					catch(const StageFailure & failure)
+					{
+						error = failure.error;
+					}
+				}
+				grainInfo.t2=std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::high_resolution_clock::now().time_since_epoch());
+				const size_t latency = grainInfo.t2.count()-grainInfo.t1.count();
+				if(load.ownsGrain)
+				{
+					delete load.grainInfo;
+				}
+				context.responseQueue->push(Response({error?0:1,latency,0,0,Response::singleTicket,(size_t)-1,-1,error}));
+				fields->singleInFlight.fetch_sub(1);
+				return true;
+			}
+
+			// single work request
+			if(load.cmd==2)
+			{
+				GrainOfWork<State,GrainState> & grainInfo = *load.grainInfo;
+				grainInfo.t1=std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::high_resolution_clock::now().time_since_epoch());
+				std::exception_ptr error;
+				try
+				{
+					if(!grainInfo.isReady(indexThr))
+					{
+						callStage(Stage::Init, state, indexThr, grainInfo, grainInfo.refGrainState(), (size_t)-1); // user should have asynchronous launch in this
+						grainInfo.makeReady(indexThr);
+					}
+					callStage(Stage::Input, state, indexThr, grainInfo, grainInfo.refGrainState(), (size_t)-1); // user should have asynchronous launch in this
+					callStage(Stage::Compute, state, indexThr, grainInfo, grainInfo.refGrainState(), (size_t)-1); // user should have asynchronous launch in this
+					callStage(Stage::Output, state, indexThr, grainInfo, grainInfo.refGrainState(), (size_t)-1); // user should have asynchronous launch in this
+				}
+				catch(const StageFailure & failure)
+				{
+					// reported by sync command so that responses stay in order of grains
+					error = failure.error;
+				}
+
+				// creates a self-sync command behind the loads queued so far (to let others run asynchronously)
+				context.selfSyncs.push_back(std::make_pair(context.taken+context.loadQueue->size(),
+						Load<GrainOfWork<State,GrainState>>({3,0,0,false,load.grainInfo,load.ownsGrain,nullptr,nullptr,Response::singleTicket,error,nullptr,nullptr})));
+				if(context.executor)
+				{
+					context.executor->notify(context.tenant);
+				}
+				return true;
+			}
+
+			// device is removed: grains initialized in device are released before thread stops
+			if(load.cmd==8)
+			{
+				try
+				{
+					releaseAllGrains(state, indexThr);
+				}
+				catch(...)
+				{
+					std::cout<<"Error: release failed in device-"<<indexThr<<std::endl;
+				}
+				fields->pools[indexThr].reset();
+				return false;
+			}
+
+			// compute grain
+			// grains of this range may still be in use by other devices in previous run
+			if(load.dependency)
+			{
+				for(const size_t k:load.completion->waitList[indexThr])
+				{
+					load.dependency->waitDone(k);
+				}
+			}
+
+			// items of previous run's ranges may still be in progress in other devices
+			if(load.ranges && load.ranges->previous)
+			{
+				load.ranges->previous->waitFinished();
+			}
+
+			// exception of a stage function fails the whole load, host re-dispatches its grains
+			size_t elapsedDevice = 0;
+			size_t computed = 0;
+			Response response({1,0,0,0,load.ticket,(size_t)-1,-1,nullptr});
+			const size_t clockBegin = context.clock ? context.clock() : 0;
+			if(context.loadBegin)
+			{
+				context.loadBegin();
+			}
+			try
+			{
+				Bench benchDevice(&elapsedDevice);
+				if(load.cmd==4)
+				{
+					computed = computeStealing(state, indexThr, pipelined, pipeline);
+				}
+				else if(load.cmd==5)
+				{
+					releaseGrains(state, indexThr);
+				}
+				else if(load.cmd==7)
+				{
+					computeRange(state, indexThr, start, 1, pipelined, pipeline);
+					computed = 1;
+				}
+				else if(load.cmd==6)
+				{
+					const std::vector<size_t> & list = fields->assigned[indexThr];
+					computeParallel(state, indexThr, list.size(), ListIndex(list.data()), pipelined, pipeline);
+					computed = list.size();
+				}
+				else if(load.cmd==9)
+				{
+					// host counts completed grains from deadline signal
+					const std::vector<size_t> & list = fields->deadlineList[indexThr];
+					computeParallel(state, indexThr, list.size(), ListIndex(list.data()), pipelined, pipeline, load.deadline.get());
+				}
+				else if(load.cmd==10)
+				{
+					computed = computeRanges(state, indexThr, context, *load.ranges);
+				}
+				else
+				{
+					computeRange(state, indexThr, start, grain, pipelined, pipeline);
+					computed = grain;
+				}
+			}
+			catch(const StageFailure & failure)
+			{
+				response.msg = 0;
+				response.failedGrain = failure.grain;
+				response.failedStage = failure.stage;
+				response.error = failure.error;
+			}
+			catch(...)
+			{
+				response.msg = 0;
+				response.error = std::current_exception();
+			}
+			if(context.loadEnd)
+			{
+				context.loadEnd();
+			}
+			if(context.clock)
+			{
+				elapsedDevice = context.clock()-clockBegin;
+			}
+			if(load.completion)
+			{
+				load.completion->markDone(indexThr);
+			}
+			if(load.ranges)
+			{
+				load.ranges->endLoad(indexThr);
+			}
+			response.ns = elapsedDevice;
+			response.grains = computed;
+			response.finish = nowNanoseconds();
+			context.responseQueue->push(response);
+			if(load.cmd==7)
+			{
+				fields->graphResponded->notify();
+			}
+			return true;
+		}
+
+		// sends a single grain to device with least number of queued loads
+		size_t runSingleAsync(GrainOfWork<State, GrainState> * grain, bool ownsGrain)
+		{
+			startDevices();
+
+			// devices are not added or removed until grain is given to a device
+			std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
+
+			size_t szMin = (size_t)-1;
+			int iMin = -1;
+
+			// waits (without spinning) until a device takes a load from its queue when all queues are full
+			// or until syncSingle when every device has FieldBlock::maxUnsynced grains that are not synced
+			// mutGlobal is released while waiting, a device thread that is not started yet needs it to leave its start barrier
+			bool space = false;
+			while(!space)
+			{
+				// device list is being changed by addDevice or removeDevice
+				while(fields->singlePaused)
+				{
+					fields->condSingle.wait(lg);
+				}
+				if(std::find(fields->removed.begin(),fields->removed.end(),false)==fields->removed.end())
+				{
+					std::cout<<"Error: no device to compute grain"<<std::endl;
+					if(ownsGrain)
+					{
+						delete grain;
+					}
+					return (size_t)-1;
+				}
+
+				const unsigned int ticket = fields->slotFreed->prepareWait();
+				const size_t totDev = fields->devices.size();
+				for(size_t i=0; i<totDev; i++)
+				{
+					const size_t sel=fields->loadQueue[i]->size();
+					if(szMin>sel && sel<25 && fields->unsynced[i]->load()<FieldBlock<State, GrainState>::maxUnsynced && !fields->removed[i])
+					{
+						szMin=sel;
+						iMin=i;
+						space=true;
+					}
+				}
+				if(space)
+				{
+					fields->slotFreed->cancelWait();
+				}
+				else
+				{
+					lg.unlock();
+					fields->slotFreed->commitWait(ticket);
+					lg.lock();
+				}
+			}
+
+
+			fields->singleInFlight.fetch_add(1);
+			fields->unsynced[iMin]->fetch_add(1);
+			pushLoad(fields, iMin, Load<GrainOfWork<State,GrainState>>({2,0,0,false,grain,ownsGrain,nullptr,nullptr,Response::singleTicket,nullptr,nullptr,nullptr}));
+
+			return iMin;
+		}
+
+		// runs all stages of grains in [start,start+grain) in device thread of indexThr
+		void computeRange(State state, size_t indexThr, size_t start, size_t grain, bool pipelined, const PipelineOptions & pipeline)
+		{
+			computeParallel(state, indexThr, grain, RangeIndex(start), pipelined, pipeline);
+		}
 
+		/* takes chunks of ranges until all items are taken, then chunks of failed devices, returns number of items computed
+		 * chunk size is the learned size of the range in device, capped by half of device's share of remaining items near end of range
+		 * (but not below a quarter of learned size)
+		 */
+		size_t computeRanges(const State & state, size_t indexThr, DeviceContext & context, RangeRun<State> & ranges)
+		{
+			const size_t numRanges = ranges.works.size();
+			WorkerPool * pool = fields->pools[indexThr].get();
+			if(context.tuners.size()<numRanges)
+			{
+				context.tuners.resize(numRanges, ChunkTuner(pool ? pool->size() : 1));
+			}
+
+			size_t computed = 0;
+			const double share = ranges.shares[indexThr];
+			for(size_t r=0; r<numRanges; r++)
+			{
+				const RangeWork<State> & work = *ranges.works[r];
+				ChunkTuner & tuner = context.tuners[r];
+				size_t first = 0;
+				size_t count = 0;
+				while(true)
+				{
+					const size_t tail = std::max(tuner.size()/4,(size_t)(ranges.remaining(r)*share/2));
+					const size_t t0 = nowNanoseconds();
+					if(!ranges.take(indexThr, r, std::min(tuner.size(),tail), first, count))
+						break;
+					computeChunk(state, indexThr, work, first, count, ranges);
+					tuner.measure(count, nowNanoseconds()-t0, work.overheadFraction);
+					computed += count;
+					if(ranges.probe[indexThr])
+						return computed;
+				}
+			}
+
+			RangeChunk chunk;
+			while(ranges.takeLost(indexThr, chunk))
+			{
+				computeChunk(state, indexThr, *ranges.works[chunk.range], chunk.first, chunk.count, ranges);
+				computed += chunk.count;
+				if(ranges.probe[indexThr])
+					break;
+			}
+			return computed;
+		}
+
+		// computes items [first,first+count) of a range, divided between worker threads of a composite device
+		void computeChunk(const State & state, size_t indexThr, const RangeWork<State> & work, size_t first, size_t count, RangeRun<State> & ranges)
+		{
+			const bool trace = fields->tracing.load(std::memory_order_relaxed);
+			const size_t t0 = (EnableStats || trace) ? nowNanoseconds() : 0;
+			WorkerPool * pool = fields->pools[indexThr].get();
+			try
+			{
+				if(pool==nullptr || count<2)
+				{
+					work.body(state, first, first+count);
+				}
+				else
+				{
+					pool->run(count, [&](size_t begin, size_t num){ work.body(state, first+begin, first+begin+num); });
+				}
+			}
+			catch(...)
+			{
+				ranges.fail(indexThr);
+				throw StageFailure({first, (int)Stage::Compute, std::current_exception()});
+			}
+			ranges.finish(indexThr);
+			if(EnableStats || trace)
+			{
+				const size_t t1 = nowNanoseconds();
+				StatsRecorder<EnableStats>::stage(*fields->stats[indexThr], Stage::Compute, t0, t1, count);
+				if(trace)
+				{
+					fields->traceBuffers[indexThr]->add((int)Stage::Compute, indexThr, first, t0, t1, fields->traceRun.load(std::memory_order_relaxed));
+				}
+			}
+		}
+
+		// runs grains on worker threads of a composite device, or on device thread otherwise
+		// init is called by device thread before workers start so that only device thread changes readiness of grains
+		// deadline: (optional) no grain is started after deadline, completed grains are marked in it
+		template<typename Index>
+		void computeParallel(const State & state, size_t indexThr, size_t n, const Index & index, bool pipelined, const PipelineOptions & pipeline,
+							 DeadlineSignal * deadline = nullptr)
+		{
+			WorkerPool * pool = fields->pools[indexThr].get();
+			if(pool==nullptr || n<2)
+			{
+				computeGrains(state, indexThr, n, index, pipelined, pipeline, deadline);
+				return;
+			}
+
+			initGrains(state, indexThr, n, index);
+			pool->run(n, [&](size_t first, size_t count){
+				computeGrains(state, indexThr, count, index.shifted(first), pipelined, pipeline, deadline);
+			});
+		}
+
+		// calls init of grains that are not initialized in device yet
+		template<typename Index>
+		void initGrains(const State & state, size_t indexThr, size_t n, const Index & index)
+		{
+			// after warm-up grains are initialized in device and per-grain scan is skipped
+			const bool ready = fields->totalWork.allReady(indexThr) ||
+							   (Index::contiguous && fields->totalWork.rangeReady(indexThr, index(0), index(0)+n));
+			for(size_t k=0; k<n && !ready; k++)
+			{
+				if(!fields->totalWork.isReady(indexThr, index(k)))
+				{
+					callStage(Stage::Init, state, indexThr, index(k)); // user should have asynchronous launch in this
+					fields->totalWork.makeReady(indexThr, index(k));
+				}
+			}
+		}
+
+		// runs all stages of n grains selected by index(0) ... index(n-1) in calling thread
+		// a Kernel with range stages gets contiguous batches of grains instead of single grains
+		template<typename Index>
+		void computeGrains(const State & state, size_t indexThr, size_t n, const Index & index, bool pipelined, const PipelineOptions & pipeline,
+						   DeadlineSignal * deadline = nullptr)
+		{
+			if(n>0)
+			{
+				initGrains(state, indexThr, n, index);
+
+				// time of each grain for cost model (a batch is shared equally by its grains)
+				CostModel * costs = fields->costs.active() ? &fields->costs : nullptr;
+
+				if(KernelStages<Kernel,State,GrainState>::batched)
+				{
+					// [first,last) of each batch
+					std::vector<std::pair<size_t,size_t>> batches;
+					const size_t batchSize = (pipeline.batchSize>0) ? pipeline.batchSize : n;
+					for(size_t k=0; Index::contiguous && k<n; k+=batchSize)
+					{
+						batches.push_back(std::make_pair(index(k),index(k)+std::min(batchSize,n-k)));
+					}
+					for(size_t k=0; !Index::contiguous && k<n; k++)
+					{
+						const size_t j = index(k);
+						if(batches.empty() || batches.back().second!=j || batches.back().second-batches.back().first>=batchSize)
+						{
+							batches.push_back(std::make_pair(j,j+1));
+						}
+						else
+						{
+							batches.back().second++;
+						}
+					}
+					computeUnits(batches.size(), [&](Stage stage, size_t u){
+						const size_t t0 = costs ? nowNanoseconds() : 0;
+						callBatch(stage, state, indexThr, batches[u].first, batches[u].second);
+						const size_t perGrain = costs ? (nowNanoseconds()-t0)/(batches[u].second-batches[u].first) : 0;
+						for(size_t j=batches[u].first; costs && j<batches[u].second; j++)
+						{
+							costs->record(indexThr, j, stage, perGrain);
+						}
+						for(size_t j=batches[u].first; deadline && stage==Stage::Sync && j<batches[u].second; j++)
+						{
+							deadline->completed[j]=1;
+						}
+					}, pipelined, pipeline, deadline, indexThr);
+				}
+				else
+				{
+					computeUnits(n, [&](Stage stage, size_t k){
+						const size_t t0 = costs ? nowNanoseconds() : 0;
+						callStage(stage, state, indexThr, index(k));
+						if(costs)
+						{
+							costs->record(indexThr, index(k), stage, nowNanoseconds()-t0);
+						}
+						if(deadline && stage==Stage::Sync)
+						{
+							deadline->completed[index(k)]=1;
+						}
+					}, pipelined, pipeline, deadline, indexThr);
+				}
+			}
+		}
 
-								}
-								else
-								{
-									// 3-way concurrency by pipelining methods
-									// input 1 input 2     input 3
-									//         compute 1   compute 2   compute 3
-									//                     output 1    output 2     output 3
-
-									const size_t first = start+2;
-									const size_t last = first+grain-2;
-									fields->totalWork[start].input(state, fields->totalWork[start].refGrainState());
-									fields->totalWork[start+1].input(state, fields->totalWork[start+1].refGrainState());
-									fields->totalWork[start].compute(state, fields->totalWork[start].refGrainState());
-									for(size_t j=first;j<last;j++)
-									{
-										fields->totalWork[j].input(state, fields->totalWork[j].refGrainState());
-										fields->totalWork[j-1].compute(state, fields->totalWork[j-1].refGrainState());
-										fields->totalWork[j-2].output(state, fields->totalWork[j-2].refGrainState());
-									}
-									fields->totalWork[last-1].compute(state, fields->totalWork[last-1].refGrainState());
-									fields->totalWork[last-2].output(state, fields->totalWork[last-2].refGrainState());
-									fields->totalWork[last-1].output(state, fields->totalWork[last-1].refGrainState());
-								}
+		// runs input/compute/output/sync stages of n units (grains or batches) in order given by pipeline options
+		// stage(Stage, u) runs a stage of unit u
+		// deadline: (optional) checked for device before input of each unit (before each block of syncWindow units, or each unit if syncWindow is 0, when not pipelined)
+		// 			units started before deadline are completed, others are skipped
+		template<typename UnitStage>
+		void computeUnits(size_t n, const UnitStage & stage, bool pipelined, const PipelineOptions & pipeline, const DeadlineSignal * deadline = nullptr, size_t device = 0)
+		{
+			const size_t window = (deadline && !pipelined && pipeline.syncWindow==0) ? 1 : pipeline.window(n);
+			if(!pipelined)
+			{
+				for(size_t first=0; first<n; first+=window)
+				{
+					if(deadline && deadline->expired(device))
+						break;
+					const size_t last = std::min(n, first+window);
+					for(size_t k=first; k<last; k++)
+					{
+						stage(Stage::Input, k); // user should have asynchronous launch in this
+					}
 
-								for(size_t j=first; j<last; j++)
-								{
-									fields->totalWork[j].sync(state, fields->totalWork[j].refGrainState()); // user must synchronize in this unless it is synchronized in other methods
-								}
-							}
-						}
-						fields->responseQueue[indexThr]->push(Response({1,elapsedDevice}));
+					for(size_t k=first; k<last; k++)
+					{
+						stage(Stage::Compute, k); // user should have asynchronous launch in this
 					}
 
+					for(size_t k=first; k<last; k++)
+					{
+						stage(Stage::Output, k); // user should have asynchronous launch in this
+					}
 
+					for(size_t k=first; k<last; k++)
+					{
+						stage(Stage::Sync, k); // user must synchronize in this unless it is synchronized in other methods
+					}
+				}
+			}
+			else
+			{
+				// skewed concurrency by pipelining methods (inputLead=1, outputLag=1)
+				// input 1 input 2     input 3
+				//         compute 1   compute 2   compute 3
+				//                     output 1    output 2     output 3
+				const size_t computeDelay = pipeline.inputLead;
+				const size_t outputDelay = pipeline.inputLead + pipeline.outputLag;
+				size_t synced = 0;
+				size_t started = n; // units after deadline are not started, units in flight are completed
+				for(size_t t=0; t<started+outputDelay; t++)
+				{
+					if(deadline && t<started && deadline->expired(device))
+					{
+						started = t;
+					}
+					// frees the slot of oldest unit in flight before a new unit takes it
+					if(t<started && t>=window)
+					{
+						stage(Stage::Sync, synced++);
+					}
+					if(t<started)
+					{
+						stage(Stage::Input, t);
+					}
+					if(t>=computeDelay && t-computeDelay<started)
+					{
+						stage(Stage::Compute, t-computeDelay);
+					}
+					if(t>=outputDelay && t-outputDelay<started)
+					{
+						stage(Stage::Output, t-outputDelay);
+					}
 				}
 
-			}));
+				for(size_t k=synced; k<started; k++)
+				{
+					stage(Stage::Sync, k); // user must synchronize in this unless it is synchronized in other methods
+				}
+			}
 		}
 
-
-
-
-		size_t runSingleAsync(GrainOfWork<State, GrainState> grain)
+		// calls a range stage of Kernel for grains [first,last) or the grain stage for each of them if Kernel has no range version of the stage
+		void callBatch(Stage stage, const State & state, size_t indexThr, size_t first, size_t last)
 		{
+			if(!KernelStages<Kernel,State,GrainState>::hasStage(stage))
 			{
-				std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
-				fields->initialized=true;
+				return;
 			}
 
-			const size_t totDev = fields->devices.size();
-
-			unsigned int szMin = ((unsigned int)0)-1;
-			int iMin = -1;
-
-			bool space = false;
-			while(!space)
+			if(!KernelStages<Kernel,State,GrainState>::hasRange(stage))
 			{
-				for(size_t i=0; i<totDev; i++)
+				for(size_t j=first; j<last; j++)
 				{
-					int sel=fields->loadQueue[i]->size();
-					if(szMin>sel && sel<25)
-					{
-						szMin=sel;
-						iMin=i;
-						space=true;
-					}
+					callStage(stage, state, indexThr, j);
 				}
+				return;
 			}
 
+			const bool trace = fields->tracing.load(std::memory_order_relaxed);
+			const size_t t0 = (EnableStats || trace) ? nowNanoseconds() : 0;
+			GrainSpan<GrainState> grainStates(&fields->totalWork.state(first), sizeof(GrainState), last-first);
+			try
+			{
+				KernelStages<Kernel,State,GrainState>::callRange(stage, state, first, last, grainStates);
+			}
+			catch(...)
+			{
+				throw StageFailure({first, (int)stage, std::current_exception()});
+			}
+			if(EnableStats || trace)
+			{
+				const size_t t1 = nowNanoseconds();
+				StatsRecorder<EnableStats>::stage(*fields->stats[indexThr], stage, t0, t1, stage==Stage::Sync ? last-first : 0);
+				if(trace)
+				{
+					fields->traceBuffers[indexThr]->add((int)stage, indexThr, first, t0, t1, fields->traceRun.load(std::memory_order_relaxed));
+				}
+			}
+		}
 
-			fields->loadQueue[iMin]->push(Load<GrainOfWork<State,GrainState>>({2,0,0,false,grain}));
-
-			return iMin;
+		// calls a stage function of grain j of total work
+		void callStage(Stage stage, const State & state, size_t indexThr, size_t j)
+		{
+			StoredFunctions<State,GrainState> functions(fields->totalWork, j);
+			callStage(stage, state, indexThr, functions, fields->totalWork.state(j), j);
 		}
 
-		// returns latency of grain's operation from being acquired by dedicated device thread to being sent to synchronization queue
-		// most of this latency can be hidden behind other grains' operations
-		size_t syncSingle(size_t id)
+		// calls a stage function of a grain and records its latency (if statistics are enabled) and timeline event (if tracing is enabled)
+		// functions: GrainOfWork of a single grain or StoredFunctions of a grain of total work
+		template<typename Functions>
+		void callStage(Stage stage, const State & state, size_t indexThr, Functions & functions, GrainState & gState, size_t j)
 		{
-			Response response = fields->responseQueue[id]->pop();
-			if(response.msg==0)
+			const bool trace = fields->tracing.load(std::memory_order_relaxed);
+			const size_t t0 = (EnableStats || trace) ? nowNanoseconds() : 0;
+			try
 			{
-				std::cout<<"Error: compute failed in device-"<<id<<std::endl;
+				KernelStages<Kernel,State,GrainState>::call(stage, state, functions, gState);
+			}
+			catch(...)
+			{
+				throw StageFailure({j, (int)stage, std::current_exception()});
+			}
+			if(EnableStats || trace)
+			{
+				const size_t t1 = nowNanoseconds();
+				StatsRecorder<EnableStats>::stage(*fields->stats[indexThr], stage, t0, t1, stage==Stage::Sync ? 1 : 0);
+				if(trace)
+				{
+					fields->traceBuffers[indexThr]->add((int)stage, indexThr, j, t0, t1, fields->traceRun.load(std::memory_order_relaxed));
+				}
 			}
-			return response.ns;
 		}
 
-		/* returns elapsed time in nanoseconds (this is minimized by load-balancer)
-		* pipelined: uses 3-way concurrency in launch pattern of input/compute/output/sync methods for supporting any CUDA/OpenCL-like efficient stream overlapping
-		*/
-		size_t run(bool pipelined = false)
+		/* graph mode: host thread dispatches grains whose dependencies are complete to devices with a free slot
+		 * free device with highest learned performance per queued grain is filled first,
+		 * with the oldest ready grain that has most of its dependencies computed in that device (their outputs are already there)
+		 * per-device time and grain count of the run update the balancing policy like other modes
+		 * grains of a device that fails (or times out) are dispatched again to other devices, failed device is not used until end of run
+		 * a quarantined device gets a single grain at a time as a probe
+		 */
+		void computeGraph(bool pipelined, size_t ticket, std::vector<RunError> & errors)
 		{
-
-			{
-				std::unique_lock<std::mutex> lg(*(fields->mutGlobal));
-				fields->initialized=true;
-			}
 			const size_t totWrk = fields->totalWork.size();
 			const size_t totDev = fields->devices.size();
+			const size_t depth = 2; // grains queued per device so that a device does not wait for the host between grains
+			const size_t lookAhead = 64; // number of ready grains searched for locality
+			std::vector<size_t> failures; // indices of errors of failed grains (timeouts that are waited for are not failures)
+
+			fields->dependsOn.resize(totWrk);
 
-			const int numSmoothing = 5;
-			const int curHistoryIndex = runCount % numSmoothing;
-			double totPerf = 0;
-			if(fields->performancesHistory.size()<totDev*numSmoothing)
+			// successors of each grain and number of dependencies left
+			std::vector<size_t> waiting(totWrk,0);
+			std::vector<size_t> firstSuccessor(totWrk+1,0);
+			for(size_t j=0;j<totWrk;j++)
 			{
-				fields->performancesHistory = std::vector<double>(totDev*numSmoothing);
-				for(size_t i=0;i<totDev;i++)
+				waiting[j]=fields->dependsOn[j].size();
+				for(const size_t d:fields->dependsOn[j])
+				{
+					firstSuccessor[d+1]++;
+				}
+			}
+			for(size_t j=0;j<totWrk;j++)
+			{
+				firstSuccessor[j+1]+=firstSuccessor[j];
+			}
+			std::vector<size_t> successors(firstSuccessor[totWrk]);
+			{
+				std::vector<size_t> fill(firstSuccessor.begin(),firstSuccessor.end()-1);
+				for(size_t j=0;j<totWrk;j++)
 				{
-					for(int j=0;j<numSmoothing;j++)
+					for(const size_t d:fields->dependsOn[j])
 					{
-						fields->performancesHistory[j*totDev + i]=1.0/totDev;
+						successors[fill[d]++]=j;
 					}
 				}
-
 			}
 
-			// compute real performance
-			totPerf=0.0f;
-			for(size_t i=0;i<totDev;i++)
+			std::deque<size_t> ready;
+			for(size_t j=0;j<totWrk;j++)
 			{
-				double perf = (fields->grainDev[i]+0.1)/(double)fields->nsDev[i];
-
-				totPerf+=perf;
-				fields->performances[i]=perf;
+				if(waiting[j]==0)
+				{
+					ready.push_back(j);
+				}
 			}
 
-			runCount++;
+			std::vector<int> producer(totWrk,-1);
+			std::vector<std::deque<size_t>> inFlight(totDev);
+			std::vector<size_t> nsGraph(totDev,0);
+			std::vector<size_t> grainsGraph(totDev,0);
+			std::vector<double> unitsGraph(totDev,0.0);
 
-			size_t ct=0;
+			// grains a device can have in flight (0: excluded until end of run) and time point when its oldest grain in flight was started
+			std::vector<size_t> limit(totDev,depth);
+			std::vector<size_t> frontSince(totDev,0);
+			bool watchdog = false;
 			for(size_t i=0;i<totDev;i++)
 			{
+				if(fields->quarantined[i])
+				{
+					limit[i] = (fields->abandoned[i]==0) ? 1 : 0;
+				}
+				if(fields->removed[i])
+				{
+					limit[i] = 0;
+				}
+				watchdog = watchdog || fields->options[i].watchdogNs>0;
+			}
+
+			size_t completed = 0;
+			size_t numInFlight = 0;
+			while(completed<totWrk)
+			{
+				// dispatch
+				while(!ready.empty())
+				{
+					size_t selected = totDev;
+					for(size_t i=0;i<totDev;i++)
+					{
+						if(inFlight[i].size()<limit[i] && (selected==totDev ||
+						   fields->performances[i]/(inFlight[i].size()+1) > fields->performances[selected]/(inFlight[selected].size()+1)))
+						{
+							selected=i;
+						}
+					}
+					if(selected==totDev)
+						break;
 
-				fields->performances[i]/=totPerf;
+					// oldest ready grain with most dependencies computed in selected device
+					size_t best = 0;
+					size_t bestLocal = 0;
+					const size_t scan = std::min(ready.size(),lookAhead);
+					for(size_t k=0;k<scan;k++)
+					{
+						size_t local = 0;
+						for(const size_t d:fields->dependsOn[ready[k]])
+						{
+							local += (producer[d]==(int)selected);
+						}
+						if(local>bestLocal)
+						{
+							best=k;
+							bestLocal=local;
+						}
+					}
 
-				// smoothing the performance measurement
-				double smooth = 0.0;
+					const size_t j = ready[best];
+					ready.erase(ready.begin()+best);
+					if(inFlight[selected].empty())
+					{
+						frontSince[selected]=nowNanoseconds();
+					}
+					inFlight[selected].push_back(j);
+					numInFlight++;
+					pushLoad(fields, selected, Load<GrainOfWork<State,GrainState>>({7,j,1,pipelined,nullptr,false,nullptr,nullptr,ticket,nullptr,nullptr,nullptr}));
+				}
 
+				// no device left for remaining grains
+				if(numInFlight==0)
+				{
+					break;
+				}
 
-				fields->performancesHistory[curHistoryIndex*totDev + i]=fields->performances[i];
-				for(int j=0;j<numSmoothing;j++)
+				// completion
+				const unsigned int waitTicket = fields->graphResponded->prepareWait();
+				size_t numResponded = 0;
+				for(size_t i=0;i<totDev;i++)
 				{
-					smooth += fields->performancesHistory[j*totDev + i];
+					Response response;
+					while(!inFlight[i].empty() && nextRunResponse(fields, i, false, response))
+					{
+						const size_t j = inFlight[i].front();
+						inFlight[i].pop_front();
+						numInFlight--;
+						frontSince[i]=nowNanoseconds();
+						if(response.msg==0)
+						{
+							if(limit[i]>0)
+							{
+								deviceFailed(fields, i, false, response, errors);
+								failures.push_back(errors.size()-1);
+								limit[i]=0;
+							}
+							ready.push_front(j);
+							numResponded++;
+							continue;
+						}
+						if(limit[i]>0)
+						{
+							fields->quarantined[i]=false;
+							limit[i]=depth;
+						}
+						numResponded++;
+						completed++;
+						producer[j]=(int)i;
+						nsGraph[i]+=response.ns;
+						grainsGraph[i]++;
+						unitsGraph[i]+=fields->costs.getCost(j);
+						for(size_t k=firstSuccessor[j];k<firstSuccessor[j+1];k++)
+						{
+							if(--waiting[successors[k]]==0)
+							{
+								ready.push_back(successors[k]);
+							}
+						}
+					}
 				}
-				smooth /= (double)numSmoothing;
-				fields->performances[i]=smooth;
-				fields->grainDev[i]=fields->performances[i]*totWrk;
-				ct+=fields->grainDev[i];
-			}
 
+				// grains of a device that does not complete its oldest grain in time are dispatched again only with redispatchOnTimeout,
+				// otherwise they and their successors are left uncomputed (run ends when no grain is in flight)
+				for(size_t i=0;i<totDev && watchdog;i++)
+				{
+					const size_t timeout = fields->options[i].watchdogNs;
+					if(!inFlight[i].empty() && timeout>0 && nowNanoseconds()-frontSince[i]>timeout)
+					{
+						const bool redispatch = deviceFailed(fields, i, true, Response(), errors);
+						if(redispatch)
+						{
+							failures.push_back(errors.size()-1);
+						}
+						fields->abandoned[i]+=inFlight[i].size()-1;
+						limit[i]=0;
+						numInFlight-=inFlight[i].size();
+						numResponded++;
+						while(!inFlight[i].empty())
+						{
+							if(redispatch)
+							{
+								ready.push_front(inFlight[i].back());
+							}
+							inFlight[i].pop_back();
+						}
+					}
+				}
 
+				if(numResponded==0 && !watchdog)
+				{
+					fields->graphResponded->commitWait(waitTicket);
+				}
+				else
+				{
+					fields->graphResponded->cancelWait();
+					if(numResponded==0)
+					{
+						std::this_thread::sleep_for(std::chrono::microseconds(20));
+					}
+				}
+			}
 
-			// if all devices have 0 work or num work < num device or not enough work allocated
-			size_t ctct=0;
-			while(ct < totWrk)
+			for(const size_t k:failures)
 			{
-
-				fields->grainDev[ctct%totDev]++;
-				ct++;ctct++;
+				errors[k].recovered = (completed==totWrk);
 			}
 
-			ct=0;
 			for(size_t i=0;i<totDev;i++)
 			{
+				if(grainsGraph[i]>0)
+				{
+					fields->nsDev[i]=std::max((size_t)1,nsGraph[i]);
+					fields->measured[i]=true;
+					fields->measuredGrains[i]=CostModel::toGrains(unitsGraph[i]);
+				}
+			}
+		}
 
-				fields->startDev[i]=ct;
-				ct+=fields->grainDev[i];
+		// affinity mode: moves minimum number of grains between devices to have grainDev[i] grains in device i
+		// with cost model, a device gets the same share of total cost of grains as its share of grains in grainDev instead
+		// (quarantined and removed devices still use counts for their probe grain)
+		// surplus grains leave a device from end of its list (grains received most recently move first)
+		// a grain is given to a device that already initialized it, if possible
+		void partitionAffinity()
+		{
+			const size_t totWrk = fields->totalWork.size();
+			const size_t totDev = fields->devices.size();
+			const CostModel & costs = fields->costs;
+			std::vector<size_t> pool;
+			for(size_t j=fields->grainOwner.size(); j<totWrk; j++)
+			{
+				fields->grainOwner.push_back(-1);
+				pool.push_back(j);
+			}
 
+			// target of device: grain count or total cost of its list
+			std::vector<bool> counted(totDev,true);
+			std::vector<double> target(totDev,0.0);
+			std::vector<double> load(totDev,0.0);
+			double costTotal = costs.units(0,totWrk);
+			size_t grainsOfCosted = 0;
+			for(size_t i=0;i<totDev;i++)
+			{
+				counted[i] = !costs.active() || fields->quarantined[i] || fields->removed[i];
+				target[i] = (double)fields->grainDev[i];
+				if(counted[i])
+					costTotal -= fields->grainDev[i];
+				else
+					grainsOfCosted += fields->grainDev[i];
+			}
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(!counted[i])
+				{
+					target[i] = grainsOfCosted>0 ? std::max(0.0,costTotal)*fields->grainDev[i]/grainsOfCosted : 0.0;
+				}
+				for(const size_t j:fields->assigned[i])
+				{
+					load[i] += counted[i] ? 1.0 : costs.getCost(j);
+				}
 			}
 
+			// a grain is moved when that brings load of device closer to its target
+			auto weight = [&](size_t i, size_t j){ return counted[i] ? 1.0 : costs.getCost(j); };
+			auto room = [&](size_t i, size_t j){ return load[i]+0.5*weight(i,j)<target[i]; };
+			for(size_t i=0;i<totDev;i++)
+			{
+				while(!fields->assigned[i].empty() && load[i]-0.5*weight(i,fields->assigned[i].back())>target[i])
+				{
+					load[i]-=weight(i,fields->assigned[i].back());
+					pool.push_back(fields->assigned[i].back());
+					fields->assigned[i].pop_back();
+				}
+			}
 
-			size_t elapsedTotal;
+			fields->migrations=0;
+			std::vector<size_t> rest;
+			for(size_t k=0;k<pool.size();k++)
 			{
-				Bench bench(&elapsedTotal);
+				bool placed = false;
+				for(size_t i=0;i<totDev && !placed;i++)
+				{
+					if(room(i,pool[k]) && fields->totalWork.isReady(i, pool[k]))
+					{
+						load[i]+=weight(i,pool[k]);
+						assignGrain(pool[k],i);
+						placed = true;
+					}
+				}
+				if(!placed)
+				{
+					rest.push_back(pool[k]);
+				}
+			}
 
-				// parallel run for real work & time measurement
-				for(size_t i=0; i<totDev; i++)
+			// remaining grains: device with room, or largest remaining share of cost (rounding of costs)
+			for(size_t k=0;k<rest.size();k++)
+			{
+				size_t selected = totDev;
+				for(size_t i=0;i<totDev && selected==totDev;i++)
+				{
+					if(room(i,rest[k]))
+						selected=i;
+				}
+				for(size_t i=0;i<totDev && selected==totDev;i++)
+				{
+					if(!counted[i])
+						selected=i;
+				}
+				for(size_t i=selected+1;i<totDev && !counted[selected];i++)
 				{
+					if(!counted[i] && target[i]-load[i]>target[selected]-load[selected])
+						selected=i;
+				}
+				if(selected==totDev)
+				{
+					// only counted devices and no room: same as count rounding of split
+					selected=0;
+					while(selected+1<totDev && fields->removed[selected])
+						selected++;
+				}
+				load[selected]+=weight(selected,rest[k]);
+				assignGrain(rest[k],selected);
+			}
+		}
 
-					if(fields->grainDev[i]>0)
-					{
-						fields->loadQueue[i]->push(Load<GrainOfWork<State,GrainState>>({1,fields->startDev[i],fields->grainDev[i],pipelined}));
+		void assignGrain(size_t grain, size_t device)
+		{
+			const int previous = fields->grainOwner[grain];
+			if(previous>=0 && previous!=(int)device)
+			{
+				fields->migrations++;
+				StoredFunctions<State,GrainState> functions(fields->totalWork, grain);
+				if(KernelStages<Kernel,State,GrainState>::hasRelease(functions))
+				{
+					fields->releaseList[previous].push_back(grain);
+				}
+			}
+			fields->grainOwner[grain]=device;
+			fields->assigned[device].push_back(grain);
+		}
 
-					}
+		// sends release commands to devices that lost grains and waits for them
+		// grains of a device that is still computing a timed out load are released when it responds again
+		// failures: indices of errors of failed releases are added (a failed release loses no grain, it is recovered with the run)
+		void releaseMigratedGrains(size_t ticket, std::vector<RunError> & errors, std::vector<size_t> & failures)
+		{
+			const size_t totDev = fields->devices.size();
+			std::vector<size_t> pending;
+			for(size_t i=0;i<totDev;i++)
+			{
+				if(!fields->releaseList[i].empty() && fields->abandoned[i]==0)
+				{
+					pushLoad(fields, i, Load<GrainOfWork<State,GrainState>>({5,0,0,false,nullptr,false,nullptr,nullptr,ticket,nullptr,nullptr,nullptr}));
+					pending.push_back(i);
 				}
+			}
 
-				for(size_t i=0; i<totDev; i++)
+			for(size_t k=0;k<pending.size();k++)
+			{
+				Response response;
+				const bool responded = takeResponse(fields, pending[k], ticket, response);
+				if(!responded || response.msg==0)
 				{
-					if(fields->grainDev[i]>0)
+					if(deviceFailed(fields, pending[k], !responded, response, errors))
 					{
-
-						Response response = fields->responseQueue[i]->pop();
-						if(response.msg==0)
-						{
-							std::cout<<"Error: compute failed in device-"<<i<<std::endl;
-						}
-						fields->nsDev[i]=response.ns;
+						failures.push_back(errors.size()-1);
 					}
 				}
 			}
-			return elapsedTotal;
+		}
 
+		// calls release function of grains that migrated away from device (affinity mode)
+		void releaseGrains(State state, size_t indexThr)
+		{
+			std::vector<size_t> & list = fields->releaseList[indexThr];
+			for(size_t k=0; k<list.size(); k++)
+			{
+				const size_t j = list[k];
+				if(fields->totalWork.isReady(indexThr, j))
+				{
+					StoredFunctions<State,GrainState> functions(fields->totalWork, j);
+					KernelStages<Kernel,State,GrainState>::release(state, functions, fields->totalWork.state(j));
+					fields->totalWork.makeUnready(indexThr, j);
+				}
+			}
+			list.clear();
 		}
 
-		// returns percentage of total system performance
-		std::vector<double> getRelativePerformancesOfDevices()
+		// calls release function of all grains initialized in device (device is removed)
+		void releaseAllGrains(State state, size_t indexThr)
 		{
-			std::vector<double> result;
-			size_t sz=fields->performances.size();
-			for(size_t i=0;i<sz;i++)
+			const size_t totWrk = fields->totalWork.size();
+			for(size_t j=0; j<totWrk; j++)
 			{
-				std::unique_lock<std::mutex> lg(*(fields->mut[i]));
-				result.push_back(fields->performances[i]*100.0);
+				if(fields->totalWork.isReady(indexThr, j))
+				{
+					StoredFunctions<State,GrainState> functions(fields->totalWork, j);
+					KernelStages<Kernel,State,GrainState>::release(state, functions, fields->totalWork.state(j));
+					fields->totalWork.makeUnready(indexThr, j);
+				}
 			}
-			return result;
 		}
-	private:
+
+		// work-stealing mode: computes own range chunk by chunk, then steals from back of slowest peer until all ranges are empty
+		// returns number of grains computed by this device
+		size_t computeStealing(State state, size_t indexThr, bool pipelined, const PipelineOptions & pipeline)
+		{
+			return computeAndSteal(fields->stealRange, indexThr, [&](size_t first, size_t count){
+				computeRange(state, indexThr, first, count, pipelined, pipeline);
+			});
+		}
+
 		std::shared_ptr<FieldBlock<State, GrainState>> fields;
 		int runCount;
 	};
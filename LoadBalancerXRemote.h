@@ -0,0 +1,697 @@
+/*
+ * LoadBalancerXRemote.h
+ *
+ *  remote devices: grains of a LoadBalancerX computed by another process (or computer) over TCP or Unix sockets
+ *
+ *  host side: a device whose State has a RemoteConnection is a remote device, grains made by makeRemoteGrain send their input
+ *  in input stage and receive their output in sync stage (so pipelined runs keep many grains in flight per connection)
+ *  worker side: RemoteWorker accepts connections and computes received grains on devices of its own LoadBalancerX
+ */
+
+#ifndef LOADBALANCERXREMOTE_H_
+#define LOADBALANCERXREMOTE_H_
+
+#include"LoadBalancerX.h"
+
+#include<cstring>
+#include<stdexcept>
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<netdb.h>
+#include<unistd.h>
+
+namespace LoadBalanceLib
+{
+	/* wire format: every message is a fixed header followed by payload bytes (host byte order, both sides must have same endianness)
+	 * Compute: host -> worker, grain index + input bytes
+	 * Result: worker -> host, grain index + output bytes, value = nanoseconds spent in worker
+	 * Echo: both directions, payload is sent back as is (used to measure round-trip time and bandwidth)
+	 * Error: worker -> host, grain index + error text, a stage of the grain failed in worker (no Result is sent for it)
+	 */
+	enum class RemoteMessage : uint32_t
+	{
+		Compute=1,
+		Result=2,
+		Echo=3,
+		Error=4
+	};
+
+	class RemoteHeader
+	{
+	public:
+		uint32_t type;
+		uint32_t reserved;
+		uint64_t grain;
+		uint64_t value;
+		uint64_t bytes; // payload size
+	};
+
+	// default limit of payload size of a received message, a larger header drops the connection (RemoteConnection::setMaxPayload)
+	enum : uint64_t { remoteMaxPayload = ((uint64_t)1)<<30 };
+
+	// blocking socket with whole-buffer send/receive
+	class RemoteSocket
+	{
+	public:
+		RemoteSocket():fd(-1){ }
+		explicit RemoteSocket(int fdPrm):fd(fdPrm){ }
+		~RemoteSocket(){ close(); }
+		RemoteSocket(const RemoteSocket &) = delete;
+		RemoteSocket & operator=(const RemoteSocket &) = delete;
+
+		/* address: "tcp:host:port" or "unix:/path/to/socket"
+		 * listening: true = bind and listen (server), false = connect (client)
+		 * returns false if socket can not be created, bound or connected
+		 */
+		bool open(const std::string & address, bool listening)
+		{
+			close();
+			if(address.compare(0,5,"unix:")==0)
+			{
+				const std::string path = address.substr(5);
+				sockaddr_un addr;
+				std::memset(&addr,0,sizeof(addr));
+				addr.sun_family=AF_UNIX;
+				if(path.size()>=sizeof(addr.sun_path))
+					return false;
+				std::strncpy(addr.sun_path,path.c_str(),sizeof(addr.sun_path)-1);
+				fd=::socket(AF_UNIX,SOCK_STREAM,0);
+				if(fd<0)
+					return false;
+				if(listening)
+				{
+					::unlink(path.c_str());
+					if(::bind(fd,(sockaddr *)&addr,sizeof(addr))!=0 || ::listen(fd,16)!=0)
+					{
+						close();
+						return false;
+					}
+				}
+				else if(::connect(fd,(sockaddr *)&addr,sizeof(addr))!=0)
+				{
+					close();
+					return false;
+				}
+				return true;
+			}
+
+			if(address.compare(0,4,"tcp:")==0)
+			{
+				const std::string hostPort = address.substr(4);
+				const size_t colon = hostPort.rfind(':');
+				if(colon==std::string::npos)
+					return false;
+				const std::string host = hostPort.substr(0,colon);
+				const std::string port = hostPort.substr(colon+1);
+				addrinfo hints;
+				std::memset(&hints,0,sizeof(hints));
+				hints.ai_family=AF_UNSPEC;
+				hints.ai_socktype=SOCK_STREAM;
+				hints.ai_flags=listening?AI_PASSIVE:0;
+				addrinfo * found = nullptr;
+				if(::getaddrinfo(host.empty()?nullptr:host.c_str(),port.c_str(),&hints,&found)!=0)
+					return false;
+				for(addrinfo * a=found; a!=nullptr && fd<0; a=a->ai_next)
+				{
+					fd=::socket(a->ai_family,a->ai_socktype,a->ai_protocol);
+					if(fd<0)
+						continue;
+					const int one = 1;
+					bool ok;
+					if(listening)
+					{
+						::setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+						ok = ::bind(fd,a->ai_addr,a->ai_addrlen)==0 && ::listen(fd,16)==0;
+					}
+					else
+					{
+						ok = ::connect(fd,a->ai_addr,a->ai_addrlen)==0;
+						::setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one)); // small messages of pipelined grains are not delayed
+					}
+					if(!ok)
+					{
+						close();
+					}
+				}
+				::freeaddrinfo(found);
+				return fd>=0;
+			}
+			return false;
+		}
+
+		// server side: waits for next connection, returns nullptr when socket is closed
+		std::shared_ptr<RemoteSocket> accept()
+		{
+			const int client = ::accept(fd,nullptr,nullptr);
+			if(client<0)
+				return nullptr;
+			const int one = 1;
+			::setsockopt(client,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one)); // fails harmlessly on unix sockets
+			return std::make_shared<RemoteSocket>(client);
+		}
+
+		bool sendAll(const void * data, size_t bytes)
+		{
+			const char * p = (const char *)data;
+			while(bytes>0)
+			{
+				const ssize_t sent = ::send(fd,p,bytes,MSG_NOSIGNAL);
+				if(sent<=0)
+					return false;
+				p+=sent;
+				bytes-=sent;
+			}
+			return true;
+		}
+
+		bool receiveAll(void * data, size_t bytes)
+		{
+			char * p = (char *)data;
+			while(bytes>0)
+			{
+				const ssize_t received = ::recv(fd,p,bytes,0);
+				if(received<=0)
+					return false;
+				p+=received;
+				bytes-=received;
+			}
+			return true;
+		}
+
+		// sends a message (header and payload), not thread-safe (callers lock)
+		bool sendMessage(RemoteMessage type, uint64_t grain, uint64_t value, const void * payload, size_t bytes)
+		{
+			RemoteHeader header;
+			std::memset(&header,0,sizeof(header));
+			header.type=(uint32_t)type;
+			header.grain=grain;
+			header.value=value;
+			header.bytes=bytes;
+			return sendAll(&header,sizeof(header)) && (bytes==0 || sendAll(payload,bytes));
+		}
+
+		// unblocks threads waiting in receive/accept of this socket
+		void shutdown()
+		{
+			if(fd>=0)
+				::shutdown(fd,SHUT_RDWR);
+		}
+
+		void close()
+		{
+			if(fd>=0)
+			{
+				::close(fd);
+				fd=-1;
+			}
+		}
+	private:
+		int fd;
+	};
+
+	// reads payload of a received header into buffer, returns false (connection is to be dropped) if it is larger than maxBytes,
+	// can not be allocated or is not received completely
+	inline bool receivePayload(RemoteSocket & socket, const RemoteHeader & header, uint64_t maxBytes, std::vector<char> & payload)
+	{
+		if(header.bytes>maxBytes)
+		{
+			std::cout<<"Error: remote message of "<<header.bytes<<" bytes exceeds limit of "<<maxBytes<<" bytes, connection is dropped"<<std::endl;
+			return false;
+		}
+		try
+		{
+			payload.resize(header.bytes);
+		}
+		catch(const std::bad_alloc &)
+		{
+			std::cout<<"Error: can not allocate "<<header.bytes<<" bytes for remote message, connection is dropped"<<std::endl;
+			return false;
+		}
+		return header.bytes==0 || socket.receiveAll(payload.data(),header.bytes);
+	}
+
+	/* host side of a remote device: one connection to a RemoteWorker
+	 * send() of many grains can be called before their receive() so that network latency is hidden (pipelined run)
+	 * a grain index must not be in flight twice at the same time
+	 */
+	class RemoteConnection
+	{
+	public:
+		RemoteConnection():connected(false),pendingEcho(0),echoed(0),rttNs(0),bytesPerNs(0.0),maxPayload(remoteMaxPayload){ }
+
+		~RemoteConnection()
+		{
+			disconnect();
+		}
+
+		// address: "tcp:host:port" or "unix:/path", returns false if worker can not be reached
+		bool connect(const std::string & address)
+		{
+			disconnect();
+			if(!socket.open(address,false))
+			{
+				std::cout<<"Error: can not connect to remote worker "<<address<<std::endl;
+				return false;
+			}
+			connected=true;
+			reader=std::thread([&]{ readLoop(); });
+			return true;
+		}
+
+		void disconnect()
+		{
+			socket.shutdown();
+			if(reader.joinable())
+				reader.join();
+			socket.close();
+		}
+
+		// sends input of a grain to worker, returns false if connection is lost
+		bool send(size_t grain, const void * input, size_t bytes)
+		{
+			std::unique_lock<std::mutex> lg(mutSend);
+			return socket.sendMessage(RemoteMessage::Compute, grain, 0, input, bytes);
+		}
+
+		// waits for output of a grain and copies at most capacity bytes into output, returns false if connection is lost or grain failed in worker
+		bool receive(size_t grain, void * output, size_t capacity)
+		{
+			std::string reason;
+			return receive(grain, output, capacity, reason);
+		}
+
+		// same as receive(grain, output, capacity), reason: why grain has no output (when false is returned)
+		bool receive(size_t grain, void * output, size_t capacity, std::string & reason)
+		{
+			std::unique_lock<std::mutex> lg(mutResult);
+			while(connected && results.find(grain)==results.end() && failures.find(grain)==failures.end())
+			{
+				condResult.wait(lg);
+			}
+			auto failed = failures.find(grain);
+			if(failed!=failures.end())
+			{
+				reason = "remote worker failed grain: "+failed->second;
+				failures.erase(failed);
+				return false;
+			}
+			auto found = results.find(grain);
+			if(found==results.end())
+			{
+				std::cout<<"Error: connection to remote worker lost before grain-"<<grain<<" completed"<<std::endl;
+				reason = "connection to remote worker lost while receiving grain";
+				return false;
+			}
+			std::memcpy(output, found->second.data(), std::min(capacity,found->second.size()));
+			results.erase(found);
+			return true;
+		}
+
+		/* measures round-trip time with an empty message and bandwidth with a probeBytes message (sent and echoed back)
+		 * grains in flight delay the probes (measured link is slower than it is), returns false if connection is lost
+		 */
+		bool measureLink(size_t probeBytes = (1<<20))
+		{
+			const size_t t0 = nowNanoseconds();
+			if(!echo(0))
+				return false;
+			const size_t t1 = nowNanoseconds();
+			if(!echo(probeBytes))
+				return false;
+			const size_t t2 = nowNanoseconds();
+			rttNs = t1-t0;
+			const size_t transferNs = (t2-t1>rttNs) ? (t2-t1-rttNs) : 1;
+			bytesPerNs = 2.0*probeBytes/transferNs;
+			return true;
+		}
+
+		// largest output of a grain accepted from worker (bytes), set before connect
+		void setMaxPayload(uint64_t bytes){ maxPayload = bytes; }
+
+		// round-trip time of an empty message (nanoseconds), 0 before measureLink
+		size_t getRoundTripTime() const { return rttNs; }
+
+		// bytes per nanosecond (in one direction), 0 before measureLink
+		double getBandwidth() const { return bytesPerNs; }
+
+		/* pipeline options for a remote device from measured link: enough grains in flight to cover one round trip and transfer of a grain
+		 * grainBytes: input + output bytes of a grain, grainComputeNs: expected compute time of a grain in worker
+		 */
+		PipelineOptions suggestedPipeline(size_t grainBytes, size_t grainComputeNs) const
+		{
+			const double transferNs = (bytesPerNs>0.0) ? grainBytes/bytesPerNs : 0.0;
+			const double perGrainNs = std::max(1.0, std::max(transferNs, (double)grainComputeNs));
+			const size_t inFlight = 1+(size_t)std::ceil((rttNs+transferNs)/perGrainNs);
+			return PipelineOptions(1, 1, std::max((size_t)3, inFlight));
+		}
+	private:
+		bool echo(size_t bytes)
+		{
+			std::vector<char> probe(bytes,0);
+			std::unique_lock<std::mutex> lg(mutResult);
+			const size_t expected = ++pendingEcho;
+			lg.unlock();
+
+			// readLoop needs mutResult to deliver results while worker may be blocked on sending them
+			{
+				std::unique_lock<std::mutex> lgSend(mutSend);
+				if(!socket.sendMessage(RemoteMessage::Echo, expected, 0, probe.data(), bytes))
+					return false;
+			}
+			lg.lock();
+			while(connected && echoed<expected)
+			{
+				condResult.wait(lg);
+			}
+			return connected;
+		}
+
+		void readLoop()
+		{
+			RemoteHeader header;
+			std::vector<char> payload;
+			while(socket.receiveAll(&header,sizeof(header)))
+			{
+				if(!receivePayload(socket, header, maxPayload, payload))
+				{
+					socket.shutdown();
+					break;
+				}
+
+				std::unique_lock<std::mutex> lg(mutResult);
+				if(header.type==(uint32_t)RemoteMessage::Result)
+				{
+					results[header.grain].swap(payload);
+				}
+				else if(header.type==(uint32_t)RemoteMessage::Error)
+				{
+					failures[header.grain].assign(payload.begin(),payload.end());
+				}
+				else if(header.type==(uint32_t)RemoteMessage::Echo)
+				{
+					echoed=header.grain;
+				}
+				condResult.notify_all();
+			}
+
+			std::unique_lock<std::mutex> lg(mutResult);
+			connected=false;
+			condResult.notify_all();
+		}
+
+		RemoteSocket socket;
+		std::thread reader;
+		std::mutex mutSend;
+		std::mutex mutResult;
+		std::condition_variable condResult;
+		std::map<size_t,std::vector<char>> results;
+		std::map<size_t,std::string> failures;
+		bool connected;
+		size_t pendingEcho;
+		size_t echoed;
+		size_t rttNs;
+		double bytesPerNs;
+		uint64_t maxPayload;
+	};
+
+	/* grain that is computed by computeLocal on local devices, or by a RemoteWorker on remote devices
+	 * State must have a member "std::shared_ptr<RemoteConnection> remote" (nullptr on local devices)
+	 * grainIndex: index of grain in total work (sent to worker, to select the work there)
+	 * inputBytes/outputBytes: byte range of input/output data of grain (output is written when grain is synced)
+	 * a lost connection (or a grain that failed in worker) throws std::runtime_error from input or sync stage,
+	 * so the load fails and its grains are computed by other devices
+	 */
+	template<typename State, typename GrainState>
+	GrainOfWork<State, GrainState> makeRemoteGrain(	size_t grainIndex,
+													std::function<std::pair<const void *,size_t>(GrainState&)> inputBytes,
+													std::function<std::pair<void *,size_t>(GrainState&)> outputBytes,
+													std::function<void(State, GrainState&)> computeLocal)
+	{
+		return GrainOfWork<State, GrainState>(
+				nullptr,
+				[=](State state, GrainState& grainState){
+					if(state.remote)
+					{
+						const std::pair<const void *,size_t> input = inputBytes(grainState);
+						if(!state.remote->send(grainIndex, input.first, input.second))
+							throw std::runtime_error("connection to remote worker lost while sending grain");
+					}
+				},
+				[=](State state, GrainState& grainState){
+					if(!state.remote)
+					{
+						computeLocal(state, grainState);
+					}
+				},
+				nullptr,
+				[=](State state, GrainState& grainState){
+					if(state.remote)
+					{
+						const std::pair<void *,size_t> output = outputBytes(grainState);
+						std::string reason;
+						if(!state.remote->receive(grainIndex, output.first, output.second, reason))
+							throw std::runtime_error(reason);
+					}
+				});
+	}
+
+	// a received grain in a RemoteWorker
+	class RemoteTask
+	{
+	public:
+		size_t grain;
+		std::vector<char> input;
+		std::vector<char> output;
+		bool failed; // kernel threw, reason is sent to host instead of output
+		std::string reason;
+		size_t t0; // receive time
+		std::shared_ptr<RemoteSocket> socket;
+		std::shared_ptr<std::mutex> mutSend;
+	};
+
+	/* worker daemon: computes grains received from hosts on devices of its own LoadBalancerX
+	 * kernel(state, grainIndex, input, output) computes a grain on a local device (output is sent back to host)
+	 * grains are run with runSingleAsync so that grains of all connections are balanced between local devices
+	 * each grain sends its own result (or failure) to its connection from its sync stage, a single collector only syncs them
+	 */
+	template<typename State>
+	class RemoteWorker
+	{
+	public:
+		RemoteWorker(std::function<void(State, size_t, const std::vector<char>&, std::vector<char>&)> kernelPrm):kernel(kernelPrm),listener(std::make_shared<RemoteSocket>()),maxPayload(remoteMaxPayload),collecting(false)
+		{
+
+		}
+
+		~RemoteWorker()
+		{
+			stop();
+		}
+
+		void addDevice(ComputeDevice<State> device, DeviceOptions options = DeviceOptions())
+		{
+			lb.addDevice(device, options);
+		}
+
+		// largest input of a grain accepted from hosts (bytes), a larger message drops its connection, set before start
+		void setMaxPayload(uint64_t bytes){ maxPayload = bytes; }
+
+		// starts accepting connections in background, returns false if address can not be listened
+		bool start(const std::string & address)
+		{
+			if(!listener->open(address,true))
+			{
+				std::cout<<"Error: remote worker can not listen on "<<address<<std::endl;
+				return false;
+			}
+			collecting=true;
+			collector=std::thread([&]{ collectLoop(); });
+			acceptor=std::thread([&]{ acceptLoop(); });
+			return true;
+		}
+
+		// closes listening socket and all connections, waits for their threads
+		void stop()
+		{
+			listener->shutdown();
+			if(acceptor.joinable())
+				acceptor.join();
+			std::vector<Connection> open;
+			{
+				std::unique_lock<std::mutex> lg(mutConnections);
+				for(auto & c:connections)
+					c.socket->shutdown();
+				open.swap(connections);
+			}
+			for(auto & c:open)
+			{
+				if(c.thread->joinable())
+					c.thread->join();
+			}
+			{
+				std::unique_lock<std::mutex> lg(mutSubmitted);
+				collecting=false;
+				condSubmitted.notify_one();
+			}
+			if(collector.joinable())
+				collector.join();
+			listener->close();
+		}
+	private:
+		// an accepted connection, done is set by its thread when it ends
+		class Connection
+		{
+		public:
+			std::shared_ptr<RemoteSocket> socket;
+			std::shared_ptr<std::thread> thread;
+			std::shared_ptr<std::atomic<bool>> done;
+		};
+
+		void acceptLoop()
+		{
+			while(true)
+			{
+				std::shared_ptr<RemoteSocket> socket = listener->accept();
+				if(!socket)
+					break;
+				std::unique_lock<std::mutex> lg(mutConnections);
+				reapConnections();
+				std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+				connections.push_back(Connection({socket, std::make_shared<std::thread>([this,socket,done]{
+					connectionLoop(socket);
+					done->store(true);
+				}), done}));
+			}
+		}
+
+		// joins threads of ended connections and closes their sockets, mutConnections must be locked
+		void reapConnections()
+		{
+			for(size_t k=0;k<connections.size();)
+			{
+				if(connections[k].done->load())
+				{
+					connections[k].thread->join();
+					connections[k]=connections.back();
+					connections.pop_back();
+				}
+				else
+				{
+					k++;
+				}
+			}
+		}
+
+		// syncs grains of all connections in order of submission (device of each grain), until stop and all submitted grains are synced
+		void collectLoop()
+		{
+			while(true)
+			{
+				size_t device;
+				{
+					std::unique_lock<std::mutex> lg(mutSubmitted);
+					while(collecting && submitted.empty())
+					{
+						condSubmitted.wait(lg);
+					}
+					if(submitted.empty())
+						return;
+					device=submitted.front();
+					submitted.pop_front();
+				}
+				lb.syncSingle(device);
+			}
+		}
+
+		// reads grains of a connection and runs them asynchronously, results are sent from sync stage of grains
+		void connectionLoop(std::shared_ptr<RemoteSocket> socket)
+		{
+			std::shared_ptr<std::mutex> mutSend = std::make_shared<std::mutex>();
+			std::function<void(State, size_t, const std::vector<char>&, std::vector<char>&)> compute = kernel;
+
+			RemoteHeader header;
+			while(socket->receiveAll(&header,sizeof(header)))
+			{
+				std::vector<char> payload;
+				if(!receivePayload(*socket, header, maxPayload, payload))
+				{
+					socket->shutdown();
+					break;
+				}
+
+				if(header.type==(uint32_t)RemoteMessage::Echo)
+				{
+					std::unique_lock<std::mutex> lg(*mutSend);
+					if(!socket->sendMessage(RemoteMessage::Echo, header.grain, 0, payload.data(), payload.size()))
+						break;
+					continue;
+				}
+
+				if(header.type==(uint32_t)RemoteMessage::Compute)
+				{
+					RemoteTask task;
+					task.grain=header.grain;
+					task.input.swap(payload);
+					task.failed=false;
+					task.t0=nowNanoseconds();
+					task.socket=socket;
+					task.mutSend=mutSend;
+					GrainOfWork<State,RemoteTask> work(
+							nullptr,
+							nullptr,
+							[compute](State state, RemoteTask & t){
+								// failure is sent by sync stage of this grain (responses of devices are shared by all connections)
+								try
+								{
+									compute(state, t.grain, t.input, t.output);
+								}
+								catch(const std::exception & e)
+								{
+									t.failed=true;
+									t.reason=e.what();
+								}
+								catch(...)
+								{
+									t.failed=true;
+									t.reason="unknown exception";
+								}
+							},
+							nullptr,
+							[](State, RemoteTask & t){
+								std::unique_lock<std::mutex> lg(*t.mutSend);
+								if(t.failed)
+									t.socket->sendMessage(RemoteMessage::Error, t.grain, 0, t.reason.data(), t.reason.size());
+								else
+									t.socket->sendMessage(RemoteMessage::Result, t.grain, nowNanoseconds()-t.t0, t.output.data(), t.output.size());
+							});
+					work.refGrainState()=std::move(task);
+					const size_t device = lb.runSingleAsync(std::move(work));
+					if(device==(size_t)-1)
+						continue;
+					std::unique_lock<std::mutex> lg(mutSubmitted);
+					submitted.push_back(device);
+					condSubmitted.notify_one();
+				}
+			}
+		}
+
+		std::function<void(State, size_t, const std::vector<char>&, std::vector<char>&)> kernel;
+		LoadBalancerX<State, RemoteTask> lb;
+		std::shared_ptr<RemoteSocket> listener;
+		std::thread acceptor;
+		std::mutex mutConnections;
+		std::vector<Connection> connections;
+		uint64_t maxPayload;
+		std::thread collector;
+		std::mutex mutSubmitted;
+		std::condition_variable condSubmitted;
+		std::deque<size_t> submitted; // devices of grains that are not synced yet
+		bool collecting;
+	};
+
+}
+
+#endif /* LOADBALANCERXREMOTE_H_ */
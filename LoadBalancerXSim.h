@@ -0,0 +1,300 @@
+/*
+ * LoadBalancerXSim.h
+ *
+ *  simulated devices on a virtual clock: the real LoadBalancerX::run() distributes grains of a scenario,
+ *  grains only advance the clock of their device (nothing sleeps), so a run takes microseconds and
+ *  results depend only on the scenario (Mode::Static and Mode::Affinity, other modes depend on thread timing)
+ *
+ *  reports makespan of each run relative to the optimum (oracle) split, number of runs to converge
+ *  and host time per run() call (api overhead), as one json object per scenario
+ */
+
+#ifndef LOADBALANCERXSIM_H_
+#define LOADBALANCERXSIM_H_
+
+#include"LoadBalancerX.h"
+
+#include<stdexcept>
+
+namespace LoadBalanceLib
+{
+	// cost model of a simulated device
+	class SimDeviceModel
+	{
+	public:
+		SimDeviceModel():nsPerGrain(1000.0),launchNs(0),noise(0.0),throttleRun(never),throttleFactor(1.0),failRun(never){ }
+		SimDeviceModel(double nsPerGrainPrm, size_t launchNsPrm = 0, double noisePrm = 0.0):
+			nsPerGrain(nsPerGrainPrm),launchNs(launchNsPrm),noise(noisePrm),throttleRun(never),throttleFactor(1.0),failRun(never){ }
+
+		static const size_t never = (size_t)-1;
+
+		// time of a grain
+		double nsPerGrain;
+
+		// fixed time of each load (kernel launch, transfer setup)
+		size_t launchNs;
+
+		// time of each grain is multiplied by a uniform random number in [1-noise, 1+noise] (same numbers for same scenario)
+		double noise;
+
+		// from run throttleRun on (counted from 0), time of each grain is multiplied by throttleFactor
+		size_t throttleRun;
+		double throttleFactor;
+
+		// compute stage of first grain of device throws in run failRun
+		size_t failRun;
+
+		// time of a grain in a run without noise
+		double cost(size_t run) const
+		{
+			return (throttleRun!=never && run>=throttleRun) ? nsPerGrain*throttleFactor : nsPerGrain;
+		}
+	};
+
+	// virtual clock of a simulated device, changed only by its device thread during a run
+	class SimDevice
+	{
+	public:
+		SimDevice(const SimDeviceModel & modelPrm, uint64_t seedPrm):model(modelPrm),seed(seedPrm),run(0),clock(0),begin(0),busy(0),failed(false){ }
+
+		// called by host between runs
+		void startRun(size_t runPrm)
+		{
+			run=runPrm;
+			busy=0;
+			failed=false;
+		}
+
+		// clock of device (DeviceOptions::clock)
+		size_t now() const { return clock; }
+
+		// begin of a load (DeviceOptions::loadBegin) adds launch overhead
+		void beginLoad()
+		{
+			begin=clock;
+			clock+=model.launchNs;
+		}
+
+		// end of a load (DeviceOptions::loadEnd)
+		void endLoad()
+		{
+			busy+=clock-begin;
+		}
+
+		void compute(size_t grain)
+		{
+			if(run==model.failRun && !failed)
+			{
+				failed=true;
+				throw std::runtime_error("simulated device failure");
+			}
+			double t = model.cost(run);
+			if(model.noise>0.0)
+			{
+				t *= 1.0 + model.noise*(2.0*uniform(grain)-1.0);
+			}
+			clock += (size_t)t;
+		}
+
+		// virtual time spent by device in current run
+		size_t getBusy() const { return busy; }
+	private:
+		// deterministic random number in [0,1) for a grain of current run (splitmix64)
+		double uniform(size_t grain) const
+		{
+			uint64_t z = seed + run*0x9E3779B97F4A7C15ull + grain*0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z>>30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z>>27)) * 0x94D049BB133111EBull;
+			z = z ^ (z>>31);
+			return (z>>11) * (1.0/9007199254740992.0);
+		}
+
+		SimDeviceModel model;
+		uint64_t seed;
+		size_t run;
+		size_t clock;
+		size_t begin;
+		size_t busy;
+		bool failed;
+	};
+
+	class SimState
+	{
+	public:
+		SimDevice * device;
+	};
+
+	class SimGrain
+	{
+	public:
+		size_t index;
+	};
+
+	class SimScenario
+	{
+	public:
+		SimScenario():grains(10000),runs(30),mode(Mode::Static),tolerance(0.05),seed(1){ }
+
+		std::string name;
+		std::vector<SimDeviceModel> devices;
+		size_t grains;
+		size_t runs;
+		Mode mode;
+
+		// a run is converged when its makespan is within (1+tolerance) of the optimum
+		double tolerance;
+		uint64_t seed;
+	};
+
+	class SimReport
+	{
+	public:
+		std::string scenario;
+		std::string policy;
+		std::vector<double> ratios; // makespan / optimum makespan of each run
+		long convergenceRuns; // runs until all runs before the first event (throttle or failure) are converged, -1 if never
+		long eventRecoveryRuns; // runs after the first event until all later runs are converged, -1 if never or no event
+		double meanRatio;
+		double finalRatio;
+		double apiNsPerRun; // average wall time of a run() call (balancer and thread overhead, grains take no time)
+	};
+
+	/* optimum makespan of a run: every device finishes at same time T, sum over devices of (T-launch)/cost = grains
+	 * devices with launch>=T get no grain, a failing device is not used
+	 */
+	inline double simOracleMakespan(const std::vector<SimDeviceModel> & devices, size_t grains, size_t run)
+	{
+		std::vector<bool> used(devices.size(),true);
+		for(size_t i=0;i<devices.size();i++)
+		{
+			used[i] = (devices[i].failRun!=run);
+		}
+
+		double finish = 0.0;
+		for(size_t iteration=0;iteration<devices.size();iteration++)
+		{
+			double sumInv = 0.0;
+			double sumLaunch = 0.0;
+			for(size_t i=0;i<devices.size();i++)
+			{
+				if(used[i])
+				{
+					sumInv += 1.0/devices[i].cost(run);
+					sumLaunch += devices[i].launchNs/devices[i].cost(run);
+				}
+			}
+			if(sumInv<=0.0)
+				return 0.0;
+			finish = (grains + sumLaunch)/sumInv;
+
+			bool changed = false;
+			for(size_t i=0;i<devices.size();i++)
+			{
+				if(used[i] && devices[i].launchNs>=finish)
+				{
+					used[i]=false;
+					changed=true;
+				}
+			}
+			if(!changed)
+				break;
+		}
+		return finish;
+	}
+
+	// first run in [first,last) from which all runs up to last are converged, -1 if last run is not converged
+	inline long simConvergence(const std::vector<double> & ratios, size_t first, size_t last, double tolerance)
+	{
+		long converged = -1;
+		for(size_t r=last; r>first; r--)
+		{
+			if(ratios[r-1]>1.0+tolerance)
+				break;
+			converged = (long)(r-1-first);
+		}
+		return converged;
+	}
+
+	// runs a scenario with real LoadBalancerX::run() calls on simulated devices
+	inline SimReport simulate(const SimScenario & scenario, std::shared_ptr<BalancingPolicy> policy, std::string policyName)
+	{
+		std::vector<std::shared_ptr<SimDevice>> devices;
+		LoadBalancerX<SimState,SimGrain> lb;
+		lb.setBalancingPolicy(policy);
+
+		GrainOfWork<SimState,SimGrain> work;
+		work.workCompute = [](SimState s, SimGrain & g){ s.device->compute(g.index); };
+		lb.addWorkBulk(scenario.grains, work, [](size_t j){ return SimGrain({j}); });
+
+		for(size_t i=0;i<scenario.devices.size();i++)
+		{
+			devices.push_back(std::make_shared<SimDevice>(scenario.devices[i], scenario.seed*1000003+i));
+			SimDevice * device = devices.back().get();
+			DeviceOptions options;
+			options.clock = [device](){ return device->now(); };
+			options.loadBegin = [device](){ device->beginLoad(); };
+			options.loadEnd = [device](){ device->endLoad(); };
+			lb.addDevice(ComputeDevice<SimState>({device},"sim-"+std::to_string(i)), options);
+		}
+
+		SimReport report;
+		report.scenario = scenario.name;
+		report.policy = policyName;
+		size_t apiNs = 0;
+		size_t firstEvent = scenario.runs;
+		for(const SimDeviceModel & model:scenario.devices)
+		{
+			firstEvent = std::min(firstEvent, std::min(model.throttleRun, model.failRun));
+		}
+
+		for(size_t r=0;r<scenario.runs;r++)
+		{
+			for(size_t i=0;i<devices.size();i++)
+			{
+				devices[i]->startRun(r);
+			}
+
+			const size_t t0 = nowNanoseconds();
+			lb.run(scenario.mode);
+			apiNs += nowNanoseconds()-t0;
+
+			size_t makespan = 0;
+			for(size_t i=0;i<devices.size();i++)
+			{
+				makespan = std::max(makespan, devices[i]->getBusy());
+			}
+			const double optimum = simOracleMakespan(scenario.devices, scenario.grains, r);
+			report.ratios.push_back(optimum>0.0 ? makespan/optimum : 0.0);
+		}
+
+		report.convergenceRuns = simConvergence(report.ratios, 0, firstEvent, scenario.tolerance);
+		report.eventRecoveryRuns = (firstEvent<scenario.runs) ? simConvergence(report.ratios, firstEvent, scenario.runs, scenario.tolerance) : -1;
+		report.meanRatio = 0.0;
+		for(const double ratio:report.ratios)
+		{
+			report.meanRatio += ratio/report.ratios.size();
+		}
+		report.finalRatio = report.ratios.empty() ? 0.0 : report.ratios.back();
+		report.apiNsPerRun = scenario.runs>0 ? apiNs/(double)scenario.runs : 0.0;
+		return report;
+	}
+
+	// writes report as a single line json object
+	inline void writeSimReport(std::ostream & out, const SimReport & report)
+	{
+		out<<"{\"scenario\":\""<<report.scenario<<"\",\"policy\":\""<<report.policy<<"\""
+		   <<",\"convergenceRuns\":"<<report.convergenceRuns
+		   <<",\"eventRecoveryRuns\":"<<report.eventRecoveryRuns
+		   <<",\"meanRatio\":"<<report.meanRatio
+		   <<",\"finalRatio\":"<<report.finalRatio
+		   <<",\"apiNsPerRun\":"<<(size_t)report.apiNsPerRun
+		   <<",\"ratios\":[";
+		for(size_t r=0;r<report.ratios.size();r++)
+		{
+			out<<(r>0?",":"")<<report.ratios[r];
+		}
+		out<<"]}\n";
+	}
+}
+
+#endif /* LOADBALANCERXSIM_H_ */
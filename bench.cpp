@@ -0,0 +1,127 @@
+//============================================================================
+// Name        : bench.cpp
+// Description : balancing benchmark on simulated devices (virtual clock, no sleep)
+//               g++ -std=c++14 -O2 -pthread bench.cpp -o bench && ./bench [results.jsonl]
+//               writes one json object per scenario and policy, prints a summary table
+//============================================================================
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+
+#include "LoadBalancerXSim.h"
+
+using namespace LoadBalanceLib;
+
+int main(int argc, char ** argv) {
+
+	std::vector<SimScenario> scenarios;
+
+	// same device 4 times
+	{
+		SimScenario s;
+		s.name = "uniform-4";
+		s.devices = std::vector<SimDeviceModel>(4, SimDeviceModel(1000.0));
+		scenarios.push_back(s);
+	}
+
+	// 1x, 2.5x, 5x slower devices
+	{
+		SimScenario s;
+		s.name = "heterogeneous-3";
+		s.devices = { SimDeviceModel(1000.0), SimDeviceModel(2500.0), SimDeviceModel(5000.0) };
+		scenarios.push_back(s);
+	}
+
+	// same as above with affinity mode
+	{
+		SimScenario s = scenarios.back();
+		s.name = "heterogeneous-3-affinity";
+		s.mode = Mode::Affinity;
+		scenarios.push_back(s);
+	}
+
+	// fast device with a large fixed launch cost (throughput of a run depends on its grain count)
+	{
+		SimScenario s;
+		s.name = "launch-overhead";
+		s.devices = { SimDeviceModel(200.0, 2000000), SimDeviceModel(1000.0, 10000), SimDeviceModel(1000.0, 10000) };
+		scenarios.push_back(s);
+	}
+
+	// 20% noise on every grain
+	{
+		SimScenario s;
+		s.name = "noisy";
+		s.devices = { SimDeviceModel(1000.0, 0, 0.2), SimDeviceModel(2000.0, 0, 0.2), SimDeviceModel(3000.0, 0, 0.2) };
+		scenarios.push_back(s);
+	}
+
+	// fastest device becomes 3x slower in run 15
+	{
+		SimScenario s;
+		s.name = "throttle-step";
+		s.devices = { SimDeviceModel(1000.0), SimDeviceModel(2000.0), SimDeviceModel(2000.0) };
+		s.devices[0].throttleRun = 15;
+		s.devices[0].throttleFactor = 3.0;
+		scenarios.push_back(s);
+	}
+
+	// a device throws in run 10, its grains are computed again by others and it comes back after a probe
+	{
+		SimScenario s;
+		s.name = "device-failure";
+		s.devices = { SimDeviceModel(1000.0), SimDeviceModel(1000.0), SimDeviceModel(2000.0) };
+		s.devices[1].failRun = 10;
+		scenarios.push_back(s);
+	}
+
+	// many devices with a spread of speeds
+	{
+		SimScenario s;
+		s.name = "many-16";
+		for(int i=0;i<16;i++)
+		{
+			s.devices.push_back(SimDeviceModel(1000.0+250.0*i, 5000));
+		}
+		s.grains = 50000;
+		scenarios.push_back(s);
+	}
+
+	std::ofstream file;
+	std::ostream * out = &std::cout;
+	if(argc>1)
+	{
+		file.open(argv[1]);
+		if(!file)
+		{
+			std::cout<<"Error: can not write "<<argv[1]<<std::endl;
+			return 1;
+		}
+		out = &file;
+	}
+
+	std::vector<SimReport> reports;
+	for(const SimScenario & s:scenarios)
+	{
+		reports.push_back(simulate(s, std::make_shared<MovingAveragePolicy>(), "moving-average"));
+		reports.push_back(simulate(s, std::make_shared<EwmaPolicy>(), "ewma"));
+		reports.push_back(simulate(s, std::make_shared<LinearFitPolicy>(), "linear-fit"));
+	}
+
+	for(const SimReport & r:reports)
+	{
+		writeSimReport(*out, r);
+	}
+
+	if(argc>1)
+	{
+		std::printf("%-26s %-15s %11s %9s %9s %9s %12s\n","scenario","policy","converge","recover","mean","final","api us/run");
+		for(const SimReport & r:reports)
+		{
+			std::printf("%-26s %-15s %11ld %9ld %9.3f %9.3f %12.1f\n",r.scenario.c_str(),r.policy.c_str(),
+						r.convergenceRuns,r.eventRecoveryRuns,r.meanRatio,r.finalRatio,r.apiNsPerRun/1000.0);
+		}
+	}
+	return 0;
+}
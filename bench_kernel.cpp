@@ -0,0 +1,105 @@
+//============================================================================
+// Name        : bench_kernel.cpp
+// Description : per-grain api overhead of std::function stage callbacks vs a Kernel type with static stage functions
+//               g++ -std=c++14 -O2 -pthread bench_kernel.cpp -o bench_kernel && ./bench_kernel
+//               prints nanoseconds per grain of a run (median of runs) for trivial grains on one device
+//============================================================================
+
+#include <iostream>
+#include <cstdio>
+#include <algorithm>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+// device state with a heap-allocated member, as a device handle with a name would have (copied per call by std::function stages)
+class DeviceState
+{
+public:
+	int gpuId;
+	std::string name;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+// only compute stage, other stages compile to nothing
+class IncrementKernel
+{
+public:
+	static void compute(const DeviceState &, GrainState & grainState){ grainState.value++; }
+};
+
+// compute stage on whole range of device at once
+class IncrementRangeKernel
+{
+public:
+	static void computeRange(const DeviceState &, size_t, size_t, GrainSpan<GrainState> grainStates)
+	{
+		for(size_t k=0;k<grainStates.size();k++)
+			grainStates[k].value++;
+	}
+};
+
+const size_t grains = 100000;
+const int runs = 21;
+
+template<typename Balancer>
+double nsPerGrain(Balancer & lb, bool pipelined)
+{
+	lb.addDevice(ComputeDevice<DeviceState>({0,"device-0 (benchmark device with a long name)"}));
+	std::vector<size_t> times;
+	for(int r=0;r<runs;r++)
+	{
+		size_t nano;
+		{
+			Bench bench(&nano);
+			lb.run(pipelined);
+		}
+		times.push_back(nano);
+	}
+	std::sort(times.begin(),times.end());
+	return times[runs/2]/(double)grains;
+}
+
+int main() {
+	GrainOfWork<DeviceState,GrainState> functions(
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState & g){ g.value++; },
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ });
+
+	for(bool pipelined:{false,true})
+	{
+		double perGrainFunctions, sharedFunctions, kernel, rangeKernel;
+		{
+			LoadBalancerX<DeviceState,GrainState> lb;
+			for(size_t j=0;j<grains;j++)
+				lb.addWork(functions);
+			perGrainFunctions = nsPerGrain(lb, pipelined);
+		}
+		{
+			LoadBalancerX<DeviceState,GrainState> lb;
+			lb.addWorkBulk(grains, functions);
+			sharedFunctions = nsPerGrain(lb, pipelined);
+		}
+		{
+			LoadBalancerX<DeviceState,GrainState,false,IncrementKernel> lb;
+			lb.addWorkBulk(grains, GrainOfWork<DeviceState,GrainState>(GrainState()));
+			kernel = nsPerGrain(lb, pipelined);
+		}
+		{
+			LoadBalancerX<DeviceState,GrainState,false,IncrementRangeKernel> lb;
+			lb.addWorkBulk(grains, GrainOfWork<DeviceState,GrainState>(GrainState()));
+			rangeKernel = nsPerGrain(lb, pipelined);
+		}
+		printf("%s std::function per grain: %6.2f ns  shared std::function: %6.2f ns  Kernel: %6.2f ns  range Kernel: %6.2f ns\n",
+				pipelined?"pipelined    ":"not pipelined",perGrainFunctions,sharedFunctions,kernel,rangeKernel);
+	}
+	return 0;
+}
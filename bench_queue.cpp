@@ -0,0 +1,101 @@
+//============================================================================
+// Name        : bench_queue.cpp
+// Description : load/response queue micro-benchmark, lock-free rings (ThreadsafeQueue as load queue, response queue, MPMC) vs previous std::queue + mutex + condition variable
+//               g++ -std=c++14 -O2 -pthread bench_queue.cpp -o bench_queue && ./bench_queue
+//               prints nanoseconds per element for 1 producer & 1 consumer and for 4 producers & 1 consumer
+//============================================================================
+
+#include <iostream>
+#include <cstdio>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+// previous implementation of ThreadsafeQueue
+template<typename T, int sz>
+class MutexQueue
+{
+public:
+	void push(T t)
+	{
+		std::unique_lock<std::mutex> lc(m);
+		q.push(t);
+		c.notify_one();
+	}
+
+	T pop()
+	{
+		std::unique_lock<std::mutex> lc(m);
+		while(q.empty())
+			c.wait(lc);
+		T result=q.front();
+		q.pop();
+		return result;
+	}
+private:
+	std::queue<T> q;
+	std::mutex m;
+	std::condition_variable c;
+};
+
+// element similar in size to a Response
+struct Element
+{
+	size_t values[6];
+};
+
+template<typename Queue>
+double nsPerElement(int producers, size_t elements)
+{
+	Queue queue;
+	const size_t perProducer = elements/producers;
+	size_t nano;
+	{
+		Bench bench(&nano);
+		std::vector<std::thread> threads;
+		for(int p=0;p<producers;p++)
+		{
+			threads.emplace_back([&,p](){
+				for(size_t i=0;i<perProducer;i++)
+				{
+					Element e = {};
+					e.values[0]=i;
+					e.values[1]=p;
+					queue.push(e);
+				}
+			});
+		}
+		size_t sum = 0;
+		for(size_t i=0;i<perProducer*producers;i++)
+		{
+			sum += queue.pop().values[0];
+		}
+		for(auto & t:threads)
+			t.join();
+		if(sum != producers*(perProducer*(perProducer-1)/2))
+			std::cout<<"Error: lost elements"<<std::endl;
+	}
+	return nano/(double)(perProducer*producers);
+}
+
+int main() {
+	const size_t elements = 2000000;
+	for(int producers:{1,4})
+	{
+		for(int repeat=0;repeat<3;repeat++)
+		{
+			// responses have a single producer (device thread), loads have a single consumer
+			const double load = nsPerElement<ThreadsafeQueue<Element,1024,true,false>>(producers, elements);
+			const double mpmc = nsPerElement<ThreadsafeQueue<Element,1024>>(producers, elements);
+			const double mutex = nsPerElement<MutexQueue<Element,1024>>(producers, elements);
+			printf("producers=%d  load ring: %7.1f ns  mpmc ring: %7.1f ns  mutex+cv: %7.1f ns",producers,load,mpmc,mutex);
+			if(producers==1)
+			{
+				printf("  response ring: %7.1f ns",nsPerElement<ThreadsafeQueue<Element,1024,false,true>>(producers, elements));
+			}
+			printf("\n");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+//============================================================================
+// Name        : bench_scaling.cpp
+// Description : per-run overhead of LoadBalancerX from 1k to 1M grains (bulk registration, one device)
+//               g++ -std=c++14 -O2 -pthread bench_scaling.cpp -o bench_scaling && ./bench_scaling
+//               for each grain count prints registration time, host overhead of a run (elapsed minus time of slowest device)
+//               and whole run time of a range Kernel (stage is called once per run, so all of it is overhead)
+//============================================================================
+
+#include <iostream>
+#include <cstdio>
+#include <algorithm>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+class EmptyRangeKernel
+{
+public:
+	static void computeRange(const DeviceState &, size_t, size_t, GrainSpan<GrainState>){ }
+};
+
+const int runs = 21;
+
+size_t median(std::vector<size_t> values)
+{
+	std::sort(values.begin(),values.end());
+	return values[values.size()/2];
+}
+
+int main() {
+	GrainOfWork<DeviceState,GrainState> functions(
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState & g){ g.value++; },
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ });
+
+	printf("%10s %16s %20s %20s\n","grains","register (ms)","host overhead (us)","range Kernel run (us)");
+	for(size_t grains:{1000,10000,100000,1000000})
+	{
+		size_t registerNs;
+		std::vector<size_t> overhead;
+		{
+			LoadBalancerX<DeviceState,GrainState> lb;
+			{
+				Bench bench(&registerNs);
+				lb.addWorkBulk(grains, functions);
+			}
+			lb.addDevice(ComputeDevice<DeviceState>({0}));
+			for(int r=0;r<runs;r++)
+			{
+				RunResult result = lb.runAsync().get();
+				overhead.push_back(result.elapsed>result.nsDev[0] ? result.elapsed-result.nsDev[0] : 0);
+			}
+		}
+
+		std::vector<size_t> rangeRun;
+		{
+			LoadBalancerX<DeviceState,GrainState,false,EmptyRangeKernel> lb;
+			lb.addWorkBulk(grains, GrainOfWork<DeviceState,GrainState>(GrainState()));
+			lb.addDevice(ComputeDevice<DeviceState>({0}));
+			for(int r=0;r<runs;r++)
+			{
+				size_t nano;
+				{
+					Bench bench(&nano);
+					lb.run();
+				}
+				rangeRun.push_back(nano);
+			}
+		}
+		printf("%10zu %16.2f %20.1f %20.1f\n",grains,registerNs/1000000.0,median(overhead)/1000.0,median(rangeRun)/1000.0);
+	}
+	return 0;
+}
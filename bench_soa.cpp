@@ -0,0 +1,124 @@
+//============================================================================
+// Name        : bench_soa.cpp
+// Description : per-run time of 1M trivial grains, grain store (structure of arrays) vs previous array of GrainOfWork objects
+//               g++ -std=c++14 -O2 -pthread bench_soa.cpp -o bench_soa && ./bench_soa
+//               prints milliseconds per run (median of runs) and nanoseconds per grain
+//============================================================================
+
+#include <iostream>
+#include <cstdio>
+#include <algorithm>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+// previous layout of a grain: five std::function objects, readiness map and timing fields next to grain state
+class PreviousGrain
+{
+public:
+	std::function<void(DeviceState, GrainState&)> init, input, compute, output, sync;
+	std::map<int,bool> initialized;
+	std::chrono::nanoseconds t1, t2;
+	GrainState state;
+};
+
+// previous device loop of a non-pipelined run: readiness pass, then one pass per stage over the range
+void previousRun(std::vector<PreviousGrain> & grains, const DeviceState & device)
+{
+	for(auto & g:grains)
+	{
+		if(!g.initialized[device.gpuId])
+		{
+			g.init(device, g.state);
+			g.initialized[device.gpuId]=true;
+		}
+	}
+	for(auto & g:grains)
+		g.input(device, g.state);
+	for(auto & g:grains)
+		g.compute(device, g.state);
+	for(auto & g:grains)
+		g.output(device, g.state);
+	for(auto & g:grains)
+		g.sync(device, g.state);
+}
+
+class IncrementKernel
+{
+public:
+	static void compute(const DeviceState &, GrainState & grainState){ grainState.value++; }
+};
+
+const size_t grains = 1000000;
+const int runs = 11;
+
+template<typename Run>
+double msPerRun(const Run & run)
+{
+	std::vector<size_t> times;
+	for(int r=0;r<runs;r++)
+	{
+		size_t nano;
+		{
+			Bench bench(&nano);
+			run();
+		}
+		times.push_back(nano);
+	}
+	std::sort(times.begin(),times.end());
+	return times[runs/2]/1000000.0;
+}
+
+void report(const char * name, double ms)
+{
+	printf("%-44s %8.2f ms/run %7.2f ns/grain\n",name,ms,ms*1000000.0/grains);
+}
+
+int main() {
+	auto nothing = [](DeviceState, GrainState&){ };
+	auto increment = [](DeviceState, GrainState & g){ g.value++; };
+	GrainOfWork<DeviceState,GrainState> functions(nothing,nothing,increment,nothing,nothing);
+
+	{
+		std::vector<PreviousGrain> previous(grains);
+		for(auto & g:previous)
+		{
+			g.init=nothing; g.input=nothing; g.compute=increment; g.output=nothing; g.sync=nothing;
+		}
+		const DeviceState device({0});
+		report("previous GrainOfWork array (no threads)", msPerRun([&]{ previousRun(previous, device); }));
+	}
+	{
+		LoadBalancerX<DeviceState,GrainState> lb;
+		for(size_t j=0;j<grains;j++)
+			lb.addWork(functions);
+		lb.addDevice(ComputeDevice<DeviceState>({0}));
+		report("grain store, std::function per grain", msPerRun([&]{ lb.run(); }));
+	}
+	{
+		LoadBalancerX<DeviceState,GrainState> lb;
+		lb.addWorkBulk(grains, functions);
+		lb.addDevice(ComputeDevice<DeviceState>({0}));
+		report("grain store, shared std::function (bulk)", msPerRun([&]{ lb.run(); }));
+	}
+	{
+		LoadBalancerX<DeviceState,GrainState,false,IncrementKernel> lb;
+		lb.addWorkBulk(grains, GrainOfWork<DeviceState,GrainState>(GrainState()));
+		lb.addDevice(ComputeDevice<DeviceState>({0}));
+		report("grain store, Kernel", msPerRun([&]{ lb.run(); }));
+	}
+	return 0;
+}
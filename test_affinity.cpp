@@ -0,0 +1,132 @@
+//============================================================================
+// Name        : test_affinity.cpp
+// Description : Mode::Affinity on devices whose speed changes between runs:
+//               getMigrationCount equals grains that changed device, release runs exactly for them on their previous device
+//               g++ -std=c++14 -O2 -pthread test_affinity.cpp -o test_affinity && ./test_affinity
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <set>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int id;
+};
+
+class GrainState
+{
+public:
+	size_t index;
+};
+
+const size_t grains = 600;
+const size_t runs = 14;
+const int devices = 3;
+
+// busy time of one grain on each device in microseconds, changed between runs
+std::atomic<int> grainUs[devices];
+
+void spin(int us)
+{
+	const auto end = std::chrono::steady_clock::now()+std::chrono::microseconds(us);
+	while(std::chrono::steady_clock::now()<end){ }
+}
+
+// (device, grain) pairs of init and release calls, written by device threads
+class Calls
+{
+public:
+	void add(std::set<std::pair<int,size_t>> & calls, int device, size_t grain)
+	{
+		std::unique_lock<std::mutex> lg(mut);
+		calls.insert(std::make_pair(device,grain));
+	}
+
+	std::mutex mut;
+	std::set<std::pair<int,size_t>> inits;
+	std::set<std::pair<int,size_t>> releases;
+};
+
+int check(const std::string & name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+int main() {
+	int failed = 0;
+
+	for(int i=0;i<devices;i++)
+		grainUs[i] = 20;
+
+	Calls calls;
+	std::vector<int> owners(grains,-1); // device of latest compute of each grain
+	LoadBalancerX<DeviceState,GrainState> lb;
+	for(int i=0;i<devices;i++)
+		lb.addDevice(ComputeDevice<DeviceState>({i}));
+	for(size_t j=0;j<grains;j++)
+	{
+		GrainOfWork<DeviceState,GrainState> grain;
+		grain.workInit = [&calls](DeviceState state, GrainState & g){ calls.add(calls.inits, state.id, g.index); };
+		grain.workCompute = [&owners](DeviceState state, GrainState & g){ spin(grainUs[state.id]); owners[g.index]=state.id; };
+		grain.workRelease = [&calls](DeviceState state, GrainState & g){ calls.add(calls.releases, state.id, g.index); };
+		grain.refGrainState().index = j;
+		lb.addWork(grain);
+	}
+
+	std::vector<int> previous;
+	bool countsMatch = true;
+	bool releasesMatch = true;
+	bool initsMatch = true;
+	size_t totalMoved = 0;
+	for(size_t r=0;r<runs;r++)
+	{
+		// device 0 becomes 3x slower in run 4 and device 2 2x slower in run 9, grains follow the new split
+		if(r==4)
+			grainUs[0] = 60;
+		if(r==9)
+			grainUs[2] = 40;
+		{
+			std::unique_lock<std::mutex> lg(calls.mut);
+			calls.inits.clear();
+			calls.releases.clear();
+		}
+
+		lb.run(Mode::Affinity);
+
+		// grains that changed device in this run: released on previous device, initialized on new device
+		std::set<std::pair<int,size_t>> expectedReleases;
+		std::set<std::pair<int,size_t>> expectedInits;
+		for(size_t j=0;j<grains;j++)
+		{
+			if(previous.empty())
+			{
+				expectedInits.insert(std::make_pair(owners[j],j));
+			}
+			else if(owners[j]!=previous[j])
+			{
+				expectedReleases.insert(std::make_pair(previous[j],j));
+				expectedInits.insert(std::make_pair(owners[j],j));
+			}
+		}
+		const size_t moved = previous.empty() ? 0 : expectedReleases.size();
+		totalMoved += moved;
+		if(!previous.empty())
+			countsMatch = countsMatch && lb.getMigrationCount()==moved;
+		releasesMatch = releasesMatch && calls.releases==expectedReleases;
+		initsMatch = initsMatch && calls.inits==expectedInits;
+		previous = owners;
+	}
+
+	failed += check("grains migrated after speed changes ("+std::to_string(totalMoved)+")", totalMoved>=grains/4);
+	failed += check("getMigrationCount equals grains that changed device", countsMatch);
+	failed += check("release called exactly for migrated grains on previous device", releasesMatch);
+	failed += check("init called only for new and migrated grains", initsMatch);
+	return failed;
+}
@@ -0,0 +1,98 @@
+//============================================================================
+// Name        : test_alloc.cpp
+// Description : heap allocations of runSingleAsync/syncSingle pairs after warm-up (grain passed by pointer)
+//               g++ -std=c++14 -O2 -pthread test_alloc.cpp -o test_alloc && ./test_alloc
+//               prints allocations per pair and grain initializations, exit code 1 if a steady-state pair allocates
+//============================================================================
+
+#include <iostream>
+#include <new>
+#include <cstdlib>
+#include <atomic>
+
+// counts allocations of all threads (device threads too)
+static std::atomic<size_t> allocations(0);
+
+static void * countedAlloc(std::size_t bytes)
+{
+	allocations.fetch_add(1,std::memory_order_relaxed);
+	void * p = std::malloc(bytes>0?bytes:1);
+	if(p==nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void * operator new(std::size_t bytes){ return countedAlloc(bytes); }
+void * operator new[](std::size_t bytes){ return countedAlloc(bytes); }
+void operator delete(void * p) noexcept { std::free(p); }
+void operator delete(void * p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void * p) noexcept { std::free(p); }
+void operator delete[](void * p, std::size_t) noexcept { std::free(p); }
+
+#include "LoadBalancerX.h"
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	GrainState():inits(0),value(0){ }
+	int inits;
+	int value;
+};
+
+int main() {
+	LoadBalanceLib::LoadBalancerX<DeviceState, GrainState> lb;
+	lb.addDevice(LoadBalanceLib::ComputeDevice<DeviceState>({0}));
+	lb.addDevice(LoadBalanceLib::ComputeDevice<DeviceState>({1}));
+
+	// one grain object per device slot, each is given again only after its sync returns
+	const int grainsInFlight = 16;
+	std::vector<LoadBalanceLib::GrainOfWork<DeviceState, GrainState>> grains;
+	for(int i=0;i<grainsInFlight;i++)
+	{
+		grains.push_back(LoadBalanceLib::GrainOfWork<DeviceState, GrainState>(
+				[](DeviceState, GrainState& thisGrain){ thisGrain.inits++; },
+				[](DeviceState, GrainState&){ },
+				[](DeviceState, GrainState& thisGrain){ thisGrain.value++; },
+				[](DeviceState, GrainState&){ },
+				[](DeviceState, GrainState&){ }
+		));
+	}
+	std::vector<size_t> ids(grainsInFlight);
+
+	auto round = [&](){
+		for(int i=0;i<grainsInFlight;i++)
+			ids[i]=lb.runSingleAsync(&grains[i]);
+		for(int i=0;i<grainsInFlight;i++)
+			lb.syncSingle(ids[i]);
+	};
+
+	// warm-up: threads start, grains are initialized in devices
+	for(int r=0;r<100;r++)
+		round();
+
+	const int rounds = 1000;
+	const size_t before = allocations.load();
+	for(int r=0;r<rounds;r++)
+		round();
+	const size_t allocated = allocations.load()-before;
+
+	int inits = 0;
+	int computed = 0;
+	for(int i=0;i<grainsInFlight;i++)
+	{
+		inits += grains[i].refGrainState().inits;
+		computed += grains[i].refGrainState().value;
+	}
+
+	std::cout<<"allocations per runSingleAsync/syncSingle pair: "<<allocated/(double)(rounds*grainsInFlight)<<std::endl;
+	std::cout<<"grain initializations: "<<inits<<" (at most "<<2*grainsInFlight<<"), computed: "<<computed<<std::endl;
+	const bool ok = allocated==0 && inits<=2*grainsInFlight && computed==(rounds+100)*grainsInFlight;
+	std::cout<<(ok?"ok":"FAIL")<<std::endl;
+	return ok?0:1;
+}
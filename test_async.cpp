@@ -0,0 +1,168 @@
+//============================================================================
+// Name        : test_async.cpp
+// Description : overlapping runAsync calls: every grain computed once per run and never by two runs at the same time,
+//               a device whose range does not overlap a stalled device's range runs ahead, futures can be polled with wait_for
+//               g++ -std=c++14 -O2 -pthread test_async.cpp -o test_async && ./test_async
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <atomic>
+#include <future>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	size_t index;
+};
+
+const size_t grains = 200;
+const int devices = 2;
+
+// computations of each grain, grains being computed, computations by each device
+std::vector<std::atomic<int>> computed(grains);
+std::vector<std::atomic<int>> busy(grains);
+std::atomic<bool> overlapped;
+std::atomic<size_t> perDevice[devices];
+
+// first grain computed by device 0 after stall is armed waits until it is released
+std::atomic<bool> stallArmed;
+std::atomic<bool> stallReleased;
+
+void spin(int us)
+{
+	const auto end = std::chrono::steady_clock::now()+std::chrono::microseconds(us);
+	while(std::chrono::steady_clock::now()<end){ }
+}
+
+bool computedAtLeast(int n)
+{
+	for(auto & c:computed)
+	{
+		if(c<n)
+			return false;
+	}
+	return true;
+}
+
+// polls condition until it holds (for up to 5 seconds)
+template<typename Condition>
+bool eventually(Condition condition)
+{
+	const auto end = std::chrono::steady_clock::now()+std::chrono::seconds(5);
+	while(!condition() && std::chrono::steady_clock::now()<end)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return condition();
+}
+
+int check(const std::string & name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+int main() {
+	int failed = 0;
+	overlapped = false;
+	stallArmed = false;
+	stallReleased = false;
+	for(size_t j=0;j<grains;j++)
+	{
+		computed[j]=0;
+		busy[j]=0;
+	}
+
+	LoadBalancerX<DeviceState,GrainState> lb;
+	for(size_t j=0;j<grains;j++)
+	{
+		GrainOfWork<DeviceState,GrainState> grain;
+		grain.workCompute = [](DeviceState gpu, GrainState & g){
+			if(busy[g.index].exchange(1)!=0)
+				overlapped = true;
+			if(gpu.gpuId==0 && stallArmed.exchange(false))
+			{
+				while(!stallReleased)
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			spin(20);
+			computed[g.index]++;
+			perDevice[gpu.gpuId]++;
+			busy[g.index] = 0;
+		};
+		grain.refGrainState().index = j;
+		lb.addWork(grain);
+	}
+	for(int i=0;i<devices;i++)
+	{
+		perDevice[i]=0;
+		lb.addDevice(ComputeDevice<DeviceState>({i}));
+	}
+
+	// several runs started before any result is taken, results are taken in order of runs
+	const int runs = 8;
+	{
+		std::vector<std::future<RunResult>> futures;
+		for(int r=0;r<runs;r++)
+			futures.push_back(lb.runAsync());
+		bool inOrder = true;
+		size_t grainsOfRuns = 0;
+		for(int r=0;r<runs;r++)
+		{
+			const RunResult result = futures[r].get();
+			inOrder = inOrder && computedAtLeast(r+1);
+			for(const size_t g:result.grainDev)
+				grainsOfRuns += g;
+		}
+		failed += check("runs before get: every grain computed once per run", computedAtLeast(runs) && !computedAtLeast(runs+1) &&
+						grainsOfRuns==runs*grains);
+		failed += check("runs before get: a run is complete for every grain when its future is ready", inOrder);
+	}
+
+	// device 0 stalls in first run: device 1 computes its range in all three runs meanwhile
+	// (no run completes while device 0 stalls, so all three runs get same ranges and ranges of different devices do not overlap)
+	{
+		stallArmed = true;
+		for(int i=0;i<devices;i++)
+			perDevice[i]=0;
+		std::vector<std::future<RunResult>> futures;
+		for(int r=0;r<3;r++)
+			futures.push_back(lb.runAsync());
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+		const size_t aheadGrains = perDevice[1];
+		const bool pending = futures[0].wait_for(std::chrono::milliseconds(0))!=std::future_status::ready &&
+							 futures[2].wait_for(std::chrono::milliseconds(0))!=std::future_status::ready;
+		failed += check("futures are not ready while a device of their run is stalled", pending);
+
+		stallReleased = true;
+		bool ready = true;
+		for(auto & f:futures)
+			ready = ready && eventually([&f](){ return f.wait_for(std::chrono::milliseconds(0))==std::future_status::ready; });
+		size_t grainsOfRuns = 0;
+		size_t grainsOfDevice1 = 0;
+		for(auto & f:futures)
+		{
+			const RunResult result = f.get();
+			for(const size_t g:result.grainDev)
+				grainsOfRuns += g;
+			grainsOfDevice1 += result.grainDev[1];
+		}
+		failed += check("device with non-overlapping range runs ahead of stalled device ("+std::to_string(aheadGrains)+" grains)",
+						grainsOfDevice1>0 && aheadGrains==grainsOfDevice1);
+		failed += check("futures become ready after stall, polled with wait_for", ready && grainsOfRuns==3*grains && computedAtLeast(runs+3) &&
+						!computedAtLeast(runs+4));
+	}
+
+	failed += check("no grain computed by two runs at the same time", !overlapped);
+	return failed;
+}
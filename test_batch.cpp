@@ -0,0 +1,188 @@
+//============================================================================
+// Name        : test_batch.cpp
+// Description : range stages of a Kernel with PipelineOptions::batchSize that does not divide the range of a device:
+//               number of batches, first/last and GrainSpan of every batch, same batches in every stage
+//               g++ -std=c++14 -O2 -pthread test_batch.cpp -o test_batch && ./test_batch
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <map>
+#include <algorithm>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	size_t index;
+};
+
+// one range stage call: [first,last) and what its GrainSpan points to
+class Batch
+{
+public:
+	size_t first;
+	size_t last;
+	size_t spanSize;
+	bool spanMatches; // span[k] is grain first+k for every k
+	bool operator<(const Batch & other) const { return first<other.first; }
+};
+
+// batches seen by each (device, stage), written by device threads
+class BatchLog
+{
+public:
+	void add(int device, Stage stage, size_t first, size_t last, GrainSpan<GrainState> grainStates)
+	{
+		bool matches = true;
+		for(size_t k=0;k<grainStates.size();k++)
+			matches = matches && grainStates[k].index==first+k;
+		std::unique_lock<std::mutex> lg(mut);
+		batches[std::make_pair(device,(int)stage)].push_back(Batch({first, last, grainStates.size(), matches}));
+	}
+
+	void clear()
+	{
+		std::unique_lock<std::mutex> lg(mut);
+		batches.clear();
+	}
+
+	std::mutex mut;
+	std::map<std::pair<int,int>,std::vector<Batch>> batches;
+};
+
+BatchLog batchLog;
+
+class BatchKernel
+{
+public:
+	static void inputRange(const DeviceState & gpu, size_t first, size_t last, GrainSpan<GrainState> grainStates){ batchLog.add(gpu.gpuId, Stage::Input, first, last, grainStates); }
+	static void computeRange(const DeviceState & gpu, size_t first, size_t last, GrainSpan<GrainState> grainStates){ batchLog.add(gpu.gpuId, Stage::Compute, first, last, grainStates); }
+	static void outputRange(const DeviceState & gpu, size_t first, size_t last, GrainSpan<GrainState> grainStates){ batchLog.add(gpu.gpuId, Stage::Output, first, last, grainStates); }
+	static void syncRange(const DeviceState & gpu, size_t first, size_t last, GrainSpan<GrainState> grainStates){ batchLog.add(gpu.gpuId, Stage::Sync, first, last, grainStates); }
+};
+
+const size_t grains = 1000;
+const size_t batchSize = 7; // 1000 = 142*7 + 6
+
+// batches of a device in one stage split its contiguous range [first,last) into full batches and a shorter last one
+// returns number of grains covered, 0 if batches are wrong
+size_t checkSplit(std::vector<Batch> batches)
+{
+	if(batches.empty())
+		return 0;
+	std::sort(batches.begin(),batches.end());
+	const size_t first = batches.front().first;
+	const size_t last = batches.back().last;
+	const size_t n = last-first;
+	if(batches.size()!=(n+batchSize-1)/batchSize)
+		return 0;
+	for(size_t b=0;b<batches.size();b++)
+	{
+		const size_t start = first+b*batchSize;
+		const size_t size = std::min(batchSize,last-start);
+		if(batches[b].first!=start || batches[b].last!=start+size || batches[b].spanSize!=size || !batches[b].spanMatches)
+			return 0;
+	}
+	return n;
+}
+
+// every stage of a device got same batches in same order of first grains
+bool sameInEveryStage(int device)
+{
+	std::vector<Batch> compute = batchLog.batches[std::make_pair(device,(int)Stage::Compute)];
+	std::sort(compute.begin(),compute.end());
+	for(const Stage stage:{Stage::Input, Stage::Output, Stage::Sync})
+	{
+		std::vector<Batch> other = batchLog.batches[std::make_pair(device,(int)stage)];
+		std::sort(other.begin(),other.end());
+		if(other.size()!=compute.size())
+			return false;
+		for(size_t b=0;b<other.size();b++)
+		{
+			if(other[b].first!=compute[b].first || other[b].last!=compute[b].last)
+				return false;
+		}
+	}
+	return true;
+}
+
+int check(const std::string & name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+int main() {
+	int failed = 0;
+
+	for(bool pipelined:{false,true})
+	{
+		const std::string suffix = pipelined ? " (pipelined)" : " (not pipelined)";
+
+		// one device gets whole range: 142 batches of 7 grains and a last batch of 6 grains
+		{
+			LoadBalancerX<DeviceState,GrainState,false,BatchKernel> lb;
+			for(size_t j=0;j<grains;j++)
+				lb.addWork(GrainOfWork<DeviceState,GrainState>(GrainState({j})));
+			DeviceOptions options;
+			options.pipeline = PipelineOptions(1,1,4,batchSize);
+			lb.addDevice(ComputeDevice<DeviceState>({0}), options);
+			batchLog.clear();
+			lb.run(pipelined);
+
+			const std::vector<Batch> & compute = batchLog.batches[std::make_pair(0,(int)Stage::Compute)];
+			bool ok = compute.size()==143 && checkSplit(compute)==grains && sameInEveryStage(0);
+			for(size_t b=0;b<compute.size() && ok;b++)
+			{
+				// single device computes its batches in order
+				ok = compute[b].first==b*batchSize && compute[b].spanSize==(b<142 ? batchSize : 6);
+			}
+			failed += check("one device: 143 batches, last one 6 grains"+suffix, ok);
+		}
+
+		// three devices: range of each device is split from its own first grain, every grain is in exactly one batch
+		{
+			LoadBalancerX<DeviceState,GrainState,false,BatchKernel> lb;
+			for(size_t j=0;j<grains;j++)
+				lb.addWork(GrainOfWork<DeviceState,GrainState>(GrainState({j})));
+			for(int i=0;i<3;i++)
+			{
+				DeviceOptions options;
+				options.pipeline = PipelineOptions(1,1,4,batchSize);
+				lb.addDevice(ComputeDevice<DeviceState>({i}), options);
+			}
+			bool ok = true;
+			for(int r=0;r<3 && ok;r++)
+			{
+				batchLog.clear();
+				lb.run(pipelined);
+				std::vector<int> covered(grains,0);
+				size_t total = 0;
+				for(int i=0;i<3 && ok;i++)
+				{
+					const std::vector<Batch> & compute = batchLog.batches[std::make_pair(i,(int)Stage::Compute)];
+					total += checkSplit(compute);
+					ok = sameInEveryStage(i);
+					for(const Batch & b:compute)
+					{
+						for(size_t j=b.first;j<b.last;j++)
+							covered[j]++;
+					}
+				}
+				ok = ok && total==grains && std::count(covered.begin(),covered.end(),1)==(long)grains;
+			}
+			failed += check("three devices: batches of each device range, every grain once"+suffix, ok);
+		}
+	}
+	return failed;
+}
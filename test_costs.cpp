@@ -0,0 +1,105 @@
+//============================================================================
+// Name        : test_costs.cpp
+// Description : cost-aware partitioning (setGrainCosts): with skewed per-grain costs, the summed cost of grains computed by each device
+//               follows the device's performance share (modes Static and Affinity, hinted and learned costs)
+//               g++ -std=c++14 -O2 -pthread test_costs.cpp -o test_costs && ./test_costs
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+const int grains = 200;
+
+// first fifth of grains is 10 times as expensive as the rest (560 units in total)
+int costOf(int i){ return i<grains/5 ? 10 : 1; }
+
+// microseconds per cost unit of each device, device-0 is 3 times faster
+const size_t unitUs[2] = {100, 300};
+
+// sums cost and counts grains computed by each device
+class Counters
+{
+public:
+	Counters():computed(grains),cost(2),count(2){ reset(); }
+	std::vector<std::atomic<int>> computed;
+	std::vector<std::atomic<int>> cost;
+	std::vector<std::atomic<int>> count;
+
+	void reset(){ for(auto & c:computed) c=0; for(auto & c:cost) c=0; for(auto & c:count) c=0; }
+	bool exactlyOnce(){ for(auto & c:computed) if(c!=1) return false; return true; }
+	double costShare(){ return cost[0]/(double)(cost[0]+cost[1]); }
+	double countShare(){ return count[0]/(double)grains; }
+};
+
+// grains sleep so that time of a grain is its cost on a single core too
+void addGrains(LoadBalancerX<DeviceState,GrainState> & lb, Counters & counters)
+{
+	for(int i=0;i<grains;i++)
+	{
+		lb.addWork(GrainOfWork<DeviceState,GrainState>(
+				[](DeviceState, GrainState&){ },
+				[](DeviceState, GrainState&){ },
+				[&counters,i](DeviceState gpu, GrainState&){
+					std::this_thread::sleep_for(std::chrono::microseconds(costOf(i)*unitUs[gpu.gpuId]));
+					counters.computed[i]++;
+					counters.cost[gpu.gpuId]+=costOf(i);
+					counters.count[gpu.gpuId]++;
+				},
+				[](DeviceState, GrainState&){ },
+				[](DeviceState, GrainState&){ }));
+	}
+}
+
+int check(const char * name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+// cost share of device-0 converges to its performance share 3/4 while its grain count share does not
+int costShare(const char * name, Mode mode, bool hinted)
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Counters counters;
+	addGrains(lb, counters);
+	lb.addDevice(ComputeDevice<DeviceState>({0}));
+	lb.addDevice(ComputeDevice<DeviceState>({1}));
+	std::vector<double> hints;
+	for(int i=0;i<grains && hinted;i++)
+		hints.push_back(costOf(i));
+	lb.setGrainCosts(hints, !hinted);
+	bool ok = true;
+	for(int r=0;r<20;r++)
+	{
+		counters.reset();
+		lb.run(mode);
+		ok = ok && counters.exactlyOnce();
+	}
+	const double share = counters.costShare();
+	std::cout<<"      device-0 share of cost = "<<share<<", of grains = "<<counters.countShare()<<std::endl;
+	return check(name, ok && share>0.67 && share<0.83 && std::abs(counters.countShare()-share)>0.05);
+}
+
+int main() {
+	int failed = 0;
+	failed += costShare("hinted costs in static mode", Mode::Static, true);
+	failed += costShare("hinted costs in affinity mode", Mode::Affinity, true);
+	failed += costShare("learned costs in static mode", Mode::Static, false);
+	return failed;
+}
@@ -0,0 +1,211 @@
+//============================================================================
+// Name        : test_executor.cpp
+// Description : two LoadBalancerX instances sharing one device thread (DeviceExecutor) with different priorities and weights
+//               g++ -std=c++14 -O2 -pthread test_executor.cpp -o test_executor && ./test_executor
+//               prints one line per case, exit code is number of failed cases (a deadlock fails after 60 seconds)
+//============================================================================
+
+#include <iostream>
+#include <cstdlib>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+const int grains = 32;
+
+// counts computations of each grain of a balancer
+class Counters
+{
+public:
+	Counters():computed(grains){ reset(); }
+	std::vector<std::atomic<int>> computed;
+
+	void reset(){ for(auto & c:computed) c=0; }
+	bool exactly(int n){ for(auto & c:computed) if(c!=n) return false; return true; }
+};
+
+void addGrains(LoadBalancerX<DeviceState,GrainState> & lb, Counters & counters)
+{
+	for(int i=0;i<grains;i++)
+	{
+		lb.addWork(GrainOfWork<DeviceState,GrainState>(
+				[](DeviceState, GrainState&){ },
+				[](DeviceState, GrainState&){ },
+				[&counters,i](DeviceState, GrainState&){
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+					counters.computed[i]++;
+				},
+				[](DeviceState, GrainState&){ },
+				[](DeviceState, GrainState&){ }));
+	}
+}
+
+DeviceOptions tenantOptions(std::shared_ptr<DeviceExecutor> executor, int priority, double weight)
+{
+	DeviceOptions options;
+	options.executor = executor;
+	options.priority = priority;
+	options.weight = weight;
+	return options;
+}
+
+int check(const char * name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+// both tenants always have a load queued, device time follows weights 3:1
+int weights()
+{
+	std::shared_ptr<DeviceExecutor> executor = std::make_shared<DeviceExecutor>();
+	Counters countersA, countersB;
+	LoadBalancerX<DeviceState,GrainState> a, b;
+	addGrains(a, countersA);
+	addGrains(b, countersB);
+	a.addDevice(ComputeDevice<DeviceState>({0}), tenantOptions(executor, 0, 3.0));
+	b.addDevice(ComputeDevice<DeviceState>({0}), tenantOptions(executor, 0, 1.0));
+
+	const int runs = 40;
+	auto host = [runs](LoadBalancerX<DeviceState,GrainState> & lb){
+		std::deque<std::future<RunResult>> inFlight;
+		for(int r=0;r<runs;r++)
+		{
+			inFlight.push_back(lb.runAsync());
+			if(inFlight.size()>4)
+			{
+				inFlight.front().get();
+				inFlight.pop_front();
+			}
+		}
+		for(auto & f:inFlight)
+			f.get();
+	};
+	std::thread hostA([&](){ host(a); });
+	std::thread hostB([&](){ host(b); });
+
+	// usage is compared between two time points while both tenants are busy
+	std::this_thread::sleep_for(std::chrono::milliseconds(30));
+	std::vector<TenantUsage> before = executor->getUsage();
+	std::this_thread::sleep_for(std::chrono::milliseconds(70));
+	std::vector<TenantUsage> after = executor->getUsage();
+	hostA.join();
+	hostB.join();
+
+	double ratio = 0.0;
+	if(before.size()==2 && after.size()==2 && after[1].busyNs>before[1].busyNs)
+	{
+		ratio = (after[0].busyNs-before[0].busyNs)/(double)(after[1].busyNs-before[1].busyNs);
+	}
+	std::cout<<"      busy time ratio of weights 3:1 = "<<ratio<<std::endl;
+	return check("weights share device time", ratio>2.0 && ratio<4.5 && countersA.exactly(runs) && countersB.exactly(runs));
+}
+
+// loads of higher priority tenant go first, lower priority tenant waits until they are all computed
+int priorities()
+{
+	std::shared_ptr<DeviceExecutor> executor = std::make_shared<DeviceExecutor>();
+	Counters countersHigh, countersLow;
+	LoadBalancerX<DeviceState,GrainState> high, low;
+	addGrains(high, countersHigh);
+	addGrains(low, countersLow);
+	high.addDevice(ComputeDevice<DeviceState>({0}), tenantOptions(executor, 1, 1.0));
+	low.addDevice(ComputeDevice<DeviceState>({0}), tenantOptions(executor, 0, 1.0));
+
+	// first runs start device threads of both tenants
+	high.run();
+	low.run();
+
+	const int runs = 10;
+	std::vector<std::future<RunResult>> highRuns;
+	for(int r=0;r<runs;r++)
+		highRuns.push_back(high.runAsync());
+	std::future<RunResult> lowRun = low.runAsync();
+	lowRun.wait();
+	int highReady = 0;
+	for(auto & f:highRuns)
+		highReady += f.wait_for(std::chrono::seconds(0))==std::future_status::ready;
+	for(auto & f:highRuns)
+		f.get();
+	return check("priority goes first", highReady==runs && countersHigh.exactly(runs+1) && countersLow.exactly(2));
+}
+
+// destroyed balancer detaches its tenant, other tenant keeps using executor
+int detachOnDestruction()
+{
+	std::shared_ptr<DeviceExecutor> executor = std::make_shared<DeviceExecutor>();
+	Counters countersA, countersB;
+	LoadBalancerX<DeviceState,GrainState> a;
+	addGrains(a, countersA);
+	a.addDevice(ComputeDevice<DeviceState>({0}), tenantOptions(executor, 0, 1.0));
+	bool ok = true;
+	{
+		LoadBalancerX<DeviceState,GrainState> b;
+		addGrains(b, countersB);
+		b.addDevice(ComputeDevice<DeviceState>({0}), tenantOptions(executor, 0, 1.0));
+		a.run();
+		b.run();
+		ok = executor->getUsage().size()==2;
+
+		// runs in flight are completed before detach
+		b.runAsync();
+		b.runAsync();
+	}
+	ok = ok && executor->getUsage().size()==1 && countersB.exactly(3);
+	a.run();
+	ok = ok && countersA.exactly(2);
+
+	// a removed device is detached too
+	a.removeDevice(0);
+	ok = ok && executor->getUsage().empty();
+	return check("detach on destruction and removeDevice", ok);
+}
+
+// executor device is added while a single grain of a not yet started device thread is in flight
+int addWithSingleInFlight()
+{
+	std::shared_ptr<DeviceExecutor> executor = std::make_shared<DeviceExecutor>();
+	bool ok = true;
+	for(int iteration=0;iteration<20 && ok;iteration++)
+	{
+		Counters counters;
+		LoadBalancerX<DeviceState,GrainState> lb;
+		addGrains(lb, counters);
+		lb.addDevice(ComputeDevice<DeviceState>({0}), tenantOptions(executor, 0, 1.0));
+		const size_t id = lb.runSingleAsync(GrainOfWork<DeviceState,GrainState>(GrainState()));
+		lb.addDevice(ComputeDevice<DeviceState>({1}), tenantOptions(executor, 0, 1.0));
+		lb.syncSingle(id);
+		lb.run();
+		ok = counters.exactly(1);
+	}
+	return check("addDevice with single grain in flight", ok);
+}
+
+int main() {
+	std::thread deadlock([](){
+		std::this_thread::sleep_for(std::chrono::seconds(60));
+		std::cout<<"FAIL deadlock"<<std::endl;
+		std::_Exit(1);
+	});
+	deadlock.detach();
+
+	int failed = 0;
+	failed += weights();
+	failed += priorities();
+	failed += detachOnDestruction();
+	failed += addWithSingleInFlight();
+	return failed;
+}
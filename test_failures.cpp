@@ -0,0 +1,266 @@
+//============================================================================
+// Name        : test_failures.cpp
+// Description : re-dispatch of grains of failed loads (stage exception, watchdog timeout), timed out loads kept by hung devices, runs in flight at a timeout
+//               g++ -std=c++14 -O2 -pthread test_failures.cpp -o test_failures && ./test_failures
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <stdexcept>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+const int grains = 64;
+
+// counts computations of each grain, detects a grain computed by two devices at the same time
+class Counters
+{
+public:
+	Counters():computed(grains),running(grains),overlapped(false),hungGrain(-1),overlappedOther(false){ for(int i=0;i<grains;i++){ computed[i]=0; running[i]=0; } }
+	std::vector<std::atomic<int>> computed;
+	std::vector<std::atomic<int>> running;
+	std::atomic<bool> overlapped;
+	std::atomic<int> hungGrain; // grain that hangs in device-1
+	std::atomic<bool> overlappedOther; // a grain other than hungGrain is computed by two devices at the same time
+
+	int minimum(){ int m=computed[0]; for(int i=0;i<grains;i++) m=std::min(m,computed[i].load()); return m; }
+	int maximum(){ int m=computed[0]; for(int i=0;i<grains;i++) m=std::max(m,computed[i].load()); return m; }
+};
+
+// grain that throws once in device-1, or hangs once in device-1 for hangMs
+void addGrains(LoadBalancerX<DeviceState,GrainState> & lb, Counters & counters, std::atomic<bool> & armed, bool hang, int hangMs)
+{
+	for(int i=0;i<grains;i++)
+	{
+		lb.addWork(GrainOfWork<DeviceState,GrainState>(
+				[](DeviceState, GrainState&){ },
+				[](DeviceState, GrainState&){ },
+				[&,i,hang,hangMs](DeviceState gpu, GrainState&){
+					if(counters.running[i]++>0)
+					{
+						counters.overlapped=true;
+						if(i!=counters.hungGrain)
+							counters.overlappedOther=true;
+					}
+					bool expected = true;
+					if(gpu.gpuId==1 && armed.compare_exchange_strong(expected,false))
+					{
+						if(!hang)
+						{
+							counters.running[i]--;
+							throw std::runtime_error("device-1 failed");
+						}
+						counters.hungGrain=i;
+						std::this_thread::sleep_for(std::chrono::milliseconds(hangMs));
+					}
+					std::this_thread::sleep_for(std::chrono::microseconds(200));
+					counters.computed[i]++;
+					counters.running[i]--;
+				},
+				[](DeviceState, GrainState&){ },
+				[](DeviceState, GrainState&){ }
+		));
+	}
+}
+
+int check(const char * name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+int exceptionRedispatch(Mode mode, const char * name)
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Counters counters;
+	std::atomic<bool> armed(true);
+	addGrains(lb, counters, armed, false, 0);
+	lb.addDevice(ComputeDevice<DeviceState>({0}));
+	lb.addDevice(ComputeDevice<DeviceState>({1}));
+	lb.run(mode);
+	std::vector<RunError> errors = lb.getRunErrors();
+	bool rethrown = false;
+	try
+	{
+		if(errors.size()==1 && errors[0].exception)
+			std::rethrow_exception(errors[0].exception);
+	}
+	catch(const std::runtime_error &)
+	{
+		rethrown = true;
+	}
+	return check(name, counters.minimum()>=1 && errors.size()==1 && errors[0].device==1 && !errors[0].timeout && errors[0].recovered
+						&& rethrown && lb.isDeviceQuarantined(1) && !counters.overlapped);
+}
+
+int watchdogRedispatch(Mode mode, const char * name)
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Counters counters;
+	std::atomic<bool> armed(true);
+	addGrains(lb, counters, armed, true, 300);
+	DeviceOptions options;
+	options.watchdogNs = 30000000;
+	options.redispatchOnTimeout = true;
+	lb.addDevice(ComputeDevice<DeviceState>({0}), options);
+	lb.addDevice(ComputeDevice<DeviceState>({1}), options);
+	size_t nano;
+	{
+		Bench bench(&nano);
+		lb.run(mode);
+	}
+	std::vector<RunError> errors = lb.getRunErrors();
+	const bool ok = counters.minimum()>=1 && nano<250000000 && errors.size()==1 && errors[0].device==1 && errors[0].timeout && errors[0].recovered
+					&& lb.isDeviceQuarantined(1);
+
+	// hung device completes its abandoned load, it is not given new work until it responds
+	std::this_thread::sleep_for(std::chrono::milliseconds(400));
+	lb.run(mode);
+	lb.run(mode);
+	return check(name, ok && !lb.isDeviceQuarantined(1) && lb.getRunErrors().empty());
+}
+
+// run returns at timeout without grains of the late load, they are not given to device-0 while device-1 is still computing them
+int watchdogKeep(Mode mode, const char * name)
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Counters counters;
+	std::atomic<bool> armed(true);
+	addGrains(lb, counters, armed, true, 300);
+	DeviceOptions options;
+	options.watchdogNs = 50000000;
+	lb.addDevice(ComputeDevice<DeviceState>({0}), options);
+	lb.addDevice(ComputeDevice<DeviceState>({1}), options);
+	size_t nano;
+	{
+		Bench bench(&nano);
+		lb.run(mode);
+	}
+	std::vector<RunError> errors = lb.getRunErrors();
+	const bool ok = nano<250000000 && counters.computed[counters.hungGrain]==0 && counters.maximum()==1
+					&& errors.size()==1 && errors[0].device==1 && errors[0].timeout && !errors[0].recovered && lb.isDeviceQuarantined(1);
+
+	// hung device completes its late load, it is not given new work until it responds
+	std::this_thread::sleep_for(std::chrono::milliseconds(400));
+	lb.run(mode);
+	lb.run(mode);
+	return check(name, ok && !counters.overlapped && !lb.isDeviceQuarantined(1) && lb.getRunErrors().empty());
+}
+
+// range load queued behind a timed out load is not reported again, run returns without waiting for the hung device
+int hungBeforeRange(const char * name)
+{
+	// counters outlive balancer, its destructor waits for the hung device
+	Counters counters;
+	std::atomic<bool> armed(true);
+	LoadBalancerX<DeviceState,GrainState> lb;
+	addGrains(lb, counters, armed, true, 100);
+	lb.addRange(1000, [](DeviceState, size_t, size_t){ });
+	DeviceOptions options;
+	options.watchdogNs = 10000000;
+	lb.addDevice(ComputeDevice<DeviceState>({1}), options);
+	size_t nano;
+	{
+		Bench bench(&nano);
+		lb.run();
+	}
+	std::vector<RunError> errors = lb.getRunErrors();
+	return check(name, nano<90000000 && errors.size()==1 && errors[0].timeout && !errors[0].recovered && lb.isDeviceQuarantined(0));
+}
+
+// hung device keeps its timed out deadline load, later deadline runs do not send its grain list again
+// (hung grain itself is computed by device-0 in later runs while device-1 is still in it)
+int deadlineWatchdogRedispatch(const char * name)
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Counters counters;
+	std::atomic<bool> armed(true);
+	addGrains(lb, counters, armed, true, 300);
+	DeviceOptions options;
+	options.watchdogNs = 30000000;
+	options.redispatchOnTimeout = true;
+	lb.addDevice(ComputeDevice<DeviceState>({0}), options);
+	lb.addDevice(ComputeDevice<DeviceState>({1}), options);
+	DeadlineResult first = lb.run(std::chrono::milliseconds(50));
+	const bool timedOut = first.errors.size()==1 && first.errors[0].device==1 && first.errors[0].timeout && lb.isDeviceQuarantined(1);
+
+	// device-1 wakes up during one of these runs
+	const size_t begin = nowNanoseconds();
+	while(nowNanoseconds()-begin<600000000)
+	{
+		lb.run(std::chrono::milliseconds(50));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	lb.run(std::chrono::milliseconds(50));
+	lb.run(std::chrono::milliseconds(50));
+	return check(name, timedOut && !counters.overlappedOther && !lb.isDeviceQuarantined(1));
+}
+
+// runs in flight return at watchdog timeouts without waiting for the hung device (its late loads may overlap later runs, see runAsync)
+// after its late loads end the device is re-admitted and no grain is computed by two runs at the same time again
+int watchdogRunsInFlight(const char * name)
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Counters counters;
+	std::atomic<bool> armed(true);
+	addGrains(lb, counters, armed, true, 300);
+	DeviceOptions options;
+	options.watchdogNs = 30000000;
+	lb.addDevice(ComputeDevice<DeviceState>({0}), options);
+	lb.addDevice(ComputeDevice<DeviceState>({1}), options);
+	size_t nano;
+	bool timedOut = true;
+	{
+		Bench bench(&nano);
+		std::vector<std::future<RunResult>> futures;
+		for(int r=0;r<3;r++)
+			futures.push_back(lb.runAsync());
+		for(auto & f:futures)
+		{
+			const RunResult result = f.get();
+			timedOut = timedOut && result.errors.size()==1 && result.errors[0].device==1 && result.errors[0].timeout && !result.errors[0].recovered;
+		}
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(400));
+	lb.run();
+	counters.overlapped = false;
+	std::vector<std::future<RunResult>> futures;
+	for(int r=0;r<3;r++)
+		futures.push_back(lb.runAsync());
+	bool clean = true;
+	for(auto & f:futures)
+		clean = clean && f.get().errors.empty();
+	return check(name, nano<250000000 && timedOut && clean && !counters.overlapped && !lb.isDeviceQuarantined(1));
+}
+
+int main() {
+	int failed = 0;
+	failed += exceptionRedispatch(Mode::Static, "exception re-dispatch, static");
+	failed += exceptionRedispatch(Mode::WorkStealing, "exception re-dispatch, work stealing");
+	failed += exceptionRedispatch(Mode::Affinity, "exception re-dispatch, affinity");
+	failed += watchdogRedispatch(Mode::Static, "watchdog re-dispatch, static");
+	failed += watchdogRedispatch(Mode::Affinity, "watchdog re-dispatch, affinity");
+	failed += watchdogKeep(Mode::Static, "watchdog without re-dispatch, static");
+	failed += watchdogKeep(Mode::WorkStealing, "watchdog without re-dispatch, work stealing");
+	failed += watchdogKeep(Mode::Affinity, "watchdog without re-dispatch, affinity");
+	failed += watchdogKeep(Mode::Graph, "watchdog without re-dispatch, graph");
+	failed += deadlineWatchdogRedispatch("watchdog re-dispatch, deadline");
+	failed += hungBeforeRange("range behind a timed out load");
+	failed += watchdogRunsInFlight("watchdog with runs in flight");
+	return failed;
+}
@@ -0,0 +1,211 @@
+//============================================================================
+// Name        : test_graph.cpp
+// Description : dependency order of run(Mode::Graph) for chains, fan-out/fan-in and random graphs, rejected cyclic dependencies
+//               and a device that fails in the middle of a graph
+//               g++ -std=c++14 -O2 -pthread test_graph.cpp -o test_graph && ./test_graph
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+// dependencies of each grain (only earlier grains)
+typedef std::vector<std::vector<size_t>> Graph;
+
+// a grain is done after its sync, it must not start (input) before all of its dependencies are done
+class Observer
+{
+public:
+	Observer(const Graph & graphPrm):graph(graphPrm),done(graphPrm.size()),computed(graphPrm.size()),early(-1),failAfter(-1),calls(0){ reset(); }
+
+	void reset(){ for(auto & d:done) d=0; for(auto & c:computed) c=0; early=-1; }
+
+	void input(size_t j)
+	{
+		for(const size_t d:graph[j])
+		{
+			if(!done[d])
+				early=(int)j;
+		}
+	}
+
+	void compute(const DeviceState & gpu, size_t j)
+	{
+		// device-1 throws once, after failAfter grains of it are computed
+		if(gpu.gpuId==1 && failAfter>=0 && calls++==failAfter)
+			throw std::runtime_error("device-1 failed");
+		computed[j]++;
+	}
+
+	void sync(size_t j){ done[j]=1; }
+
+	// description of first violation, empty if none
+	std::string verify()
+	{
+		std::ostringstream out;
+		if(early>=0)
+			out<<"grain "<<early<<" started before a dependency was done";
+		for(size_t j=0;j<done.size() && out.str().empty();j++)
+		{
+			if(!done[j] || computed[j]!=1)
+				out<<"grain "<<j<<" computed "<<computed[j]<<" times";
+		}
+		return out.str();
+	}
+
+	const Graph & graph;
+	std::vector<std::atomic<int>> done;
+	std::vector<std::atomic<int>> computed;
+	std::atomic<int> early;
+	int failAfter;
+	std::atomic<int> calls;
+};
+
+void addGraph(LoadBalancerX<DeviceState,GrainState> & lb, Observer & observer)
+{
+	for(size_t j=0;j<observer.graph.size();j++)
+	{
+		lb.addWork(GrainOfWork<DeviceState,GrainState>(
+				[](DeviceState, GrainState&){ },
+				[&observer,j](DeviceState, GrainState&){ observer.input(j); },
+				[&observer,j](DeviceState gpu, GrainState&){
+					observer.compute(gpu, j);
+					std::this_thread::sleep_for(std::chrono::microseconds(30+(j*7)%50));
+				},
+				[](DeviceState, GrainState&){ },
+				[&observer,j](DeviceState, GrainState&){ observer.sync(j); }),
+				observer.graph[j]);
+	}
+}
+
+Graph chain(size_t n)
+{
+	Graph graph(n);
+	for(size_t j=1;j<n;j++)
+		graph[j].push_back(j-1);
+	return graph;
+}
+
+// layers of width grains, each grain depends on all grains of previous layer
+Graph layers(size_t numLayers, size_t width)
+{
+	Graph graph(numLayers*width);
+	for(size_t l=1;l<numLayers;l++)
+		for(size_t k=0;k<width;k++)
+			for(size_t d=0;d<width;d++)
+				graph[l*width+k].push_back((l-1)*width+d);
+	return graph;
+}
+
+// each grain depends on up to 3 random earlier grains (same graph for same seed)
+Graph randomGraph(size_t n, uint64_t seed)
+{
+	Graph graph(n);
+	for(size_t j=1;j<n;j++)
+	{
+		seed = seed*6364136223846793005ull+1442695040888963407ull;
+		const size_t numDeps = (seed>>33)%4;
+		for(size_t k=0;k<numDeps;k++)
+		{
+			seed = seed*6364136223846793005ull+1442695040888963407ull;
+			const size_t d = (seed>>33)%j;
+			if(std::find(graph[j].begin(),graph[j].end(),d)==graph[j].end())
+				graph[j].push_back(d);
+		}
+	}
+	return graph;
+}
+
+int check(const std::string & name, const std::string & violation)
+{
+	std::cout<<(violation.empty()?"ok   ":"FAIL ")<<name<<(violation.empty()?"":": "+violation)<<std::endl;
+	return violation.empty()?0:1;
+}
+
+int order(const std::string & name, const Graph & graph)
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Observer observer(graph);
+	addGraph(lb, observer);
+	for(int i=0;i<3;i++)
+		lb.addDevice(ComputeDevice<DeviceState>({i}));
+	std::string violation;
+	for(int r=0;r<4 && violation.empty();r++)
+	{
+		observer.reset();
+		lb.run(Mode::Graph, r%2==1);
+		violation = observer.verify();
+	}
+	return check(name, violation);
+}
+
+// dependencies on the grain itself or on later grains would make a cycle, such grains are not added
+int cycles()
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	GrainOfWork<DeviceState,GrainState> work(GrainState({0}));
+	std::string violation;
+	if(lb.addWork(work, {})!=0 || lb.addWork(work, {0})!=1)
+		violation = "valid dependency rejected";
+	else if(lb.addWork(work, {2})!=(size_t)-1 || lb.addWork(work, {1,5})!=(size_t)-1)
+		violation = "dependency on itself or a later grain accepted";
+	else if(lb.addWork(work, {1})!=2)
+		violation = "rejected grain was added";
+	return check("cyclic dependencies rejected", violation);
+}
+
+// grains of device-1 are dispatched again after it throws, order still holds
+int failingDevice()
+{
+	const Graph graph = randomGraph(300, 7);
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Observer observer(graph);
+	observer.failAfter = 20;
+	addGraph(lb, observer);
+	for(int i=0;i<3;i++)
+		lb.addDevice(ComputeDevice<DeviceState>({i}));
+	lb.run(Mode::Graph);
+	std::string violation = observer.verify();
+	std::vector<RunError> errors = lb.getRunErrors();
+	if(violation.empty() && (errors.size()!=1 || errors[0].device!=1 || !errors[0].recovered))
+		violation = "failure of device-1 is not reported as recovered";
+
+	// device-1 is back after its probe grain succeeds
+	for(int r=0;r<3 && violation.empty();r++)
+	{
+		observer.reset();
+		lb.run(Mode::Graph);
+		violation = observer.verify();
+	}
+	if(violation.empty() && lb.isDeviceQuarantined(1))
+		violation = "device-1 still quarantined";
+	return check("device fails in the middle of a graph", violation);
+}
+
+int main() {
+	int failed = 0;
+	failed += order("chain", chain(100));
+	failed += order("fan-out and fan-in layers", layers(10, 12));
+	for(uint64_t seed=1;seed<=5;seed++)
+		failed += order("random graph "+std::to_string(seed), randomGraph(500, seed));
+	failed += cycles();
+	failed += failingDevice();
+	return failed;
+}
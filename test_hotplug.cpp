@@ -0,0 +1,172 @@
+//============================================================================
+// Name        : test_hotplug.cpp
+// Description : addDevice and removeDevice between runs, during runAsync and with single grains (runSingleAsync) in flight
+//               g++ -std=c++14 -O2 -pthread test_hotplug.cpp -o test_hotplug && ./test_hotplug
+//               prints one line per case, exit code is number of failed cases (a deadlock fails after 60 seconds)
+//============================================================================
+
+#include <iostream>
+#include <cstdlib>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+const int grains = 200;
+const int maxDevices = 3;
+
+// counts computations of each grain and grains computed by each device
+class Counters
+{
+public:
+	Counters():computed(grains),perDevice(maxDevices){ reset(); }
+	std::vector<std::atomic<int>> computed;
+	std::vector<std::atomic<int>> perDevice;
+
+	void reset(){ for(auto & c:computed) c=0; for(auto & c:perDevice) c=0; }
+	bool exactlyOnce(){ for(auto & c:computed) if(c!=1) return false; return true; }
+};
+
+GrainOfWork<DeviceState,GrainState> countingGrain(Counters & counters, int i)
+{
+	return GrainOfWork<DeviceState,GrainState>(
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ },
+			[&counters,i](DeviceState gpu, GrainState&){
+				std::this_thread::sleep_for(std::chrono::microseconds(20));
+				if(i>=0)
+					counters.computed[i]++;
+				counters.perDevice[gpu.gpuId]++;
+			},
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ });
+}
+
+int check(const char * name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+// device threads are still at their start barrier when addDevice is called
+int addWithSingleInFlight()
+{
+	bool ok = true;
+	for(int iteration=0;iteration<20 && ok;iteration++)
+	{
+		LoadBalancerX<DeviceState,GrainState> lb;
+		Counters counters;
+		for(int i=0;i<grains;i++)
+			lb.addWork(countingGrain(counters, i));
+		lb.addDevice(ComputeDevice<DeviceState>({0}));
+		const size_t id = lb.runSingleAsync(countingGrain(counters, -1));
+		const size_t added = lb.addDevice(ComputeDevice<DeviceState>({1}));
+		lb.syncSingle(id);
+		lb.run();
+		ok = added==1 && counters.exactlyOnce() && counters.perDevice[1]>0;
+	}
+	return check("addDevice with single grain in flight", ok);
+}
+
+int removeWithSingleInFlight()
+{
+	bool ok = true;
+	for(int iteration=0;iteration<20 && ok;iteration++)
+	{
+		LoadBalancerX<DeviceState,GrainState> lb;
+		Counters counters;
+		for(int i=0;i<grains;i++)
+			lb.addWork(countingGrain(counters, i));
+		lb.addDevice(ComputeDevice<DeviceState>({0}));
+		lb.addDevice(ComputeDevice<DeviceState>({1}));
+		const size_t id = lb.runSingleAsync(countingGrain(counters, -1));
+		const bool removed = lb.removeDevice(0);
+
+		// response of a removed device's single grain can still be taken
+		lb.syncSingle(id);
+		counters.perDevice[0]=0;
+		lb.run();
+		ok = removed && counters.exactlyOnce() && counters.perDevice[0]==0 && counters.perDevice[1]==grains;
+	}
+	return check("removeDevice with single grain in flight", ok);
+}
+
+int hotplugBetweenRuns()
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Counters counters;
+	for(int i=0;i<grains;i++)
+		lb.addWork(countingGrain(counters, i));
+	lb.addDevice(ComputeDevice<DeviceState>({0}));
+	lb.addDevice(ComputeDevice<DeviceState>({1}));
+	bool ok = true;
+	for(int r=0;r<5;r++)
+	{
+		counters.reset();
+		lb.run();
+		ok = ok && counters.exactlyOnce();
+	}
+
+	lb.addDevice(ComputeDevice<DeviceState>({2}));
+	counters.reset();
+	lb.run();
+	ok = ok && counters.exactlyOnce() && counters.perDevice[2]>0;
+
+	lb.removeDevice(1);
+	for(int r=0;r<3;r++)
+	{
+		counters.reset();
+		lb.run();
+		ok = ok && counters.exactlyOnce() && counters.perDevice[1]==0;
+	}
+	std::vector<double> performances = lb.getRelativePerformancesOfDevices();
+	ok = ok && performances.size()==3 && performances[1]==0.0 && !lb.removeDevice(1);
+	return check("add and remove between runs", ok);
+}
+
+// addDevice and removeDevice wait for runs in flight
+int hotplugDuringRunAsync()
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Counters counters;
+	for(int i=0;i<grains;i++)
+		lb.addWork(countingGrain(counters, i));
+	lb.addDevice(ComputeDevice<DeviceState>({0}));
+	lb.addDevice(ComputeDevice<DeviceState>({1}));
+	std::future<RunResult> first = lb.runAsync();
+	lb.addDevice(ComputeDevice<DeviceState>({2}));
+	bool ok = first.wait_for(std::chrono::seconds(0))==std::future_status::ready && counters.exactlyOnce();
+	counters.reset();
+	std::future<RunResult> second = lb.runAsync();
+	lb.removeDevice(0);
+	ok = ok && second.wait_for(std::chrono::seconds(0))==std::future_status::ready && counters.exactlyOnce();
+	return check("add and remove during runAsync", ok);
+}
+
+int main() {
+	std::thread deadlock([](){
+		std::this_thread::sleep_for(std::chrono::seconds(60));
+		std::cout<<"FAIL deadlock"<<std::endl;
+		std::_Exit(1);
+	});
+	deadlock.detach();
+
+	int failed = 0;
+	failed += addWithSingleInFlight();
+	failed += removeWithSingleInFlight();
+	failed += hotplugBetweenRuns();
+	failed += hotplugDuringRunAsync();
+	return failed;
+}
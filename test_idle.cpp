@@ -0,0 +1,87 @@
+//============================================================================
+// Name        : test_idle.cpp
+// Description : cpu time used by an idle balancer (before first run, between runs) and by a host blocked on full device queues
+//               g++ -std=c++14 -O2 -pthread test_idle.cpp -o test_idle && ./test_idle
+//               prints cpu time of each phase as percentage of one core, exit code is number of phases over their limit
+//============================================================================
+
+#include <iostream>
+#include <ctime>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+// process cpu time of a phase as percentage of its wall time (100 = one busy core)
+template<typename Phase>
+double cpuPercent(const Phase & phase)
+{
+	const std::clock_t c0 = std::clock();
+	const auto t0 = std::chrono::steady_clock::now();
+	phase();
+	const double cpuNs = (std::clock()-c0)*(1000000000.0/CLOCKS_PER_SEC);
+	return 100.0*cpuNs/std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-t0).count();
+}
+
+int check(const char * name, double percent, double limit)
+{
+	const bool ok = percent<=limit;
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<": "<<percent<<"% cpu (limit "<<limit<<"%)"<<std::endl;
+	return ok?0:1;
+}
+
+int main() {
+	int failed = 0;
+
+	GrainOfWork<DeviceState,GrainState> sleeper(
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ std::this_thread::sleep_for(std::chrono::milliseconds(1)); },
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ });
+
+	{
+		LoadBalancerX<DeviceState,GrainState> lb;
+		for(int i=0;i<64;i++)
+			lb.addWork(sleeper);
+
+		// 8 devices wait at start barrier (one is created lazily, one is pinned to core 0)
+		for(int i=0;i<8;i++)
+		{
+			DeviceOptions options;
+			options.lazyStart = (i==6);
+			options.cpuCore = (i==7) ? 0 : -1;
+			lb.addDevice(ComputeDevice<DeviceState>({i}), options);
+		}
+		failed += check("8 devices before first run", cpuPercent([]{ std::this_thread::sleep_for(std::chrono::milliseconds(500)); }), 5.0);
+
+		lb.run();
+		failed += check("8 devices between runs", cpuPercent([]{ std::this_thread::sleep_for(std::chrono::milliseconds(500)); }), 5.0);
+	}
+
+	// host waits for a free load slot while a slow device computes
+	{
+		LoadBalancerX<DeviceState,GrainState> lb;
+		lb.addDevice(ComputeDevice<DeviceState>({0}));
+		std::vector<size_t> ids;
+		failed += check("runSingleAsync on full queue", cpuPercent([&]{
+			for(int i=0;i<300;i++)
+				ids.push_back(lb.runSingleAsync(sleeper));
+			for(const size_t id:ids)
+				lb.syncSingle(id);
+		}), 10.0);
+	}
+	return failed;
+}
@@ -0,0 +1,146 @@
+//============================================================================
+// Name        : test_importance.cpp
+// Description : run(budget) with setImportanceOrder: devices compute their grains in order of importance, completed grains
+//               are the most important ones, a different order completes different grains, attempted grains follow the budget
+//               g++ -std=c++14 -O2 -pthread test_importance.cpp -o test_importance && ./test_importance
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <algorithm>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	size_t index;
+};
+
+const size_t grains = 2000;
+const int devices = 2;
+const size_t grainNs = 100000; // 0.1 ms per grain, a 4 ms budget attempts a few dozen of grains
+
+// grains computed by each device in order of their compute calls, each vector written only by its device thread
+std::vector<std::vector<size_t>> computedBy(devices);
+
+void spin(size_t ns)
+{
+	const size_t end = nowNanoseconds()+ns;
+	while(nowNanoseconds()<end){ }
+}
+
+// position of each grain in order of importance (order has every grain once)
+std::vector<size_t> ranks(const std::vector<size_t> & order)
+{
+	std::vector<size_t> rank(grains);
+	for(size_t k=0;k<order.size();k++)
+		rank[order[k]]=k;
+	return rank;
+}
+
+// every device computed its grains in order of importance, result lists only grains of first result.attempted ranks in order
+bool followsOrder(const DeadlineResult & result, const std::vector<size_t> & order)
+{
+	const std::vector<size_t> rank = ranks(order);
+	for(const std::vector<size_t> & computed:computedBy)
+	{
+		for(size_t k=1;k<computed.size();k++)
+		{
+			if(rank[computed[k-1]]>=rank[computed[k]])
+				return false;
+		}
+	}
+	for(size_t k=0;k<result.completed.size();k++)
+	{
+		if(rank[result.completed[k]]>=result.attempted || (k>0 && rank[result.completed[k-1]]>=rank[result.completed[k]]))
+			return false;
+	}
+	return !result.completed.empty();
+}
+
+DeadlineResult runBudget(LoadBalancerX<DeviceState,GrainState> & lb, std::chrono::nanoseconds budget)
+{
+	for(std::vector<size_t> & computed:computedBy)
+		computed.clear();
+	return lb.run(budget);
+}
+
+int check(const std::string & name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+int main() {
+	int failed = 0;
+
+	LoadBalancerX<DeviceState,GrainState> lb;
+	GrainOfWork<DeviceState,GrainState> work;
+	work.workCompute = [](DeviceState gpu, GrainState & g){ spin(grainNs); computedBy[gpu.gpuId].push_back(g.index); };
+	lb.addWorkBulk(grains, work, [](size_t j){ return GrainState({j}); });
+	for(int i=0;i<devices;i++)
+		lb.addDevice(ComputeDevice<DeviceState>({i}));
+
+	const std::chrono::milliseconds budget(4);
+
+	// default order is order of index: lowest indices are completed
+	std::vector<size_t> order(grains);
+	for(size_t j=0;j<grains;j++)
+		order[j]=j;
+	for(int r=0;r<5;r++)
+		runBudget(lb, budget);
+	DeadlineResult result = runBudget(lb, budget);
+	failed += check("index order: devices follow order, completed grains are most important ("+std::to_string(result.completed.size())+")",
+					followsOrder(result, order) && result.attempted<grains/2);
+
+	// reversed order: highest indices are dispatched first, none of previously completed grains are computed
+	std::reverse(order.begin(),order.end());
+	lb.setImportanceOrder(order);
+	result = runBudget(lb, budget);
+	failed += check("reversed order: devices follow order, only high indices completed",
+					followsOrder(result, order) && *std::min_element(result.completed.begin(),result.completed.end())>=grains/2);
+
+	// partial order: listed grains first (in listed order), then rest in order of index
+	const std::vector<size_t> listed = {1500, 7, 1999, 300, 42};
+	lb.setImportanceOrder(listed);
+	order = listed;
+	for(size_t j=0;j<grains;j++)
+	{
+		if(std::find(listed.begin(),listed.end(),j)==listed.end())
+			order.push_back(j);
+	}
+	result = runBudget(lb, budget);
+	bool listedFirst = result.completed.size()>listed.size();
+	for(size_t k=0;k<listed.size() && listedFirst;k++)
+		listedFirst = result.completed[k]==listed[k];
+	failed += check("partial order: listed grains completed first, then order of index", followsOrder(result, order) && listedFirst);
+
+	// attempted grains follow budget: 3x budget attempts about 3x grains after a few runs
+	// (summed over runs after learning: a preempted device thread makes one short run attempt few grains)
+	size_t attemptedShort = 0;
+	for(int r=0;r<8;r++)
+	{
+		const size_t attempted = runBudget(lb, budget).attempted;
+		if(r>=3)
+			attemptedShort += attempted;
+	}
+	size_t attemptedLong = 0;
+	for(int r=0;r<8;r++)
+	{
+		const size_t attempted = runBudget(lb, 3*budget).attempted;
+		if(r>=3)
+			attemptedLong += attempted;
+	}
+	failed += check("attempted grains follow budget ("+std::to_string(attemptedShort)+" -> "+std::to_string(attemptedLong)+")",
+					2*attemptedLong>=3*attemptedShort && attemptedLong<=6*attemptedShort);
+	return failed;
+}
@@ -0,0 +1,159 @@
+//============================================================================
+// Name        : test_pipeline_order.cpp
+// Description : order of stage calls for every pipeline shape (inputLead, outputLag, syncWindow) and grain count
+//               g++ -std=c++14 -O2 -pthread test_pipeline_order.cpp -o test_pipeline_order && ./test_pipeline_order
+//               prints number of checked shapes, exit code 1 if any order is wrong
+//============================================================================
+
+#include <iostream>
+#include <sstream>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int unused;
+};
+
+// (stage, grain) of each call in device thread
+typedef std::vector<std::pair<int,int>> Log;
+
+// schedule documented in PipelineOptions:
+// pipelined: in step t sync(t-window) input(t) compute(t-inputLead) output(t-inputLead-outputLag), remaining syncs at end
+// not pipelined: blocks of window grains, each block runs input, compute, output, sync of all its grains
+Log expectedSchedule(const PipelineOptions & p, int n, bool pipelined)
+{
+	Log log;
+	const int window = (int)p.window(n);
+	if(!pipelined)
+	{
+		for(int first=0;first<n;first+=window)
+		{
+			const int last = std::min(n,first+window);
+			for(int stage:{(int)Stage::Input,(int)Stage::Compute,(int)Stage::Output,(int)Stage::Sync})
+				for(int k=first;k<last;k++)
+					log.push_back(std::make_pair(stage,k));
+		}
+		return log;
+	}
+	const int computeDelay = (int)p.inputLead;
+	const int outputDelay = (int)(p.inputLead+p.outputLag);
+	int synced = 0;
+	for(int t=0;t<n+outputDelay;t++)
+	{
+		if(t<n && t>=window)
+			log.push_back(std::make_pair((int)Stage::Sync,synced++));
+		if(t<n)
+			log.push_back(std::make_pair((int)Stage::Input,t));
+		if(t>=computeDelay && t-computeDelay<n)
+			log.push_back(std::make_pair((int)Stage::Compute,t-computeDelay));
+		if(t>=outputDelay && t-outputDelay<n)
+			log.push_back(std::make_pair((int)Stage::Output,t-outputDelay));
+	}
+	for(int k=synced;k<n;k++)
+		log.push_back(std::make_pair((int)Stage::Sync,k));
+	return log;
+}
+
+// properties that hold for any pipeline shape, returns description of first violation (empty if none)
+std::string checkOrder(const Log & log, const PipelineOptions & p, int n, bool pipelined)
+{
+	std::vector<int> next(n,(int)Stage::Input); // next stage expected for each grain
+	std::vector<int> position(numStages*n,-1);
+	int inFlight = 0;
+	const int window = (int)p.window(n);
+	for(size_t e=0;e<log.size();e++)
+	{
+		const int stage = log[e].first;
+		const int j = log[e].second;
+		std::ostringstream where;
+		where<<"call "<<e<<" (stage "<<stage<<" grain "<<j<<")";
+		if(j<0 || j>=n)
+			return where.str()+": grain out of range";
+		if(stage!=next[j])
+			return where.str()+": stage out of order for grain";
+		position[stage*n+j]=(int)e;
+		next[j]++;
+		if(stage==(int)Stage::Input && ++inFlight>window)
+			return where.str()+": more grains in flight than window";
+		if(stage==(int)Stage::Sync)
+			inFlight--;
+		// each stage visits grains in increasing order
+		if(j>0 && position[stage*n+j-1]<0)
+			return where.str()+": grain before this one did not run this stage";
+	}
+	for(int j=0;j<n;j++)
+	{
+		if(next[j]!=numStages)
+			return "grain "+std::to_string(j)+" did not run all stages";
+	}
+	if(pipelined)
+	{
+		// input runs inputLead grains ahead of compute, output runs outputLag grains behind compute
+		for(int j=0;j<n;j++)
+		{
+			const int ahead = std::min(n-1,j+(int)p.inputLead);
+			if(position[(int)Stage::Input*n+ahead]>position[(int)Stage::Compute*n+j])
+				return "compute of grain "+std::to_string(j)+" runs before input of grain "+std::to_string(ahead);
+			const int behind = std::min(n-1,j+(int)p.outputLag);
+			if(position[(int)Stage::Compute*n+behind]>position[(int)Stage::Output*n+j])
+				return "output of grain "+std::to_string(j)+" runs before compute of grain "+std::to_string(behind);
+		}
+	}
+	return "";
+}
+
+int main() {
+	int checked = 0;
+	int failed = 0;
+	for(size_t inputLead=0;inputLead<=3;inputLead++)
+	for(size_t outputLag=0;outputLag<=3;outputLag++)
+	for(size_t syncWindow:{0,1,2,3,5,8})
+	for(int n:{1,2,3,4,7,16})
+	for(bool pipelined:{true,false})
+	{
+		PipelineOptions pipeline(inputLead,outputLag,syncWindow);
+		Log log;
+		LoadBalancerX<DeviceState,GrainState> lb;
+		for(int j=0;j<n;j++)
+		{
+			lb.addWork(GrainOfWork<DeviceState,GrainState>(
+					[](DeviceState, GrainState&){ },
+					[&log,j](DeviceState, GrainState&){ log.push_back(std::make_pair((int)Stage::Input,j)); },
+					[&log,j](DeviceState, GrainState&){ log.push_back(std::make_pair((int)Stage::Compute,j)); },
+					[&log,j](DeviceState, GrainState&){ log.push_back(std::make_pair((int)Stage::Output,j)); },
+					[&log,j](DeviceState, GrainState&){ log.push_back(std::make_pair((int)Stage::Sync,j)); }));
+		}
+		DeviceOptions options;
+		options.pipeline = pipeline;
+		lb.addDevice(ComputeDevice<DeviceState>({0}),options);
+
+		// second run checks order after grains are initialized
+		for(int r=0;r<2;r++)
+		{
+			log.clear();
+			lb.run(pipelined);
+			std::string error = checkOrder(log, pipeline, n, pipelined);
+			if(error.empty() && log!=expectedSchedule(pipeline, n, pipelined))
+				error = "order differs from documented schedule";
+			checked++;
+			if(!error.empty())
+			{
+				failed++;
+				std::cout<<"FAIL inputLead="<<inputLead<<" outputLag="<<outputLag<<" syncWindow="<<syncWindow<<" grains="<<n
+						 <<(pipelined?" pipelined":" not pipelined")<<" run "<<r<<": "<<error<<std::endl;
+			}
+		}
+	}
+	std::cout<<(failed==0?"ok ":"FAIL ")<<checked-failed<<"/"<<checked<<" pipeline shapes in order"<<std::endl;
+	return failed==0?0:1;
+}
@@ -0,0 +1,174 @@
+//============================================================================
+// Name        : test_policies.cpp
+// Description : each balancing policy balances busy time of devices with 1x, 2.5x, 5x grain times within a few runs,
+//               and balances again when policy is changed between runs or while runAsync runs are in flight
+//               g++ -std=c++14 -O2 -pthread test_policies.cpp -o test_policies && ./test_policies
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <atomic>
+#include <algorithm>
+#include <deque>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+const int grains = 400;
+const int devices = 3;
+const int grainUs[devices] = {100, 250, 500};
+
+// busy time of each device in latest run, written by device threads
+std::atomic<size_t> busyNs[devices];
+
+// balancer with sleeping grains, busy time of each grain is added to its device
+void addAll(LoadBalancerX<DeviceState,GrainState> & lb)
+{
+	for(int j=0;j<grains;j++)
+	{
+		GrainOfWork<DeviceState,GrainState> grain;
+		grain.workCompute = [](DeviceState gpu, GrainState &){
+			const auto t0 = std::chrono::steady_clock::now();
+			std::this_thread::sleep_for(std::chrono::microseconds(grainUs[gpu.gpuId]));
+			busyNs[gpu.gpuId] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-t0).count();
+		};
+		lb.addWork(grain);
+	}
+	for(int i=0;i<devices;i++)
+		lb.addDevice(ComputeDevice<DeviceState>({i}));
+}
+
+// busy time of slowest device over busy time of fastest device in one run
+double imbalance(LoadBalancerX<DeviceState,GrainState> & lb)
+{
+	for(int i=0;i<devices;i++)
+		busyNs[i] = 0;
+	lb.run();
+	size_t low = busyNs[0];
+	size_t high = busyNs[0];
+	for(int i=1;i<devices;i++)
+	{
+		low = std::min(low,busyNs[i].load());
+		high = std::max(high,busyNs[i].load());
+	}
+	return high/(double)std::max((size_t)1,low);
+}
+
+// busy time of slowest device over busy time of fastest device in a run of runAsync
+double imbalance(const RunResult & result)
+{
+	const size_t low = *std::min_element(result.nsDev.begin(),result.nsDev.end());
+	const size_t high = *std::max_element(result.nsDev.begin(),result.nsDev.end());
+	return high/(double)std::max((size_t)1,low);
+}
+
+// first run after which every run of runs is balanced (-1: not balanced at end)
+int convergence(const std::vector<double> & imbalances)
+{
+	int converged = -1;
+	for(int r=(int)imbalances.size()-1; r>=0 && imbalances[r]<=1.3; r--)
+		converged = r;
+	return converged;
+}
+
+int check(const std::string & name, bool ok, const std::vector<double> & imbalances)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<" (converged in "<<convergence(imbalances)<<" runs, last imbalance "<<imbalances.back()<<")"<<std::endl;
+	return ok?0:1;
+}
+
+// runs a case (imbalance of each of its runs) once more if it does not converge within limit runs
+// busy time is measured by sleeping grains: on a loaded machine wakeups of device threads are delayed unevenly for a while
+template<typename Case>
+int checkConverges(const std::string & name, int limit, Case runCase)
+{
+	std::vector<double> imbalances = runCase();
+	if(convergence(imbalances)<0 || convergence(imbalances)>limit)
+		imbalances = runCase();
+	const int converged = convergence(imbalances);
+	return check(name, converged>=0 && converged<=limit, imbalances);
+}
+
+int main() {
+	int failed = 0;
+	const int runs = 14;
+
+	// every policy reaches a split that gives devices equal busy time and keeps it, linear fit solves it from first measurements
+	const std::vector<std::pair<std::string,std::function<std::shared_ptr<BalancingPolicy>()>>> policies = {
+			std::make_pair("moving-average", [](){ return std::make_shared<MovingAveragePolicy>(); }),
+			std::make_pair("ewma", [](){ return std::make_shared<EwmaPolicy>(); }),
+			std::make_pair("linear-fit", [](){ return std::make_shared<LinearFitPolicy>(); })
+	};
+	for(const auto & policy:policies)
+	{
+		const int limit = (policy.first=="linear-fit") ? 4 : 8;
+		failed += checkConverges(policy.first, limit, [&](){
+			LoadBalancerX<DeviceState,GrainState> lb;
+			addAll(lb);
+			lb.setBalancingPolicy(policy.second());
+			std::vector<double> imbalances;
+			for(int r=0;r<runs;r++)
+				imbalances.push_back(imbalance(lb));
+			return imbalances;
+		});
+	}
+
+	// policy changed every 4 runs: shares still converge with the latest policy
+	failed += checkConverges("moving-average -> ewma -> linear-fit between runs", 10, [&](){
+		LoadBalancerX<DeviceState,GrainState> lb;
+		addAll(lb);
+		std::vector<double> imbalances;
+		for(int r=0;r<runs;r++)
+		{
+			if(r==4)
+				lb.setBalancingPolicy(std::make_shared<EwmaPolicy>());
+			if(r==8)
+				lb.setBalancingPolicy(std::make_shared<LinearFitPolicy>());
+			imbalances.push_back(imbalance(lb));
+		}
+		return imbalances;
+	});
+
+	// policy changed every 4 runs while two runs of runAsync are in flight (collector thread stores their measurements meanwhile)
+	// measurements reach the policy two runs later than with run()
+	failed += checkConverges("moving-average -> ewma -> linear-fit with runs in flight", 12, [&](){
+		LoadBalancerX<DeviceState,GrainState> lb;
+		addAll(lb);
+		std::vector<double> imbalances;
+		std::deque<std::future<RunResult>> futures;
+		const int asyncRuns = runs+4;
+		for(int r=0;r<asyncRuns;r++)
+		{
+			if(r==4)
+				lb.setBalancingPolicy(std::make_shared<EwmaPolicy>());
+			if(r==8)
+				lb.setBalancingPolicy(std::make_shared<LinearFitPolicy>());
+			futures.push_back(lb.runAsync());
+			if(futures.size()>2)
+			{
+				imbalances.push_back(imbalance(futures.front().get()));
+				futures.pop_front();
+			}
+		}
+		while(!futures.empty())
+		{
+			imbalances.push_back(imbalance(futures.front().get()));
+			futures.pop_front();
+		}
+		return imbalances;
+	});
+	return failed;
+}
@@ -0,0 +1,163 @@
+//============================================================================
+// Name        : test_profile.cpp
+// Description : saveProfile/loadProfile round trip, mismatched devices and malformed files
+//               g++ -std=c++14 -O2 -pthread test_profile.cpp -o test_profile && ./test_profile
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <cmath>
+#include <unistd.h>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int grainUs; // time of one grain on this device
+	std::atomic<size_t> * busyNs; // busy time of this device in latest run
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+const int grains = 300;
+
+// balancer with a device per grain time (microseconds), named by identities
+class TimedBalancer
+{
+public:
+	TimedBalancer(const std::vector<int> & grainUs, const std::vector<std::string> & identities):busyNs(grainUs.size())
+	{
+		for(int j=0;j<grains;j++)
+		{
+			GrainOfWork<DeviceState,GrainState> grain;
+			grain.workCompute = [](DeviceState device, GrainState &){
+				const auto t0 = std::chrono::steady_clock::now();
+				std::this_thread::sleep_for(std::chrono::microseconds(device.grainUs));
+				*device.busyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-t0).count();
+			};
+			lb.addWork(grain);
+		}
+		for(size_t i=0;i<grainUs.size();i++)
+		{
+			busyNs[i] = 0;
+			lb.addDevice(ComputeDevice<DeviceState>({grainUs[i],&busyNs[i]},identities[i]));
+		}
+	}
+
+	void run(size_t runs)
+	{
+		for(size_t r=0;r<runs;r++)
+		{
+			for(auto & busy:busyNs)
+				busy = 0;
+			lb.run();
+		}
+	}
+
+	LoadBalancerX<DeviceState,GrainState> lb;
+	std::vector<std::atomic<size_t>> busyNs;
+};
+
+bool near(const std::vector<double> & percentages, const std::vector<double> & expected)
+{
+	if(percentages.size()!=expected.size())
+		return false;
+	for(size_t i=0;i<expected.size();i++)
+	{
+		if(std::fabs(percentages[i]-expected[i])>0.5)
+			return false;
+	}
+	return true;
+}
+
+void writeFile(const std::string & path, const std::string & text)
+{
+	std::ofstream file(path);
+	file<<text;
+}
+
+int check(const char * name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+int main() {
+	int failed = 0;
+	const std::string path = "/tmp/loadbalancerx_test_profile_"+std::to_string(getpid());
+	const std::string badPath = path+"_bad";
+
+	// device 0 is 3x faster than device 1
+	TimedBalancer learned({100, 300}, {"dev-0", "dev-1"});
+	learned.run(10);
+	const std::vector<double> shares = learned.lb.getRelativePerformancesOfDevices();
+	failed += check("learned split favors faster device", shares[0]>2.0*shares[1]);
+	failed += check("saveProfile", learned.lb.saveProfile(path));
+
+	// same identities: learned split is restored before first run, first run is balanced
+	{
+		TimedBalancer fresh({100, 300}, {"dev-0", "dev-1"});
+		const bool loaded = fresh.lb.loadProfile(path);
+		const bool restored = near(fresh.lb.getRelativePerformancesOfDevices(), shares);
+		fresh.run(1);
+		const double ratio = fresh.busyNs[0]/(double)fresh.busyNs[1];
+		failed += check("round trip restores performances, first run balanced", loaded && restored && ratio>0.75 && ratio<1.33);
+	}
+
+	// no saved identity matches: profile is rejected and nothing changes
+	{
+		TimedBalancer other({100, 300}, {"other-0", "other-1"});
+		const std::vector<double> before = other.lb.getRelativePerformancesOfDevices();
+		const bool loaded = other.lb.loadProfile(path);
+		failed += check("mismatched identities rejected", !loaded && near(other.lb.getRelativePerformancesOfDevices(), before));
+	}
+
+	// more devices than saved: matched devices keep their ratio, new device gets their average throughput
+	{
+		TimedBalancer more({100, 300, 200}, {"dev-0", "dev-1", "new"});
+		const bool loaded = more.lb.loadProfile(path);
+		failed += check("extra device gets average throughput", loaded && near(more.lb.getRelativePerformancesOfDevices(),
+																				{shares[0]/1.5, shares[1]/1.5, 100.0/3.0}));
+	}
+
+	// fewer devices than saved: saved devices that are not present are ignored
+	{
+		TimedBalancer fewer({300}, {"dev-1"});
+		const bool loaded = fewer.lb.loadProfile(path);
+		failed += check("missing saved device ignored", loaded && near(fewer.lb.getRelativePerformancesOfDevices(), {100.0}));
+	}
+
+	// malformed files return false without changing loaded performances
+	{
+		TimedBalancer target({100, 300}, {"dev-0", "dev-1"});
+		bool ok = target.lb.loadProfile(path);
+		const std::vector<std::string> bad = {
+				"LoadBalancerX-profile 2 2\n0.75 3000 3000000 dev-0\n0.25 1000 3000000 dev-1\n",	// unknown version
+				"OtherBalancer-profile 1 2\n0.75 3000 3000000 dev-0\n0.25 1000 3000000 dev-1\n",	// unknown format
+				"LoadBalancerX-profile 1 3\n0.5 1000 1000000 dev-0\n0.5 1000 1000000 dev-1\n",		// fewer lines than header says
+				"LoadBalancerX-profile 1 2\n0.5 x 1000000 dev-0\n0.5 1000 1000000 dev-1\n",			// not a number
+				"LoadBalancerX-profile\n",
+				""
+		};
+		for(const std::string & text:bad)
+		{
+			writeFile(badPath, text);
+			ok = ok && !target.lb.loadProfile(badPath);
+		}
+		ok = ok && !target.lb.loadProfile(badPath+"_missing");
+		failed += check("malformed profiles rejected, state unchanged", ok && near(target.lb.getRelativePerformancesOfDevices(), shares));
+	}
+
+	::unlink(path.c_str());
+	::unlink(badPath.c_str());
+	return failed;
+}
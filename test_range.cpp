@@ -0,0 +1,144 @@
+//============================================================================
+// Name        : test_range.cpp
+// Description : index spaces of addRange: every item computed exactly once across devices (also after a failing chunk),
+//               chunk sizes grow while per-chunk overhead dominates and stay small when item time dominates
+//               g++ -std=c++14 -O2 -pthread test_range.cpp -o test_range && ./test_range
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <stdexcept>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+// counts computations of each item of a range and chunk sizes of the latest run
+class Items
+{
+public:
+	Items(size_t n):computed(n),largestChunk(0){ reset(); }
+	std::vector<std::atomic<int>> computed;
+	std::atomic<size_t> largestChunk;
+	std::atomic<size_t> perDevice[2];
+
+	void reset(){ for(auto & c:computed) c=0; largestChunk=0; perDevice[0]=0; perDevice[1]=0; }
+	bool exactly(int n){ for(auto & c:computed) if(c!=n) return false; return true; }
+	void add(int device, size_t first, size_t last)
+	{
+		for(size_t k=first;k<last;k++)
+			computed[k]++;
+		perDevice[device]+=last-first;
+		size_t largest = largestChunk.load();
+		while(last-first>largest && !largestChunk.compare_exchange_weak(largest,last-first)){ }
+	}
+};
+
+void spin(size_t ns)
+{
+	const size_t end = nowNanoseconds()+ns;
+	while(nowNanoseconds()<end){ }
+}
+
+int check(const char * name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+// items of two ranges are shared by two devices, together with grains
+int exactlyOnce()
+{
+	const size_t n = 200000;
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Items a(n), b(1000);
+	lb.addWorkBulk(64, GrainOfWork<DeviceState,GrainState>(
+			[](DeviceState, GrainState&){ }, [](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ spin(20000); },
+			[](DeviceState, GrainState&){ }, [](DeviceState, GrainState&){ }));
+	lb.addRange(n, [&a](DeviceState gpu, size_t first, size_t last){ a.add(gpu.gpuId, first, last); });
+	lb.addRange(1000, [&b](DeviceState gpu, size_t first, size_t last){ b.add(gpu.gpuId, first, last); spin(1000*(last-first)); });
+	lb.addDevice(ComputeDevice<DeviceState>({0}));
+	lb.addDevice(ComputeDevice<DeviceState>({1}));
+	const int runs = 5;
+	for(int r=0;r<runs;r++)
+	{
+		lb.run();
+	}
+	lb.runAsync().get();
+	return check("every item exactly once per run", a.exactly(runs+1) && b.exactly(runs+1) && b.perDevice[0]>0 && b.perDevice[1]>0);
+}
+
+// first chunk of device-1 throws before computing its items, chunk is computed by device-0 in same run
+int failingChunk()
+{
+	const size_t n = 5000;
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Items items(n);
+	std::atomic<bool> armed(true);
+	lb.addRange(n, [&](DeviceState gpu, size_t first, size_t last){
+		bool expected = true;
+		if(gpu.gpuId==1 && armed.compare_exchange_strong(expected,false))
+			throw std::runtime_error("device-1 failed");
+		items.add(gpu.gpuId, first, last);
+		spin(2000*(last-first));
+	});
+	lb.addDevice(ComputeDevice<DeviceState>({0}));
+	lb.addDevice(ComputeDevice<DeviceState>({1}));
+	lb.run();
+	std::vector<RunError> errors = lb.getRunErrors();
+	bool ok = items.exactly(1) && !armed && errors.size()==1 && errors[0].device==1 && errors[0].grain<n && errors[0].recovered;
+
+	// next runs compute every item once again
+	items.reset();
+	lb.run();
+	lb.run();
+	return check("failed chunk computed again by another device", ok && items.exactly(2));
+}
+
+// largest chunk of last run, chunks are timed with a fixed per-call overhead or a per-item time
+size_t learnedChunk(size_t callNs, size_t itemNs)
+{
+	const size_t n = 20000;
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Items items(n);
+	lb.addRange(n, [&](DeviceState gpu, size_t first, size_t last){
+		items.add(gpu.gpuId, first, last);
+		spin(callNs+itemNs*(last-first));
+	});
+	lb.addDevice(ComputeDevice<DeviceState>({0}));
+	for(int r=0;r<10;r++)
+	{
+		items.reset();
+		lb.run();
+	}
+	return items.exactly(1) ? items.largestChunk.load() : 0;
+}
+
+int chunkAdaptation()
+{
+	const size_t overheadBound = learnedChunk(50000, 10);
+	const size_t itemBound = learnedChunk(0, 5000);
+	std::cout<<"      learned chunk: "<<overheadBound<<" items (per-call overhead), "<<itemBound<<" items (per-item time)"<<std::endl;
+	return check("chunk size adapts to overhead", overheadBound>=256 && itemBound>0 && itemBound<=16);
+}
+
+int main() {
+	int failed = 0;
+	failed += exactlyOnce();
+	failed += failingChunk();
+	failed += chunkAdaptation();
+	return failed;
+}
@@ -0,0 +1,227 @@
+//============================================================================
+// Name        : test_remote.cpp
+// Description : remote device transport over unix sockets (worker and host in same process)
+//               g++ -std=c++14 -O2 -pthread test_remote.cpp -o test_remote && ./test_remote
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "LoadBalancerXRemote.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int id;
+	std::shared_ptr<RemoteConnection> remote;
+};
+
+class WorkerState
+{
+public:
+	int id;
+};
+
+class GrainState
+{
+public:
+	int unused;
+};
+
+const int grains = 200;
+
+// file descriptors of this process
+int openFiles()
+{
+	int count = 0;
+	DIR * dir = ::opendir("/proc/self/fd");
+	while(dir && ::readdir(dir))
+		count++;
+	if(dir)
+		::closedir(dir);
+	return count;
+}
+
+int check(const char * name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+// doubles input of grains on one local device and one remote device, returns number of wrong outputs
+// sign: -1 gives negative inputs (rejected by worker kernel of main)
+int runDoubling(const std::string & address, int runs, bool pipelined, std::vector<RunError> & errors, int sign = 1)
+{
+	std::vector<int> input(grains), output(grains,0);
+	for(int i=0;i<grains;i++)
+		input[i]=sign*i;
+
+	LoadBalancerX<DeviceState,GrainState> lb;
+	for(int i=0;i<grains;i++)
+	{
+		lb.addWork(makeRemoteGrain<DeviceState,GrainState>(i,
+				[&input,i](GrainState&){ return std::make_pair((const void *)&input[i],sizeof(int)); },
+				[&output,i](GrainState&){ return std::make_pair((void *)&output[i],sizeof(int)); },
+				[&input,&output,i](DeviceState, GrainState&){ output[i]=2*input[i]; }));
+	}
+	std::shared_ptr<RemoteConnection> connection = std::make_shared<RemoteConnection>();
+	if(!connection->connect(address))
+		return grains;
+	lb.addDevice(ComputeDevice<DeviceState>({0,nullptr}));
+	lb.addDevice(ComputeDevice<DeviceState>({1,connection}));
+
+	int wrong = 0;
+	for(int r=0;r<runs;r++)
+	{
+		std::fill(output.begin(),output.end(),0);
+		lb.run(pipelined);
+		std::vector<RunError> current = lb.getRunErrors();
+		errors.insert(errors.end(),current.begin(),current.end());
+		for(int i=0;i<grains;i++)
+			wrong += (output[i]!=2*input[i]);
+	}
+	return wrong;
+}
+
+int main() {
+	int failed = 0;
+	const std::string workerAddress = "unix:/tmp/loadbalancerx_test_worker_"+std::to_string(getpid());
+	const std::string fakeAddress = "unix:/tmp/loadbalancerx_test_fake_"+std::to_string(getpid());
+
+	auto doubling = [](WorkerState, size_t, const std::vector<char> & in, std::vector<char> & out){
+		int value;
+		std::memcpy(&value,in.data(),sizeof(int));
+		if(value<0)
+			throw std::runtime_error("negative input");
+		value*=2;
+		out.resize(sizeof(int));
+		std::memcpy(out.data(),&value,sizeof(int));
+	};
+	RemoteWorker<WorkerState> worker(doubling);
+	worker.addDevice(ComputeDevice<WorkerState>({0}));
+	worker.setMaxPayload(1<<16);
+	if(!worker.start(workerAddress))
+		return 1;
+
+	// worker drops a connection whose message is larger than its limit (instead of allocating it) and keeps serving others
+	{
+		RemoteSocket client;
+		bool dropped = false;
+		if(client.open(workerAddress,false))
+		{
+			RemoteHeader header;
+			std::memset(&header,0,sizeof(header));
+			header.type=(uint32_t)RemoteMessage::Compute;
+			header.bytes=((uint64_t)1)<<62;
+			RemoteHeader reply;
+			dropped = client.sendAll(&header,sizeof(header)) && !client.receiveAll(&reply,sizeof(reply));
+		}
+		failed += check("worker drops oversized message", dropped);
+	}
+
+	// worker closes sockets and joins threads of ended connections (a short-lived connection per grain does not leak)
+	{
+		auto connectAndClose = [&]{
+			RemoteSocket client;
+			RemoteHeader header;
+			std::memset(&header,0,sizeof(header));
+			header.type=(uint32_t)RemoteMessage::Echo;
+			RemoteHeader reply;
+			return client.open(workerAddress,false) && client.sendAll(&header,sizeof(header)) && client.receiveAll(&reply,sizeof(reply));
+		};
+		bool ok = connectAndClose();
+		const int before = openFiles();
+		for(int i=0;i<100 && ok;i++)
+			ok = connectAndClose();
+		failed += check("worker reaps ended connections", ok && openFiles()<=before+3);
+	}
+
+	// results of remote device are same as local device
+	{
+		std::vector<RunError> errors;
+		failed += check("remote device, non-pipelined", runDoubling(workerAddress, 5, false, errors)==0 && errors.empty());
+		failed += check("remote device, pipelined", runDoubling(workerAddress, 5, true, errors)==0 && errors.empty());
+	}
+
+	// two hosts share the devices of a worker, failures of one host's grains are reported only to that host
+	{
+		std::vector<RunError> errorsGood, errorsFailing;
+		int wrongGood = 0;
+		std::thread good([&]{ wrongGood = runDoubling(workerAddress, 5, true, errorsGood); });
+		const int wrongFailing = runDoubling(workerAddress, 5, true, errorsFailing, -1);
+		good.join();
+		bool failuresRecovered = !errorsFailing.empty();
+		for(const RunError & error:errorsFailing)
+			failuresRecovered = failuresRecovered && error.device==1 && error.recovered;
+		failed += check("two hosts, failures reported to their own host", wrongGood==0 && errorsGood.empty() && wrongFailing==0 && failuresRecovered);
+	}
+
+	// round-trip time and bandwidth of link, pipeline depth covers a round trip of short grains
+	{
+		RemoteConnection connection;
+		bool ok = connection.connect(workerAddress) && connection.measureLink(1<<15);
+		const size_t rtt = connection.getRoundTripTime();
+		const double bandwidth = connection.getBandwidth();
+		const PipelineOptions shortGrains = connection.suggestedPipeline(2*sizeof(int), 1);
+		const PipelineOptions longGrains = connection.suggestedPipeline(2*sizeof(int), 100*rtt);
+		const size_t expected = 1+(size_t)std::ceil((rtt+2*sizeof(int)/bandwidth)/std::max(1.0,2*sizeof(int)/bandwidth));
+		ok = ok && rtt>0 && bandwidth>0.0;
+		ok = ok && shortGrains.syncWindow==std::max((size_t)3,expected) && shortGrains.syncWindow>3;
+		ok = ok && longGrains.syncWindow==3 && longGrains.inputLead==1 && longGrains.outputLag==1;
+		failed += check("link measurement and suggested pipeline", ok);
+	}
+
+	// a grain that throws in worker is reported to host instead of being waited for forever, grains of remote device are computed by local device
+	{
+		const std::string failingAddress = "unix:/tmp/loadbalancerx_test_failing_"+std::to_string(getpid());
+		RemoteWorker<WorkerState> failingWorker([&](WorkerState state, size_t grain, const std::vector<char> & in, std::vector<char> & out){
+			if(grain==grains-1)
+				throw std::runtime_error("last grain failed in worker");
+			doubling(state, grain, in, out);
+		});
+		failingWorker.addDevice(ComputeDevice<WorkerState>({0}));
+		std::vector<RunError> errors;
+		const int wrong = failingWorker.start(failingAddress) ? runDoubling(failingAddress, 1, false, errors) : grains;
+		failed += check("grain fails in worker, grains recovered", wrong==0 && errors.size()==1 && errors[0].device==1 && errors[0].recovered);
+		failingWorker.stop();
+		::unlink(failingAddress.substr(5).c_str());
+	}
+
+	// host drops a connection whose result is larger than its limit, grains of remote device are computed by local device
+	{
+		RemoteSocket fake;
+		if(!fake.open(fakeAddress,true))
+			return failed+1;
+		std::thread fakeWorker([&]{
+			std::shared_ptr<RemoteSocket> connection = fake.accept();
+			RemoteHeader header;
+			std::vector<char> payload;
+			while(connection && connection->receiveAll(&header,sizeof(header)) && receivePayload(*connection, header, 1<<16, payload))
+			{
+				if(header.type==(uint32_t)RemoteMessage::Compute)
+				{
+					RemoteHeader reply;
+					std::memset(&reply,0,sizeof(reply));
+					reply.type=(uint32_t)RemoteMessage::Result;
+					reply.grain=header.grain;
+					reply.bytes=((uint64_t)1)<<62;
+					connection->sendAll(&reply,sizeof(reply));
+				}
+			}
+		});
+		std::vector<RunError> errors;
+		const int wrong = runDoubling(fakeAddress, 1, false, errors);
+		failed += check("host drops oversized result, grains recovered", wrong==0 && errors.size()==1 && errors[0].device==1 && errors[0].recovered);
+		fake.shutdown();
+		fakeWorker.join();
+	}
+
+	worker.stop();
+	::unlink(workerAddress.substr(5).c_str());
+	::unlink(fakeAddress.substr(5).c_str());
+	return failed;
+}
@@ -0,0 +1,111 @@
+//============================================================================
+// Name        : test_sim.cpp
+// Description : convergence runs and makespan regret of each balancing policy on simulated devices (virtual clock, deterministic)
+//               g++ -std=c++14 -O2 -pthread test_sim.cpp -o test_sim && ./test_sim
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+
+#include "LoadBalancerXSim.h"
+
+using namespace LoadBalanceLib;
+
+class PolicyReports
+{
+public:
+	SimReport movingAverage;
+	SimReport ewma;
+	SimReport linearFit;
+};
+
+PolicyReports simulateAll(const SimScenario & s)
+{
+	PolicyReports reports;
+	reports.movingAverage = simulate(s, std::make_shared<MovingAveragePolicy>(), "moving-average");
+	reports.ewma = simulate(s, std::make_shared<EwmaPolicy>(), "ewma");
+	reports.linearFit = simulate(s, std::make_shared<LinearFitPolicy>(), "linear-fit");
+	return reports;
+}
+
+// makespan regret: sum over runs of makespan above optimum, in units of optimum makespan
+double regret(const SimReport & report)
+{
+	double sum = 0.0;
+	for(const double ratio:report.ratios)
+		sum += ratio-1.0;
+	return sum;
+}
+
+bool converges(const SimReport & report, long maxRuns)
+{
+	return report.convergenceRuns>=0 && report.convergenceRuns<=maxRuns && report.finalRatio<=1.01;
+}
+
+int check(const std::string & name, bool ok, const PolicyReports & reports)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name
+			 <<" (converge "<<reports.movingAverage.convergenceRuns<<"/"<<reports.ewma.convergenceRuns<<"/"<<reports.linearFit.convergenceRuns
+			 <<", regret "<<regret(reports.movingAverage)<<"/"<<regret(reports.ewma)<<"/"<<regret(reports.linearFit)<<")"<<std::endl;
+	return ok?0:1;
+}
+
+int main() {
+	int failed = 0;
+
+	// equal devices start balanced
+	{
+		SimScenario s;
+		s.name = "uniform-4";
+		s.devices = std::vector<SimDeviceModel>(4, SimDeviceModel(1000.0));
+		const PolicyReports r = simulateAll(s);
+		failed += check(s.name, converges(r.movingAverage,0) && converges(r.ewma,0) && converges(r.linearFit,0) &&
+								regret(r.movingAverage)<0.01 && regret(r.ewma)<0.01 && regret(r.linearFit)<0.01, r);
+	}
+
+	// 1x, 2.5x, 5x slower devices: linear fit solves the split from first measurement, averages approach it over their window
+	{
+		SimScenario s;
+		s.name = "heterogeneous-3";
+		s.devices = { SimDeviceModel(1000.0), SimDeviceModel(2500.0), SimDeviceModel(5000.0) };
+		const PolicyReports r = simulateAll(s);
+		failed += check(s.name, converges(r.movingAverage,6) && converges(r.ewma,8) && converges(r.linearFit,2) &&
+								regret(r.linearFit)<=regret(r.ewma) && regret(r.linearFit)<=regret(r.movingAverage), r);
+	}
+
+	// fixed launch cost of fast device makes its throughput depend on its grain count
+	{
+		SimScenario s;
+		s.name = "launch-overhead";
+		s.devices = { SimDeviceModel(200.0, 2000000), SimDeviceModel(1000.0, 10000), SimDeviceModel(1000.0, 10000) };
+		const PolicyReports r = simulateAll(s);
+		failed += check(s.name, converges(r.movingAverage,8) && converges(r.ewma,8) && converges(r.linearFit,5) &&
+								regret(r.linearFit)<=regret(r.movingAverage), r);
+	}
+
+	// fastest device becomes 3x slower in run 15, every policy adapts
+	{
+		SimScenario s;
+		s.name = "throttle-step";
+		s.devices = { SimDeviceModel(1000.0), SimDeviceModel(2000.0), SimDeviceModel(2000.0) };
+		s.devices[0].throttleRun = 15;
+		s.devices[0].throttleFactor = 3.0;
+		const PolicyReports r = simulateAll(s);
+		const bool recovered = r.movingAverage.eventRecoveryRuns>=0 && r.movingAverage.eventRecoveryRuns<=7 &&
+							   r.ewma.eventRecoveryRuns>=0 && r.ewma.eventRecoveryRuns<=7 &&
+							   r.linearFit.eventRecoveryRuns>=0 && r.linearFit.eventRecoveryRuns<=7;
+		failed += check(s.name, recovered && converges(r.movingAverage,6) && converges(r.ewma,8) && converges(r.linearFit,2), r);
+	}
+
+	// same scenario gives same makespans
+	{
+		SimScenario s;
+		s.name = "noisy";
+		s.devices = { SimDeviceModel(1000.0, 0, 0.2), SimDeviceModel(2000.0, 0, 0.2), SimDeviceModel(3000.0, 0, 0.2) };
+		const PolicyReports r = simulateAll(s);
+		const PolicyReports again = simulateAll(s);
+		failed += check("noisy, deterministic", r.movingAverage.ratios==again.movingAverage.ratios && r.ewma.ratios==again.ewma.ratios &&
+												r.linearFit.ratios==again.linearFit.ratios, r);
+	}
+	return failed;
+}
@@ -0,0 +1,173 @@
+//============================================================================
+// Name        : test_single_backlog.cpp
+// Description : runSingleAsync without syncSingle for thousands of grains, then more grains than a device can hold unsynced while another thread syncs
+//               g++ -std=c++14 -O2 -pthread test_single_backlog.cpp -o test_single_backlog && ./test_single_backlog
+//               then runs and failing single grains of another thread on the same device (each must take only its own responses)
+//               then more runAsync calls than a load queue holds while a single grain stalls the device
+//               prints "ok 3000 20000 500 200" (device thread must not block on responses or on its own load queue while host waits for a free load slot)
+//============================================================================
+
+#include <iostream>
+#include <cstdlib>
+
+#include "LoadBalancerX.h"
+
+int main() {
+
+	class DeviceState
+	{
+	public:
+		int gpuId;
+	};
+
+	class GrainState
+	{
+	public:
+		int value;
+	};
+
+	const int grains = 3000;
+	LoadBalanceLib::LoadBalancerX<DeviceState, GrainState> lb;
+	lb.addDevice(LoadBalanceLib::ComputeDevice<DeviceState>({0}));
+
+	std::atomic<int> computed(0);
+	LoadBalanceLib::GrainOfWork<DeviceState, GrainState> grain(
+			[&](DeviceState, GrainState&){ },
+			[&](DeviceState, GrainState&){ },
+			[&](DeviceState, GrainState&){ computed++; },
+			[&](DeviceState, GrainState&){ },
+			[&](DeviceState, GrainState&){ }
+	);
+
+	std::vector<size_t> ids(grains);
+	for(int i=0;i<grains;i++)
+	{
+		ids[i]=lb.runSingleAsync(grain);
+	}
+	for(int i=0;i<grains;i++)
+	{
+		lb.syncSingle(ids[i]);
+	}
+
+	if(computed.load()!=grains)
+	{
+		std::cout<<"Error: "<<computed.load()<<" grains computed"<<std::endl;
+		return 1;
+	}
+
+	// runSingleAsync waits for syncSingle of the other thread when device has too many unsynced grains
+	const int backlog = 20000;
+	computed=0;
+	std::thread syncer([&](){
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		for(int i=0;i<backlog;i++)
+		{
+			lb.syncSingle(0);
+		}
+	});
+	for(int i=0;i<backlog;i++)
+	{
+		lb.runSingleAsync(grain);
+	}
+	syncer.join();
+	if(computed.load()!=backlog)
+	{
+		std::cout<<"Error: "<<computed.load()<<" grains computed with a syncing thread"<<std::endl;
+		return 1;
+	}
+
+	// single grains share the response queue with runs (first run has ticket 0), errors of single grains must not reach runs
+	const int failing = 500;
+	LoadBalanceLib::LoadBalancerX<DeviceState, GrainState> lbShared;
+	lbShared.addDevice(LoadBalanceLib::ComputeDevice<DeviceState>({0}));
+	for(int i=0;i<100;i++)
+	{
+		lbShared.addWork(grain);
+	}
+	LoadBalanceLib::GrainOfWork<DeviceState, GrainState> thrower(
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ throw std::runtime_error("single grain"); },
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ }
+	);
+	std::atomic<int> singleErrors(0);
+	std::thread singles([&](){
+		for(int i=0;i<failing;i++)
+		{
+			std::exception_ptr error;
+			lbShared.syncSingle(lbShared.runSingleAsync(thrower), error);
+			if(error)
+				singleErrors++;
+		}
+	});
+	size_t runErrors = 0;
+	for(int i=0;i<50;i++)
+	{
+		lbShared.run();
+		runErrors += lbShared.getRunErrors().size();
+	}
+	singles.join();
+	if(singleErrors.load()!=failing || runErrors!=0)
+	{
+		std::cout<<"Error: "<<singleErrors.load()<<" failed single grains, "<<runErrors<<" run errors"<<std::endl;
+		return 1;
+	}
+	// runs fill load queue of a device that is stalled by a single grain, host waits for a free slot while holding mutRun
+	// self-sync of the single grain must not need a slot in that queue
+	const int queuedRuns = 200;
+	computed=0;
+	std::atomic<bool> released(false);
+	std::atomic<bool> finished(false);
+	LoadBalanceLib::LoadBalancerX<DeviceState, GrainState> lbFull;
+	lbFull.addDevice(LoadBalanceLib::ComputeDevice<DeviceState>({0}));
+	for(int i=0;i<10;i++)
+	{
+		lbFull.addWork(grain);
+	}
+	LoadBalanceLib::GrainOfWork<DeviceState, GrainState> staller(
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ },
+			[&](DeviceState, GrainState&){ while(!released) std::this_thread::sleep_for(std::chrono::milliseconds(1)); },
+			[](DeviceState, GrainState&){ },
+			[](DeviceState, GrainState&){ }
+	);
+	const size_t stalled = lbFull.runSingleAsync(staller);
+	std::thread releaser([&](){
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		released=true;
+	});
+	std::thread runner([&](){
+		std::vector<std::future<LoadBalanceLib::RunResult>> futures;
+		for(int i=0;i<queuedRuns;i++)
+		{
+			futures.push_back(lbFull.runAsync());
+		}
+		for(auto & f:futures)
+		{
+			f.get();
+		}
+		lbFull.syncSingle(stalled);
+		finished=true;
+	});
+
+	// a deadlocked device cannot be joined
+	for(int i=0;i<10000 && !finished;i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if(!finished)
+	{
+		std::cout<<"Error: runs and self-sync of a stalled single grain deadlocked ("<<computed.load()<<" grains of runs computed)"<<std::endl;
+		std::_Exit(1);
+	}
+	releaser.join();
+	runner.join();
+	if(computed.load()!=queuedRuns*10)
+	{
+		std::cout<<"Error: "<<computed.load()<<" grains computed by queued runs"<<std::endl;
+		return 1;
+	}
+	std::cout<<"ok "<<grains<<" "<<backlog<<" "<<singleErrors.load()<<" "<<queuedRuns<<std::endl;
+	return 0;
+}
@@ -0,0 +1,134 @@
+//============================================================================
+// Name        : test_stats.cpp
+// Description : per-device statistics (EnableStats=true) after known runs and single grains, and resetDeviceStats
+//               g++ -std=c++14 -O2 -pthread test_stats.cpp -o test_stats && ./test_stats
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+const int grains = 200;
+const int devices = 2;
+
+// stage calls seen by each device
+class Counters
+{
+public:
+	Counters():inits(devices),computes(devices),syncs(devices){ for(int i=0;i<devices;i++){ inits[i]=0; computes[i]=0; syncs[i]=0; } }
+	std::vector<std::atomic<size_t>> inits;
+	std::vector<std::atomic<size_t>> computes;
+	std::vector<std::atomic<size_t>> syncs;
+};
+
+class GrainState
+{
+public:
+	Counters * counters;
+	int sleepUs;
+};
+
+GrainOfWork<DeviceState,GrainState> countingGrain(Counters & counters, int sleepUs)
+{
+	GrainOfWork<DeviceState,GrainState> grain;
+	grain.workInit = [](DeviceState gpu, GrainState& thisGrain){ thisGrain.counters->inits[gpu.gpuId]++; };
+	grain.workCompute = [](DeviceState gpu, GrainState& thisGrain){
+		if(thisGrain.sleepUs>0)
+			std::this_thread::sleep_for(std::chrono::microseconds(thisGrain.sleepUs));
+		thisGrain.counters->computes[gpu.gpuId]++;
+	};
+	grain.workSync = [](DeviceState gpu, GrainState& thisGrain){ thisGrain.counters->syncs[gpu.gpuId]++; };
+	grain.refGrainState().counters = &counters;
+	grain.refGrainState().sleepUs = sleepUs;
+	return grain;
+}
+
+int check(const char * name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+bool allZero(const std::vector<DeviceStatsSnapshot> & stats)
+{
+	for(const DeviceStatsSnapshot & s:stats)
+	{
+		for(int j=0;j<numStages;j++)
+		{
+			if(s.stage[j].calls!=0 || s.stage[j].totalNs!=0 || s.stage[j].maxNs!=0)
+				return false;
+		}
+		if(s.grains!=0 || s.initCalls!=0 || s.idleNs!=0 || s.queueHighWater!=0)
+			return false;
+	}
+	return true;
+}
+
+int main() {
+	int failed = 0;
+
+	// two runs with an idle gap: every stage call of a device is counted once, grains are counted by their sync
+	{
+		LoadBalancerX<DeviceState,GrainState,true> lb;
+		Counters counters;
+		for(int i=0;i<grains;i++)
+			lb.addWork(countingGrain(counters, 0));
+		for(int i=0;i<devices;i++)
+			lb.addDevice(ComputeDevice<DeviceState>({i}));
+
+		lb.run();
+		std::this_thread::sleep_for(std::chrono::milliseconds(30));
+		lb.run();
+
+		const std::vector<DeviceStatsSnapshot> stats = lb.getDeviceStats();
+		bool ok = stats.size()==devices;
+		size_t totalGrains = 0;
+		for(int i=0;i<devices && ok;i++)
+		{
+			const DeviceStatsSnapshot & s = stats[i];
+			ok = s.stage[(int)Stage::Compute].calls==counters.computes[i] && s.stage[(int)Stage::Input].calls==counters.computes[i] &&
+				 s.stage[(int)Stage::Output].calls==counters.computes[i] && s.stage[(int)Stage::Sync].calls==counters.syncs[i] &&
+				 s.initCalls==counters.inits[i] && s.stage[(int)Stage::Init].calls==counters.inits[i] &&
+				 s.grains==counters.syncs[i] && s.idleNs>=25000000 && s.queueHighWater<=1;
+			totalGrains += s.grains;
+		}
+		failed += check("stage calls, grains and idle time of two runs", ok && totalGrains==2*grains);
+
+		lb.resetDeviceStats();
+		failed += check("resetDeviceStats zeroes all statistics", allZero(lb.getDeviceStats()));
+
+		lb.run();
+		const std::vector<DeviceStatsSnapshot> after = lb.getDeviceStats();
+		failed += check("statistics after reset count only later run", after[0].grains+after[1].grains==grains &&
+																		after[0].initCalls+after[1].initCalls<=(size_t)grains);
+	}
+
+	// single grains queued behind a slow grain raise queue high water mark of their device
+	{
+		LoadBalancerX<DeviceState,GrainState,true> lb;
+		Counters counters;
+		lb.addDevice(ComputeDevice<DeviceState>({0}));
+		const int singles = 20;
+		std::vector<size_t> ids;
+		ids.push_back(lb.runSingleAsync(countingGrain(counters, 50000)));
+		for(int i=1;i<singles;i++)
+			ids.push_back(lb.runSingleAsync(countingGrain(counters, 0)));
+		for(const size_t id:ids)
+			lb.syncSingle(id);
+
+		const std::vector<DeviceStatsSnapshot> stats = lb.getDeviceStats();
+		failed += check("queue high water and grains of single grains", stats.size()==1 && stats[0].grains==(size_t)singles &&
+						stats[0].stage[(int)Stage::Compute].calls==(size_t)singles && stats[0].initCalls==(size_t)singles &&
+						stats[0].queueHighWater>=singles/2 && stats[0].queueHighWater<=2*singles);
+	}
+	return failed;
+}
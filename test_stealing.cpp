@@ -0,0 +1,126 @@
+//============================================================================
+// Name        : test_stealing.cpp
+// Description : Mode::WorkStealing with a stalled device and with a slow device: its range is stolen by the others,
+//               every grain is computed once per run, learned performances follow grains actually computed by each device
+//               g++ -std=c++14 -O2 -pthread test_stealing.cpp -o test_stealing && ./test_stealing
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <cmath>
+#include <atomic>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	size_t index;
+};
+
+const size_t grains = 600;
+const int devices = 3;
+
+// time of one grain on each device in microseconds
+std::atomic<int> grainUs[devices];
+
+// first grain computed by device 2 blocks it for this long (0: no stall)
+std::atomic<int> stallMs;
+
+// computations of each grain and grains computed by each device in latest run
+std::vector<std::atomic<int>> computed(grains);
+std::atomic<size_t> perDevice[devices];
+
+void reset()
+{
+	for(auto & c:computed)
+		c=0;
+	for(int i=0;i<devices;i++)
+		perDevice[i]=0;
+}
+
+bool exactlyOnce()
+{
+	for(auto & c:computed)
+	{
+		if(c!=1)
+			return false;
+	}
+	return true;
+}
+
+int check(const std::string & name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+int main() {
+	int failed = 0;
+
+	LoadBalancerX<DeviceState,GrainState> lb;
+	for(size_t j=0;j<grains;j++)
+	{
+		GrainOfWork<DeviceState,GrainState> grain;
+		grain.workCompute = [](DeviceState gpu, GrainState & g){
+			int stall = (gpu.gpuId==2) ? stallMs.exchange(0) : 0;
+			if(stall>0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(stall));
+			std::this_thread::sleep_for(std::chrono::microseconds(grainUs[gpu.gpuId]));
+			computed[g.index]++;
+			perDevice[gpu.gpuId]++;
+		};
+		grain.refGrainState().index = j;
+		lb.addWork(grain);
+	}
+	for(int i=0;i<devices;i++)
+	{
+		grainUs[i] = 100;
+		lb.addDevice(ComputeDevice<DeviceState>({i}));
+	}
+
+	// first run splits grains equally, device 2 stalls on its first grain for longer than the others need for all grains
+	stallMs = 200;
+	reset();
+	lb.run(Mode::WorkStealing);
+	failed += check("stalled device: every grain computed once", exactlyOnce());
+	failed += check("stalled device: its range is stolen ("+std::to_string(perDevice[2])+" of "+std::to_string(grains/devices)+" left to it)",
+					perDevice[2]<grains/devices/5 && perDevice[0]+perDevice[1]+perDevice[2]==grains);
+
+	// device 2 is 4x slower: it computes fewest grains, learned shares follow grains computed by each device
+	// (measurements of a run are learned at start of next run, shares are averages of latest 5 runs)
+	grainUs[2] = 400;
+	bool allOnce = true;
+	std::vector<double> shares(devices,0.0);
+	const int runs = 15;
+	for(int r=0;r<runs;r++)
+	{
+		reset();
+		lb.run(Mode::WorkStealing);
+		allOnce = allOnce && exactlyOnce();
+		for(int i=0; r>=runs-6 && r<runs-1 && i<devices; i++)
+			shares[i] += perDevice[i]*100.0/grains/5;
+	}
+	failed += check("slow device: every grain computed once in every run", allOnce);
+
+	const std::vector<double> performances = lb.getRelativePerformancesOfDevices();
+	double total = 0.0;
+	bool follows = true;
+	for(int i=0;i<devices;i++)
+	{
+		total += performances[i];
+		follows = follows && std::fabs(performances[i]-shares[i])<5.0;
+	}
+	failed += check("slow device: learned shares follow computed grains ("+std::to_string(performances[0])+" "+std::to_string(performances[1])+" "+
+					std::to_string(performances[2])+")", follows && std::fabs(total-100.0)<0.01 &&
+					performances[2]<performances[0]/2 && performances[2]<performances[1]/2);
+	return failed;
+}
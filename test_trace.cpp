@@ -0,0 +1,263 @@
+//============================================================================
+// Name        : test_trace.cpp
+// Description : Chrome trace of a pipelined run is valid json with one event per stage per grain on the device that computed it,
+//               trace ring keeps every event of concurrent writers while it is not full
+//               g++ -std=c++14 -O2 -pthread test_trace.cpp -o test_trace && ./test_trace
+//               prints one line per case, exit code is number of failed cases
+//============================================================================
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <map>
+#include <set>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	std::atomic<int> * device; // device that computed grain
+};
+
+const int grains = 300;
+const int devices = 3;
+
+// minimal json reader: objects, arrays, strings (without escapes), numbers, true/false/null
+class JsonValue
+{
+public:
+	JsonValue():type('b'),number(0.0){ }
+	char type; // 'o', 'a', 's', 'n', 'b' (true/false/null)
+	std::map<std::string,JsonValue> members;
+	std::vector<JsonValue> items;
+	std::string text;
+	double number;
+};
+
+class JsonReader
+{
+public:
+	JsonReader(const std::string & textPrm):text(textPrm),pos(0){ }
+
+	// returns false if text is not a single json value
+	bool read(JsonValue & value)
+	{
+		return parse(value) && (skip(), pos==text.size());
+	}
+private:
+	void skip()
+	{
+		while(pos<text.size() && std::isspace((unsigned char)text[pos]))
+			pos++;
+	}
+
+	bool expect(char c)
+	{
+		skip();
+		if(pos<text.size() && text[pos]==c)
+		{
+			pos++;
+			return true;
+		}
+		return false;
+	}
+
+	bool parseString(std::string & s)
+	{
+		if(!expect('"'))
+			return false;
+		const size_t end = text.find('"',pos);
+		if(end==std::string::npos)
+			return false;
+		s = text.substr(pos,end-pos);
+		pos = end+1;
+		return s.find('\\')==std::string::npos;
+	}
+
+	bool parse(JsonValue & value)
+	{
+		skip();
+		if(pos>=text.size())
+			return false;
+		const char c = text[pos];
+		if(c=='{')
+		{
+			value.type='o';
+			pos++;
+			if(expect('}'))
+				return true;
+			do
+			{
+				std::string key;
+				if(!parseString(key) || !expect(':') || !parse(value.members[key]))
+					return false;
+			} while(expect(','));
+			return expect('}');
+		}
+		if(c=='[')
+		{
+			value.type='a';
+			pos++;
+			if(expect(']'))
+				return true;
+			do
+			{
+				value.items.push_back(JsonValue());
+				if(!parse(value.items.back()))
+					return false;
+			} while(expect(','));
+			return expect(']');
+		}
+		if(c=='"')
+		{
+			value.type='s';
+			return parseString(value.text);
+		}
+		for(const char * word:{"true","false","null"})
+		{
+			if(text.compare(pos,std::strlen(word),word)==0)
+			{
+				value.type='b';
+				pos+=std::strlen(word);
+				return true;
+			}
+		}
+		value.type='n';
+		const char * begin = text.c_str()+pos;
+		char * end = nullptr;
+		value.number = std::strtod(begin,&end);
+		if(end==begin)
+			return false;
+		pos += end-begin;
+		return true;
+	}
+
+	const std::string & text;
+	size_t pos;
+};
+
+int check(const char * name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+int main() {
+	int failed = 0;
+
+	// every stage of every grain of a pipelined run is a complete event on thread of its device
+	{
+		std::vector<std::atomic<int>> computedBy(grains);
+		LoadBalancerX<DeviceState,GrainState> lb;
+		for(int i=0;i<grains;i++)
+		{
+			computedBy[i]=-1;
+			GrainOfWork<DeviceState,GrainState> grain;
+			grain.workInit = [](DeviceState, GrainState&){ };
+			grain.workInput = [](DeviceState, GrainState&){ };
+			grain.workCompute = [](DeviceState gpu, GrainState& thisGrain){ thisGrain.device->store(gpu.gpuId); };
+			grain.workOutput = [](DeviceState, GrainState&){ };
+			grain.workSync = [](DeviceState, GrainState&){ };
+			grain.refGrainState().device = &computedBy[i];
+			lb.addWork(grain);
+		}
+		for(int i=0;i<devices;i++)
+			lb.addDevice(ComputeDevice<DeviceState>({i}));
+
+		lb.enableTracing(10000);
+		lb.run(true);
+		lb.disableTracing();
+
+		std::stringstream trace;
+		lb.writeChromeTrace(trace);
+		const std::string text = trace.str();
+		JsonValue root;
+		const bool valid = JsonReader(text).read(root) && root.type=='o' && root.members.count("traceEvents") && root.members["traceEvents"].type=='a';
+		failed += check("trace is valid json", valid);
+
+		// (grain, stage) -> tids of its events
+		std::map<std::pair<int,std::string>,std::vector<int>> stages;
+		size_t runEvents = 0;
+		size_t threadNames = 0;
+		bool fieldsOk = valid;
+		if(valid)
+		{
+			for(JsonValue & e:root.members["traceEvents"].items)
+			{
+				const std::string ph = e.members["ph"].text;
+				if(ph=="M")
+				{
+					threadNames++;
+				}
+				else if(ph=="X" && e.members["cat"].text=="grain")
+				{
+					fieldsOk = fieldsOk && e.members["ts"].type=='n' && e.members["dur"].type=='n' && e.members["dur"].number>=0.0 &&
+							   e.members["args"].members["run"].type=='n';
+					stages[std::make_pair((int)e.members["args"].members["grain"].number, e.members["name"].text)].push_back((int)e.members["tid"].number);
+				}
+				else if(ph=="X" && e.members["name"].text=="run")
+				{
+					runEvents++;
+				}
+			}
+		}
+
+		bool oneEventPerStage = valid && stages.size()==(size_t)grains*numStages;
+		for(int i=0;i<grains && oneEventPerStage;i++)
+		{
+			for(int s=0;s<numStages && oneEventPerStage;s++)
+			{
+				const std::vector<int> & tids = stages[std::make_pair(i,std::string(stageName((Stage)s)))];
+				oneEventPerStage = tids.size()==1 && tids[0]==computedBy[i].load();
+			}
+		}
+		failed += check("one event per stage per grain on its device thread", fieldsOk && oneEventPerStage);
+		failed += check("thread names and run event", threadNames==devices+1 && runEvents==1);
+	}
+
+	// concurrent writers of a ring that does not overflow: every event is published once
+	{
+		const int writers = 4;
+		const int perWriter = 5000;
+		TraceBuffer buffer(writers*perWriter);
+		std::vector<std::thread> threads;
+		for(int w=0;w<writers;w++)
+		{
+			threads.push_back(std::thread([&buffer,w](){
+				for(int k=0;k<perWriter;k++)
+					buffer.add((int)Stage::Compute, w, k, k, k+1, 0);
+			}));
+		}
+		for(auto & t:threads)
+			t.join();
+
+		std::set<std::pair<size_t,size_t>> seen;
+		size_t events = 0;
+		bool consistent = true;
+		buffer.forEach([&](const TraceEvent & e){
+			events++;
+			seen.insert(std::make_pair(e.device,e.grain));
+			consistent = consistent && e.begin==e.grain && e.end==e.grain+1 && e.kind==(int)Stage::Compute;
+		});
+		failed += check("ring keeps all events of concurrent writers", consistent && events==(size_t)writers*perWriter && seen.size()==events);
+
+		// an overflowing ring keeps only latest events
+		TraceBuffer small(100);
+		for(int k=0;k<1000;k++)
+			small.add((int)Stage::Compute, 0, k, k, k+1, 0);
+		size_t kept = 0;
+		bool latest = true;
+		small.forEach([&](const TraceEvent & e){ kept++; latest = latest && e.grain>=900; });
+		failed += check("overflowing ring keeps latest events", kept==100 && latest);
+	}
+	return failed;
+}
@@ -0,0 +1,131 @@
+//============================================================================
+// Name        : test_workers.cpp
+// Description : composite devices (DeviceOptions::workers): share of a multi-worker device next to a single-thread device,
+//               work stealing between workers of a device with uneven grains
+//               g++ -std=c++14 -O2 -pthread test_workers.cpp -o test_workers && ./test_workers
+//               prints one line per case, exit code is number of failed cases (a deadlock fails after 60 seconds)
+//============================================================================
+
+#include <iostream>
+#include <cstdlib>
+
+#include "LoadBalancerX.h"
+
+using namespace LoadBalanceLib;
+
+class DeviceState
+{
+public:
+	int gpuId;
+};
+
+class GrainState
+{
+public:
+	int value;
+};
+
+const int grains = 400;
+
+// counts computations of each grain, grains of each device and thread that computed each grain
+class Counters
+{
+public:
+	Counters():computed(grains),perDevice(2),threads(grains){ reset(); }
+	std::vector<std::atomic<int>> computed;
+	std::vector<std::atomic<int>> perDevice;
+	std::vector<std::thread::id> threads;
+	std::thread::id deviceThread; // thread of device-0 (init is called by device thread)
+
+	void reset(){ for(auto & c:computed) c=0; for(auto & c:perDevice) c=0; }
+	bool exactlyOnce(){ for(auto & c:computed) if(c!=1) return false; return true; }
+};
+
+// grains sleep instead of spinning so that worker threads scale on a single core too
+void addGrains(LoadBalancerX<DeviceState,GrainState> & lb, Counters & counters, std::function<size_t(int)> sleepUs)
+{
+	for(int i=0;i<grains;i++)
+	{
+		lb.addWork(GrainOfWork<DeviceState,GrainState>(
+				[&counters](DeviceState gpu, GrainState&){ if(gpu.gpuId==0) counters.deviceThread=std::this_thread::get_id(); },
+				[](DeviceState, GrainState&){ },
+				[&counters,i,sleepUs](DeviceState gpu, GrainState&){
+					std::this_thread::sleep_for(std::chrono::microseconds(sleepUs(i)));
+					counters.threads[i]=std::this_thread::get_id();
+					counters.computed[i]++;
+					counters.perDevice[gpu.gpuId]++;
+				},
+				[](DeviceState, GrainState&){ },
+				[](DeviceState, GrainState&){ }));
+	}
+}
+
+DeviceOptions workerOptions(size_t workers)
+{
+	DeviceOptions options;
+	options.workers = workers;
+	return options;
+}
+
+int check(const char * name, bool ok)
+{
+	std::cout<<(ok?"ok   ":"FAIL ")<<name<<std::endl;
+	return ok?0:1;
+}
+
+// device with 4 workers is about 4 times faster than single-thread device
+int proportionalShare()
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Counters counters;
+	addGrains(lb, counters, [](int){ return (size_t)200; });
+	lb.addDevice(ComputeDevice<DeviceState>({0}), workerOptions(4));
+	lb.addDevice(ComputeDevice<DeviceState>({1}));
+	bool ok = true;
+	for(int r=0;r<15;r++)
+	{
+		counters.reset();
+		lb.run();
+		ok = ok && counters.exactlyOnce();
+	}
+	const double share = counters.perDevice[0]/(double)grains;
+	std::vector<double> performances = lb.getRelativePerformancesOfDevices();
+	std::cout<<"      share of 4-worker device = "<<share<<" ("<<performances[0]<<" : "<<performances[1]<<" relative performance)"<<std::endl;
+	return check("multi-worker device gets proportional share", ok && share>0.65 && share<0.92);
+}
+
+// first quarter of grains (initial range of worker 0) is 20 times slower, other workers steal from it
+int workStealing()
+{
+	LoadBalancerX<DeviceState,GrainState> lb;
+	Counters counters;
+	addGrains(lb, counters, [](int i){ return (size_t)(i<grains/4 ? 1000 : 50); });
+	lb.addDevice(ComputeDevice<DeviceState>({0}), workerOptions(4));
+	bool ok = true;
+	int stolen = 0;
+	for(int r=0;r<5;r++)
+	{
+		counters.reset();
+		lb.run();
+		ok = ok && counters.exactlyOnce() && counters.perDevice[0]==grains;
+		stolen = 0;
+		for(int i=0;i<grains/4;i++)
+			stolen += counters.threads[i]!=counters.deviceThread;
+	}
+	std::cout<<"      slow grains computed by other workers = "<<stolen<<" of "<<grains/4<<std::endl;
+	return check("work stealing covers all grains", ok && stolen>=grains/16);
+}
+
+int main() {
+	std::thread deadlock([](){
+		std::this_thread::sleep_for(std::chrono::seconds(60));
+		std::cout<<"FAIL deadlock"<<std::endl;
+		std::_Exit(1);
+	});
+	deadlock.detach();
+
+	int failed = 0;
+	failed += proportionalShare();
+	failed += workStealing();
+	return failed;
+}